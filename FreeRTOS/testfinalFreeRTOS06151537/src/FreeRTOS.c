@@ -29,6 +29,13 @@
 #define DATA_OUT_MIDLOW_OFFSET  0x30
 #define DATA_OUT_LOW_OFFSET     0x34
 
+// DES IP control (slv_reg4) and status (slv_reg7) bits
+#define DES_CTRL_START          0x01    // self-clearing
+#define DES_CTRL_DECRYPT        0x02
+#define DES_STATUS_DONE         0x01
+#define DES_STATUS_READY        0x02    // core idle, next block can be started
+#define DES_POLL_LIMIT          100000  // status reads before giving up
+
 // Simple data structure for queue
 typedef struct {
     uint32_t value1;
@@ -117,10 +124,14 @@ uint64_t des_encrypt_value(uint32_t value, uint64_t key) {
         return 0;
     }
     
-    // Reset DES IP completely
-    DESIP_mWriteReg(XPAR_DESIP_0_S00_AXI_BASEADDR, DESIP_S00_AXI_SLV_REG4_OFFSET, 0);
-    DESIP_mWriteReg(XPAR_DESIP_0_S00_AXI_BASEADDR, DESIP_S00_AXI_SLV_REG7_OFFSET, 0);
-    vTaskDelay(pdMS_TO_TICKS(20)); // Use FreeRTOS delay instead of usleep
+    // Wait until the core can take the next block (no reset delay needed)
+    while ((DESIP_mReadReg(XPAR_DESIP_0_S00_AXI_BASEADDR, DESIP_S00_AXI_SLV_REG7_OFFSET) & DES_STATUS_READY) == 0) {
+        if (++timeout > DES_POLL_LIMIT) {
+            safe_printf("ERROR: DES core not ready\r\n");
+            break;
+        }
+    }
+    timeout = 0;
 
     // Write plaintext (low first, then high)
     DESIP_mWriteReg(XPAR_DESIP_0_S00_AXI_BASEADDR, DESIP_S00_AXI_SLV_REG0_OFFSET, pt_low);
@@ -130,23 +141,20 @@ uint64_t des_encrypt_value(uint32_t value, uint64_t key) {
     DESIP_mWriteReg(XPAR_DESIP_0_S00_AXI_BASEADDR, DESIP_S00_AXI_SLV_REG2_OFFSET, key_low);
     DESIP_mWriteReg(XPAR_DESIP_0_S00_AXI_BASEADDR, DESIP_S00_AXI_SLV_REG3_OFFSET, key_high);
 
-    vTaskDelay(pdMS_TO_TICKS(10));
-
-    // Start encryption (bit 0 = start, bit 1 = 0 for encrypt)
-    DESIP_mWriteReg(XPAR_DESIP_0_S00_AXI_BASEADDR, DESIP_S00_AXI_SLV_REG4_OFFSET, 0x01);
+    // Start encryption (start bit clears itself)
+    DESIP_mWriteReg(XPAR_DESIP_0_S00_AXI_BASEADDR, DESIP_S00_AXI_SLV_REG4_OFFSET, DES_CTRL_START);
 
     // Wait for completion with timeout
     do {
-        vTaskDelay(pdMS_TO_TICKS(2));
         status = DESIP_mReadReg(XPAR_DESIP_0_S00_AXI_BASEADDR, DESIP_S00_AXI_SLV_REG7_OFFSET);
         timeout++;
-        if (timeout > 50) {
+        if (timeout > DES_POLL_LIMIT) {
             safe_printf("ERROR: DES encryption timeout\r\n");
             break;
         }
-    } while ((status & 0x01) == 0);
+    } while ((status & DES_STATUS_DONE) == 0);
 
-    if (status & 0x01) {
+    if (status & DES_STATUS_DONE) {
         // Read result
         res_low = DESIP_mReadReg(XPAR_DESIP_0_S00_AXI_BASEADDR, DESIP_S00_AXI_SLV_REG5_OFFSET);
         res_high = DESIP_mReadReg(XPAR_DESIP_0_S00_AXI_BASEADDR, DESIP_S00_AXI_SLV_REG6_OFFSET);
@@ -155,9 +163,6 @@ uint64_t des_encrypt_value(uint32_t value, uint64_t key) {
         res_high = 0;
     }
 
-    // Clear start signal
-    DESIP_mWriteReg(XPAR_DESIP_0_S00_AXI_BASEADDR, DESIP_S00_AXI_SLV_REG4_OFFSET, 0);
-    
     xSemaphoreGive(xIPCoreMutex);
 
     return ((uint64_t)res_high << 32) | res_low;
@@ -178,10 +183,14 @@ uint64_t des_decrypt_value(uint64_t encrypted_value, uint64_t key) {
         return 0;
     }
 
-    // Reset DES IP
-    DESIP_mWriteReg(XPAR_DESIP_0_S00_AXI_BASEADDR, DESIP_S00_AXI_SLV_REG4_OFFSET, 0);
-    DESIP_mWriteReg(XPAR_DESIP_0_S00_AXI_BASEADDR, DESIP_S00_AXI_SLV_REG7_OFFSET, 0);
-    vTaskDelay(pdMS_TO_TICKS(20));
+    // Wait until the core can take the next block (no reset delay needed)
+    while ((DESIP_mReadReg(XPAR_DESIP_0_S00_AXI_BASEADDR, DESIP_S00_AXI_SLV_REG7_OFFSET) & DES_STATUS_READY) == 0) {
+        if (++timeout > DES_POLL_LIMIT) {
+            safe_printf("ERROR: DES core not ready\r\n");
+            break;
+        }
+    }
+    timeout = 0;
 
     // Write ciphertext
     DESIP_mWriteReg(XPAR_DESIP_0_S00_AXI_BASEADDR, DESIP_S00_AXI_SLV_REG0_OFFSET, cipher_low);
@@ -191,23 +200,20 @@ uint64_t des_decrypt_value(uint64_t encrypted_value, uint64_t key) {
     DESIP_mWriteReg(XPAR_DESIP_0_S00_AXI_BASEADDR, DESIP_S00_AXI_SLV_REG2_OFFSET, key_low);
     DESIP_mWriteReg(XPAR_DESIP_0_S00_AXI_BASEADDR, DESIP_S00_AXI_SLV_REG3_OFFSET, key_high);
 
-    vTaskDelay(pdMS_TO_TICKS(10));
-
-    // Start decryption (bit 0 = start, bit 1 = 1 for decrypt)
-    DESIP_mWriteReg(XPAR_DESIP_0_S00_AXI_BASEADDR, DESIP_S00_AXI_SLV_REG4_OFFSET, 0x03);
+    // Start decryption (start bit clears itself)
+    DESIP_mWriteReg(XPAR_DESIP_0_S00_AXI_BASEADDR, DESIP_S00_AXI_SLV_REG4_OFFSET, DES_CTRL_START | DES_CTRL_DECRYPT);
 
     // Wait for completion
     do {
-        vTaskDelay(pdMS_TO_TICKS(2));
         status = DESIP_mReadReg(XPAR_DESIP_0_S00_AXI_BASEADDR, DESIP_S00_AXI_SLV_REG7_OFFSET);
         timeout++;
-        if (timeout > 50) {
+        if (timeout > DES_POLL_LIMIT) {
             safe_printf("ERROR: DES decryption timeout\r\n");
             break;
         }
-    } while ((status & 0x01) == 0);
+    } while ((status & DES_STATUS_DONE) == 0);
 
-    if (status & 0x01) {
+    if (status & DES_STATUS_DONE) {
         // Read result
         res_low = DESIP_mReadReg(XPAR_DESIP_0_S00_AXI_BASEADDR, DESIP_S00_AXI_SLV_REG5_OFFSET);
         res_high = DESIP_mReadReg(XPAR_DESIP_0_S00_AXI_BASEADDR, DESIP_S00_AXI_SLV_REG6_OFFSET);
@@ -216,9 +222,6 @@ uint64_t des_decrypt_value(uint64_t encrypted_value, uint64_t key) {
         res_high = 0;
     }
 
-    // Clear start signal
-    DESIP_mWriteReg(XPAR_DESIP_0_S00_AXI_BASEADDR, DESIP_S00_AXI_SLV_REG4_OFFSET, 0);
-    
     xSemaphoreGive(xIPCoreMutex);
 
     return ((uint64_t)res_high << 32) | res_low;
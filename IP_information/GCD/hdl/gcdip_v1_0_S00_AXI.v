@@ -15,7 +15,8 @@
 	)
 	(
 		// Users to add ports here
-
+		// _ACB⧹ͤWt
+		output wire intr,
 		// User ports ends
 		// Do not modify the ports beyond this line
 
@@ -108,6 +109,10 @@
 	reg [C_S_AXI_DATA_WIDTH-1:0]	slv_reg1;
 	reg [C_S_AXI_DATA_WIDTH-1:0]	slv_reg2;
 	reg [C_S_AXI_DATA_WIDTH-1:0]	slv_reg3;
+	// Soft reset, see the user logic
+	wire	 core_resetn;
+	reg [2:0]	 soft_reset_cnt;
+	wire	 soft_reset = (soft_reset_cnt != 3'd0);
 	wire	 slv_reg_rden;
 	wire	 slv_reg_wren;
 	reg [C_S_AXI_DATA_WIDTH-1:0]	 reg_data_out;
@@ -265,6 +270,9 @@
 	                    end
 	        endcase
 	      end
+	    // Soft reset is self-clearing, once the reset is over
+	    else if (slv_reg2[31] && !soft_reset)
+	      slv_reg2[31] <= 1'b0;
 	  end
 	end    
 
@@ -409,14 +417,14 @@ wire [7:0] wire_gcd_out;
 wire       rst_gcd;         // GCD֤ߪ_H
 
 // ͦGCD֤߻ݭnq_H
-assign rst_gcd = ~S_AXI_ARESETN;
+assign rst_gcd = ~core_resetn;
 
 // t˴޿
 assign start_pulse = slv_reg2[0] & ~start_prev;  // ˴startWt
 assign done_pulse = done_i & ~done_prev;         // ˴doneWt
 
 always @(posedge S_AXI_ACLK) begin
-    if (S_AXI_ARESETN == 1'b0) begin
+    if (core_resetn == 1'b0) begin
         reg_x_i     <= 8'b0;
         reg_y_i     <= 8'b0;
         reg_start_i <= 1'b0;
@@ -442,13 +450,52 @@ always @(posedge S_AXI_ACLK) begin
         end
         
         // p⧹ɡAsGslv_reg3
-        if (done_pulse) begin
+        if (start_pulse) begin
+            slv_reg3 <= 32'b0;        // sB}lɲMµGPX
+        end
+        else if (done_pulse) begin
             slv_reg3[7:0] <= wire_gcd_out;
-            slv_reg3[31:8] <= 24'b0;  // M
+            slv_reg3[8] <= 1'b1;      // X
+            slv_reg3[31:9] <= 23'b0;  // M
         end
     end
 end
 
+// _GGgJɳ]wAﱱȦs(slv_reg2)gJ|MA
+// קKsҰʮªXвͰWt
+reg  done_irq;
+wire ctrl_wr = slv_reg_wren && (axi_awaddr[ADDR_LSB+OPT_MEM_ADDR_BITS:ADDR_LSB] == 2'h2);
+
+always @(posedge S_AXI_ACLK) begin
+    if (core_resetn == 1'b0)
+        done_irq <= 1'b0;
+    else if (ctrl_wr)
+        done_irq <= 1'b0;
+    else if (done_pulse)
+        done_irq <= 1'b1;
+end
+
+// slv_reg2: [31] = soft reset, [0] = start, [1] = _P
+assign intr = done_irq & slv_reg2[1];
+
+// Soft reset: writing slv_reg2 bit 31 holds the GCD core, the start/done
+// edge logic, the result register and the interrupt in reset for
+// SOFT_RESET_CYCLES clocks, so a core spinning on a zero operand can be
+// stopped without a bus reset. The operand registers and the AXI interface
+// are left alone. Bit 31 reads back as 1 until the reset is over.
+localparam integer SOFT_RESET_CYCLES = 4;
+
+assign core_resetn = S_AXI_ARESETN & ~soft_reset;
+
+always @(posedge S_AXI_ACLK) begin
+    if (S_AXI_ARESETN == 1'b0)
+        soft_reset_cnt <= 3'd0;
+    else if (ctrl_wr && S_AXI_WSTRB[3] && S_AXI_WDATA[31])
+        soft_reset_cnt <= SOFT_RESET_CYCLES;
+    else if (soft_reset)
+        soft_reset_cnt <= soft_reset_cnt - 1'b1;
+end
+
 // ҤGCD֤
 gcdip u_gcd_core (
     .clk    (S_AXI_ACLK),
@@ -0,0 +1,750 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <linux/io_uring.h>
+#include "crypto_ioctl.h"
+#include "crypto_hybrid.h"
+#include "crypto_uio.h"
+
+// Throughput of the blocking ioctls versus io_uring passthrough
+// (IORING_OP_URING_CMD). Both paths run the same ops; the ring keeps
+// `depth` of them in flight and needs one io_uring_enter() per reap
+// instead of one ioctl() per op. Works on the board or on x86 with
+// `insmod crypto_ips.ko mock=1`.
+//
+// `crypto_bench hybrid [des|gcd|aes] [ops]` instead compares batches run
+// on the core alone with batches split by crypto_hybrid.
+//
+// `crypto_bench latency [des|gcd|aes] [ops]` measures single-op latency of
+// the ioctl path and of crypto_uio (polling and done interrupt), for each
+// path that is present: the ioctl path with the usual DT, the UIO ones
+// with system-user-uio.dtsi.
+//
+// `crypto_bench stream [des|aes] [KiB]` pushes STREAM_TOTAL bytes through a
+// CTR streaming session in writes of KiB (default 64), reading back what is
+// ready between writes, and reports MB/s. `crypto_bench xform [des|aes]`
+// runs the same bytes file to file with CRYPTO_FILE_XFORM instead.
+//
+// `crypto_bench qos [des|gcd|aes] [ops]` measures single-op latency while a
+// second process runs batches of CRYPTO_BATCH_MAX back-to-back, first with
+// both in the normal class, then with the batches as bulk and the single
+// ops as high (CRYPTO_SET_QOS).
+
+#define DEFAULT_OPS    100000
+#define DEFAULT_DEPTH  32
+#define HYBRID_BATCH   CRYPTO_BATCH_MAX
+#define LATENCY_WARMUP 100
+#define STREAM_TOTAL   (16 << 20)
+#define STREAM_CHUNK   64   // KiB
+#define QOS_SETTLE_US  100000
+
+union bench_op {
+    struct des_operation des;
+    struct gcd_operation gcd;
+    struct aes_operation aes;
+};
+
+struct ring {
+    int fd;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+};
+
+static int crypto_fd;
+static unsigned int bench_cmd;
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int sw_gcd(int a, int b) {
+    while (b) {
+        int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// Op i of the run, identical for both paths
+static void fill_op(union bench_op *op, unsigned int i) {
+    memset(op, 0, sizeof(*op));
+    switch (bench_cmd) {
+        case CRYPTO_DES_ENCRYPT:
+            op->des.key = 0x133457799BBCDFF1ULL;
+            op->des.input = i;
+            break;
+        case CRYPTO_GCD_CALC:
+            op->gcd.x = i % 255 + 1;
+            op->gcd.y = (i * 7) % 255 + 1;
+            break;
+        default:
+            op->aes.key[0] = 0x2B7E1516;
+            op->aes.key[1] = 0x28AED2A6;
+            op->aes.key[2] = 0xABF71588;
+            op->aes.key[3] = 0x09CF4F3C;
+            op->aes.input[0] = i;
+            break;
+    }
+}
+
+static int check_op(const union bench_op *op) {
+    if (bench_cmd == CRYPTO_GCD_CALC && op->gcd.result != sw_gcd(op->gcd.x, op->gcd.y)) {
+        printf("GCD(%d, %d) = %d, expected %d\n", op->gcd.x, op->gcd.y,
+               op->gcd.result, sw_gcd(op->gcd.x, op->gcd.y));
+        return -1;
+    }
+    return 0;
+}
+
+static double bench_ioctl(unsigned int ops) {
+    union bench_op op;
+    unsigned int i;
+    double start = now();
+
+    for (i = 0; i < ops; i++) {
+        fill_op(&op, i);
+        if (ioctl(crypto_fd, bench_cmd, &op) < 0) {
+            perror("ioctl failed");
+            return -1;
+        }
+        if (check_op(&op))
+            return -1;
+    }
+    return ops / (now() - start);
+}
+
+static int ring_setup(struct ring *r, unsigned int entries) {
+    struct io_uring_params p;
+    size_t sq_size, cq_size;
+    void *sq_ptr, *cq_ptr;
+
+    memset(&p, 0, sizeof(p));
+    r->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (r->fd < 0) {
+        perror("io_uring_setup failed");
+        return -1;
+    }
+
+    sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        sq_size = cq_size = sq_size > cq_size ? sq_size : cq_size;
+
+    sq_ptr = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  r->fd, IORING_OFF_SQ_RING);
+    if (sq_ptr == MAP_FAILED) {
+        perror("mmap SQ ring failed");
+        return -1;
+    }
+    cq_ptr = sq_ptr;
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+        cq_ptr = mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      r->fd, IORING_OFF_CQ_RING);
+        if (cq_ptr == MAP_FAILED) {
+            perror("mmap CQ ring failed");
+            return -1;
+        }
+    }
+    r->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        perror("mmap SQEs failed");
+        return -1;
+    }
+
+    r->sq_head = (unsigned *)((char *)sq_ptr + p.sq_off.head);
+    r->sq_tail = (unsigned *)((char *)sq_ptr + p.sq_off.tail);
+    r->sq_mask = (unsigned *)((char *)sq_ptr + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)((char *)sq_ptr + p.sq_off.array);
+    r->cq_head = (unsigned *)((char *)cq_ptr + p.cq_off.head);
+    r->cq_tail = (unsigned *)((char *)cq_ptr + p.cq_off.tail);
+    r->cq_mask = (unsigned *)((char *)cq_ptr + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)((char *)cq_ptr + p.cq_off.cqes);
+    return 0;
+}
+
+// Queue a URING_CMD for slot; published to the kernel by the next enter
+static void ring_queue(struct ring *r, union bench_op *op, unsigned int slot) {
+    unsigned tail = *r->sq_tail;
+    unsigned idx = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+    struct crypto_uring_cmd *cmd = (struct crypto_uring_cmd *)sqe->cmd;
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_URING_CMD;
+    sqe->fd = crypto_fd;
+    sqe->cmd_op = bench_cmd;
+    sqe->user_data = slot;
+    cmd->addr = (uintptr_t)op;
+    r->sq_array[idx] = idx;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+static double bench_uring(unsigned int ops, unsigned int depth) {
+    struct ring r;
+    union bench_op *slots;
+    unsigned int issued = 0, done = 0, to_submit = 0;
+    unsigned int slot, head;
+    double start;
+
+    if (ring_setup(&r, depth))
+        return -1;
+    slots = calloc(depth, sizeof(*slots));
+    if (!slots)
+        return -1;
+
+    start = now();
+    for (slot = 0; slot < depth && issued < ops; slot++, issued++, to_submit++) {
+        fill_op(&slots[slot], issued);
+        ring_queue(&r, &slots[slot], slot);
+    }
+
+    while (done < ops) {
+        if (syscall(__NR_io_uring_enter, r.fd, to_submit, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0) {
+            perror("io_uring_enter failed");
+            return -1;
+        }
+        to_submit = 0;
+
+        // Reap everything that is there and refill the freed slots
+        head = *r.cq_head;
+        while (head != __atomic_load_n(r.cq_tail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe *cqe = &r.cqes[head & *r.cq_mask];
+
+            slot = cqe->user_data;
+            if (cqe->res < 0) {
+                printf("op failed: %s\n", strerror(-cqe->res));
+                return -1;
+            }
+            if (check_op(&slots[slot]))
+                return -1;
+            done++;
+            head++;
+
+            if (issued < ops) {
+                fill_op(&slots[slot], issued++);
+                ring_queue(&r, &slots[slot], slot);
+                to_submit++;
+            }
+        }
+        __atomic_store_n(r.cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    free(slots);
+    close(r.fd);
+    return ops / (now() - start);
+}
+
+static unsigned int batch_cmd(void) {
+    if (bench_cmd == CRYPTO_DES_ENCRYPT)
+        return CRYPTO_DES_BATCH;
+    if (bench_cmd == CRYPTO_GCD_CALC)
+        return CRYPTO_GCD_BATCH;
+    return CRYPTO_AES_BATCH;
+}
+
+// Core-only batches, then hybrid batches of the same ops; the results of
+// both must agree
+static int bench_hybrid(unsigned int ops) {
+    enum crypto_hybrid_kind kind = bench_cmd == CRYPTO_DES_ENCRYPT ? CRYPTO_HYBRID_DES :
+                                   bench_cmd == CRYPTO_GCD_CALC ? CRYPTO_HYBRID_GCD :
+                                   CRYPTO_HYBRID_AES;
+    union bench_op *hw_ops, *hy_ops;
+    struct crypto_hybrid *h;
+    struct crypto_batch batch;
+    double start, hw_time = 0, hy_time = 0, hw_rate, sw_rate;
+    unsigned int done, n, i, mismatches = 0;
+    int ret = 0;
+    size_t op_size = bench_cmd == CRYPTO_DES_ENCRYPT ? sizeof(struct des_operation) :
+                     bench_cmd == CRYPTO_GCD_CALC ? sizeof(struct gcd_operation) :
+                     sizeof(struct aes_operation);
+
+    h = crypto_hybrid_open("/dev/crypto_ips", 0);
+    if (!h) {
+        perror("crypto_hybrid_open failed");
+        return -1;
+    }
+    crypto_hybrid_rates(h, kind, &hw_rate, &sw_rate);
+    printf("calibrated: core %.0f ops/s, software %.0f ops/s per worker\n", hw_rate, sw_rate);
+
+    hw_ops = calloc(HYBRID_BATCH, sizeof(*hw_ops));
+    hy_ops = calloc(HYBRID_BATCH, sizeof(*hy_ops));
+    if (!hw_ops || !hy_ops) {
+        ret = -1;
+        goto out;
+    }
+
+    for (done = 0; done < ops; done += n) {
+        n = ops - done < HYBRID_BATCH ? ops - done : HYBRID_BATCH;
+        // Packed arrays of the op type, as the batch ioctls expect
+        for (i = 0; i < n; i++) {
+            union bench_op op;
+
+            fill_op(&op, done + i);
+            memcpy((char *)hw_ops + i * op_size, &op, op_size);
+        }
+        memcpy(hy_ops, hw_ops, n * op_size);
+
+        memset(&batch, 0, sizeof(batch));
+        batch.ops = (uint64_t)(uintptr_t)hw_ops;
+        batch.count = n;
+        start = now();
+        if (ioctl(crypto_fd, batch_cmd(), &batch) < 0) {
+            perror("batch failed");
+            ret = -1;
+            goto out;
+        }
+        hw_time += now() - start;
+
+        batch.ops = (uint64_t)(uintptr_t)hy_ops;
+        start = now();
+        if (crypto_hybrid_batch(h, batch_cmd(), &batch) < 0) {
+            perror("hybrid batch failed");
+            ret = -1;
+            goto out;
+        }
+        hy_time += now() - start;
+
+        for (i = 0; i < n; i++)
+            if (memcmp((char *)hw_ops + i * op_size, (char *)hy_ops + i * op_size, op_size))
+                mismatches++;
+    }
+
+    crypto_hybrid_rates(h, kind, &hw_rate, &sw_rate);
+    printf("core only: %10.0f ops/s\n", ops / hw_time);
+    printf("hybrid:    %10.0f ops/s (%.2fx), %.0f%% on the core, %u mismatches\n",
+           ops / hy_time, hw_time / hy_time, 100 * crypto_hybrid_hw_share(h, kind), mismatches);
+    printf("adapted:   core %.0f ops/s, software %.0f ops/s per worker\n", hw_rate, sw_rate);
+    if (mismatches)
+        ret = -1;
+
+out:
+    free(hw_ops);
+    free(hy_ops);
+    crypto_hybrid_close(h);
+    return ret;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+typedef int (*latency_fn)(void *ctx, union bench_op *op);
+
+static int latency_ioctl(void *ctx, union bench_op *op) {
+    (void)ctx;
+    return ioctl(crypto_fd, bench_cmd, op);
+}
+
+static int latency_uio(void *ctx, union bench_op *op) {
+    struct crypto_uio *u = ctx;
+
+    if (bench_cmd == CRYPTO_DES_ENCRYPT)
+        return crypto_uio_des(u, &op->des, 0);
+    if (bench_cmd == CRYPTO_GCD_CALC)
+        return crypto_uio_gcd(u, &op->gcd);
+    return crypto_uio_aes_encrypt(u, &op->aes);
+}
+
+static int cmp_ns(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+// Time ops single ops, one after the other, after a short warm-up
+static int latency_run(const char *label, latency_fn fn, void *ctx, unsigned int ops,
+                       uint64_t *ns) {
+    union bench_op op;
+    unsigned int i;
+    uint64_t start, sum = 0;
+
+    for (i = 0; i < LATENCY_WARMUP + ops; i++) {
+        fill_op(&op, i);
+        start = now_ns();
+        if (fn(ctx, &op) < 0) {
+            printf("%-9s op failed: %s\n", label, strerror(errno));
+            return -1;
+        }
+        if (i >= LATENCY_WARMUP)
+            ns[i - LATENCY_WARMUP] = now_ns() - start;
+        if (check_op(&op))
+            return -1;
+    }
+
+    qsort(ns, ops, sizeof(*ns), cmp_ns);
+    for (i = 0; i < ops; i++)
+        sum += ns[i];
+    printf("%-9s %9.0f %9llu %9llu %9llu\n", label, (double)sum / ops,
+           (unsigned long long)ns[0], (unsigned long long)ns[ops / 2],
+           (unsigned long long)ns[ops - ops / 100 - 1]);
+    return 0;
+}
+
+static int bench_latency(unsigned int ops) {
+    enum crypto_uio_core core = bench_cmd == CRYPTO_DES_ENCRYPT ? CRYPTO_UIO_DES :
+                                bench_cmd == CRYPTO_GCD_CALC ? CRYPTO_UIO_GCD :
+                                CRYPTO_UIO_AES;
+    struct crypto_uio *u;
+    uint64_t *ns;
+    int irq, ret = 0;
+
+    ns = calloc(ops, sizeof(*ns));
+    if (!ns)
+        return -1;
+
+    printf("%-9s %9s %9s %9s %9s  (ns)\n", "path", "mean", "min", "p50", "p99");
+    if (crypto_fd >= 0)
+        ret |= latency_run("ioctl", latency_ioctl, NULL, ops, ns);
+    else
+        printf("%-9s /dev/crypto_ips not available\n", "ioctl");
+
+    for (irq = 0; irq < 2; irq++) {
+        const char *label = irq ? "uio irq" : "uio poll";
+
+        u = crypto_uio_open(core, irq);
+        if (!u) {
+            printf("%-9s %s\n", label, strerror(errno));
+            continue;
+        }
+        ret |= latency_run(label, latency_uio, u, ops, ns);
+        crypto_uio_close(u);
+    }
+
+    free(ns);
+    return ret;
+}
+
+// Back-to-back batches until killed, in the batch's own class
+static void qos_bulk(uint32_t flags) {
+    size_t op_size = bench_cmd == CRYPTO_DES_ENCRYPT ? sizeof(struct des_operation) :
+                     bench_cmd == CRYPTO_GCD_CALC ? sizeof(struct gcd_operation) :
+                     sizeof(struct aes_operation);
+    struct crypto_batch batch;
+    union bench_op *ops, op;
+    unsigned int i;
+    int fd;
+
+    fd = open("/dev/crypto_ips", O_RDWR);
+    ops = calloc(HYBRID_BATCH, sizeof(*ops));
+    if (fd < 0 || !ops)
+        _exit(1);
+    for (i = 0; i < HYBRID_BATCH; i++) {
+        fill_op(&op, i);
+        memcpy((char *)ops + i * op_size, &op, op_size);
+    }
+    for (;;) {
+        memset(&batch, 0, sizeof(batch));
+        batch.ops = (uint64_t)(uintptr_t)ops;
+        batch.count = HYBRID_BATCH;
+        batch.flags = flags;
+        if (ioctl(fd, batch_cmd(), &batch) < 0)
+            _exit(1);
+    }
+}
+
+// Single-op latency while another process keeps the cores busy with
+// batches: all in the normal class, then the batches as bulk and this fd
+// as high
+static int bench_qos(unsigned int ops) {
+    static const struct {
+        const char *label;
+        uint32_t prio;
+        uint32_t bulk_flags;
+    } rounds[] = {
+        { "normal", CRYPTO_PRIO_NORMAL, 0 },
+        { "high", CRYPTO_PRIO_HIGH, CRYPTO_BATCH_PRIO(CRYPTO_PRIO_BULK) },
+    };
+    struct crypto_qos qos = { 0 };
+    uint64_t *ns;
+    unsigned int i;
+    pid_t pid;
+    int ret = 0;
+
+    ns = calloc(ops, sizeof(*ns));
+    if (!ns)
+        return -1;
+
+    printf("%-9s %9s %9s %9s %9s  (ns)\n", "class", "mean", "min", "p50", "p99");
+    for (i = 0; i < sizeof(rounds) / sizeof(rounds[0]) && !ret; i++) {
+        qos.prio = rounds[i].prio;
+        if (ioctl(crypto_fd, CRYPTO_SET_QOS, &qos) < 0) {
+            perror("CRYPTO_SET_QOS failed");
+            ret = -1;
+            break;
+        }
+        pid = fork();
+        if (pid < 0) {
+            perror("fork failed");
+            ret = -1;
+            break;
+        }
+        if (pid == 0)
+            qos_bulk(rounds[i].bulk_flags);
+
+        // Let the batches fill the queues first
+        usleep(QOS_SETTLE_US);
+        ret = latency_run(rounds[i].label, latency_ioctl, NULL, ops, ns);
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+    }
+
+    free(ns);
+    return ret;
+}
+
+// First keystream block from the single-op ioctl: E(key, counter 0)
+static int stream_check(const struct crypto_stream_setup *setup, const uint8_t *out) {
+    struct des_operation des = { .input = 0, .key = setup->key.des };
+    struct aes_operation aes;
+    int i;
+
+    if (setup->key.engine == CRYPTO_KEY_DES) {
+        if (ioctl(crypto_fd, CRYPTO_DES_ENCRYPT, &des))
+            return -1;
+        for (i = 0; i < 8; i++)
+            if (out[i] != (uint8_t)(des.output >> (56 - 8 * i)))
+                return -1;
+        return 0;
+    }
+    memset(&aes, 0, sizeof(aes));
+    memcpy(aes.key, setup->key.aes, sizeof(aes.key));
+    if (ioctl(crypto_fd, CRYPTO_AES_ENCRYPT, &aes))
+        return -1;
+    for (i = 0; i < 16; i++)
+        if (out[i] != (uint8_t)(aes.output[i / 4] >> (24 - 8 * (i % 4))))
+            return -1;
+    return 0;
+}
+
+static void stream_key(struct crypto_stream_setup *setup) {
+    uint32_t key[4] = { 0x2b7e1516, 0x28aed2a6, 0xabf71588, 0x09cf4f3c };
+
+    memset(setup, 0, sizeof(*setup));
+    if (bench_cmd == CRYPTO_DES_ENCRYPT) {
+        setup->key.engine = CRYPTO_KEY_DES;
+        setup->key.des = 0x133457799BBCDFF1ULL;
+    } else {
+        setup->key.engine = CRYPTO_KEY_AES;
+        memcpy(setup->key.aes, key, sizeof(key));
+    }
+}
+
+static int bench_stream(size_t chunk) {
+    struct crypto_stream_setup setup;
+    size_t written = 0, got = 0;
+    uint8_t *in, *out;
+    ssize_t n;
+    double t;
+    int ret = -1;
+
+    stream_key(&setup);
+    if (ioctl(crypto_fd, CRYPTO_STREAM_SETUP, &setup)) {
+        perror("CRYPTO_STREAM_SETUP");
+        return -1;
+    }
+
+    // Zero plaintext, so the output is the keystream
+    in = calloc(1, chunk);
+    out = malloc(chunk);
+    if (!in || !out)
+        goto out;
+
+    t = now();
+    while (got < STREAM_TOTAL) {
+        if (written < STREAM_TOTAL) {
+            n = write(crypto_fd, in, STREAM_TOTAL - written < chunk ? STREAM_TOTAL - written : chunk);
+            if (n < 0) {
+                perror("write");
+                goto out;
+            }
+            written += n;
+        }
+        n = read(crypto_fd, out, chunk);
+        if (n < 0) {
+            perror("read");
+            goto out;
+        }
+        if (got == 0 && n >= 16 && stream_check(&setup, out)) {
+            printf("stream output differs from CRYPTO_*_ENCRYPT\n");
+            goto out;
+        }
+        got += n;
+    }
+    t = now() - t;
+    printf("stream:    %10.2f MB/s\n", STREAM_TOTAL / t / 1e6);
+    ret = 0;
+out:
+    free(in);
+    free(out);
+    return ret;
+}
+
+// Zeros in an unlinked temp file, through the cipher into another one
+static int bench_xform(void) {
+    struct crypto_file_xform xf;
+    char in_path[] = "/tmp/crypto_bench.XXXXXX", out_path[] = "/tmp/crypto_bench.XXXXXX";
+    uint8_t out[16];
+    int in_fd, out_fd, ret = -1;
+    double t;
+
+    in_fd = mkstemp(in_path);
+    out_fd = mkstemp(out_path);
+    if (in_fd < 0 || out_fd < 0) {
+        perror("mkstemp");
+        goto out;
+    }
+    unlink(in_path);
+    unlink(out_path);
+    if (ftruncate(in_fd, STREAM_TOTAL)) {
+        perror("ftruncate");
+        goto out;
+    }
+
+    memset(&xf, 0, sizeof(xf));
+    stream_key(&xf.cipher);
+    xf.in_fd = in_fd;
+    xf.out_fd = out_fd;
+    xf.length = STREAM_TOTAL;
+    t = now();
+    if (ioctl(crypto_fd, CRYPTO_FILE_XFORM, &xf)) {
+        perror("CRYPTO_FILE_XFORM");
+        goto out;
+    }
+    t = now() - t;
+    if (xf.done != STREAM_TOTAL || pread(out_fd, out, sizeof(out), 0) != sizeof(out) ||
+        stream_check(&xf.cipher, out)) {
+        printf("xform output differs from CRYPTO_*_ENCRYPT\n");
+        goto out;
+    }
+    printf("xform:     %10.2f MB/s\n", STREAM_TOTAL / t / 1e6);
+    ret = 0;
+out:
+    if (in_fd >= 0)
+        close(in_fd);
+    if (out_fd >= 0)
+        close(out_fd);
+    return ret;
+}
+
+int main(int argc, char *argv[]) {
+    unsigned int ops = DEFAULT_OPS, depth = DEFAULT_DEPTH;
+    int hybrid = argc > 1 && strcmp(argv[1], "hybrid") == 0;
+    int latency = argc > 1 && strcmp(argv[1], "latency") == 0;
+    int stream = argc > 1 && strcmp(argv[1], "stream") == 0;
+    int xform = argc > 1 && strcmp(argv[1], "xform") == 0;
+    int qos = argc > 1 && strcmp(argv[1], "qos") == 0;
+    const char *prog = argv[0], *name;
+    double ioctl_rate, uring_rate;
+    int ret;
+
+    if (hybrid || latency || stream || xform || qos) {
+        argv++;
+        argc--;
+    }
+    name = argc > 1 ? argv[1] : "des";
+    if (strcmp(name, "des") == 0) {
+        bench_cmd = CRYPTO_DES_ENCRYPT;
+    } else if (strcmp(name, "gcd") == 0) {
+        bench_cmd = CRYPTO_GCD_CALC;
+    } else if (strcmp(name, "aes") == 0) {
+        bench_cmd = CRYPTO_AES_ENCRYPT;
+    } else {
+        printf("Usage: %s [hybrid|latency|stream|xform|qos] [des|gcd|aes] [ops] [depth]\n", prog);
+        return 1;
+    }
+    if ((stream || xform) && bench_cmd == CRYPTO_GCD_CALC) {
+        printf("%s: des or aes only\n", stream ? "stream" : "xform");
+        return 1;
+    }
+    if (argc > 2) ops = strtoul(argv[2], NULL, 0);
+    if (argc > 3) depth = strtoul(argv[3], NULL, 0);
+    if (ops == 0 || depth == 0) {
+        printf("ops and depth must be positive\n");
+        return 1;
+    }
+
+    crypto_fd = open("/dev/crypto_ips", O_RDWR);
+    if (latency) {
+        // Either path may be missing, depending on the DT
+        printf("%s: %u single ops\n", name, ops);
+        ret = bench_latency(ops);
+        if (crypto_fd >= 0)
+            close(crypto_fd);
+        return ret ? 1 : 0;
+    }
+    if (crypto_fd == -1) {
+        perror("cannot open the device crypto_ips!!");
+        exit(1);
+    }
+
+    if (qos) {
+        printf("%s: %u single ops next to batches of %u\n", name, ops, HYBRID_BATCH);
+        ret = bench_qos(ops);
+        close(crypto_fd);
+        return ret ? 1 : 0;
+    }
+
+    if (xform) {
+        printf("%s: %u MiB file to file\n", name, STREAM_TOTAL >> 20);
+        ret = bench_xform();
+        close(crypto_fd);
+        return ret ? 1 : 0;
+    }
+
+    if (stream) {
+        unsigned int kib = argc > 2 ? ops : STREAM_CHUNK;
+
+        printf("%s: %u MiB through a CTR stream, %u KiB writes\n", name, STREAM_TOTAL >> 20, kib);
+        ret = bench_stream((size_t)kib << 10);
+        close(crypto_fd);
+        return ret ? 1 : 0;
+    }
+
+    if (hybrid) {
+        printf("%s: %u ops in batches of %u\n", name, ops, HYBRID_BATCH);
+        if (bench_hybrid(ops) < 0) {
+            close(crypto_fd);
+            return 1;
+        }
+        close(crypto_fd);
+        return 0;
+    }
+
+    printf("%s: %u ops, ring depth %u\n", name, ops, depth);
+    ioctl_rate = bench_ioctl(ops);
+    if (ioctl_rate < 0) {
+        close(crypto_fd);
+        return 1;
+    }
+    printf("ioctl:     %10.0f ops/s\n", ioctl_rate);
+
+    uring_rate = bench_uring(ops, depth);
+    if (uring_rate < 0) {
+        close(crypto_fd);
+        return 1;
+    }
+    printf("uring_cmd: %10.0f ops/s (%.2fx)\n", uring_rate, uring_rate / ioctl_rate);
+
+    close(crypto_fd);
+    return 0;
+}
@@ -0,0 +1,611 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include "crypto_hybrid.h"
+
+#define CALIBRATE_OPS   256
+#define SHARE_MIN       0.05    // keep both sides measured
+#define SHARE_MAX       0.95
+#define RATE_WEIGHT     0.25    // weight of the newest measurement
+
+struct crypto_hybrid {
+    int fd;
+    int workers;
+    pthread_mutex_t lock;   // rates and shares
+    double hw_rate[CRYPTO_HYBRID_KINDS];
+    double sw_rate[CRYPTO_HYBRID_KINDS];    // one worker
+    double hw_share[CRYPTO_HYBRID_KINDS];
+    int sw_ok[CRYPTO_HYBRID_KINDS];         // software matches the core
+};
+
+// A contiguous part of a batch run by one software worker
+struct soft_slice {
+    pthread_t thread;
+    int threaded;
+    enum crypto_hybrid_kind kind;
+    int decrypt;
+    void *ops;
+    int32_t *status;
+    uint32_t first;
+    uint32_t count;
+    double elapsed;
+};
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Software DES
+//
+// Table-driven: the initial and final permutations are eight byte lookups
+// each, and every round is eight lookups in tables that combine an S-box
+// with the P permutation. Tables are built once from the FIPS 46 ones.
+// Bit positions count from 1 at the most significant bit.
+
+static const uint8_t des_ip[64] = {
+    58, 50, 42, 34, 26, 18, 10, 2, 60, 52, 44, 36, 28, 20, 12, 4,
+    62, 54, 46, 38, 30, 22, 14, 6, 64, 56, 48, 40, 32, 24, 16, 8,
+    57, 49, 41, 33, 25, 17, 9, 1, 59, 51, 43, 35, 27, 19, 11, 3,
+    61, 53, 45, 37, 29, 21, 13, 5, 63, 55, 47, 39, 31, 23, 15, 7,
+};
+
+static const uint8_t des_fp[64] = {
+    40, 8, 48, 16, 56, 24, 64, 32, 39, 7, 47, 15, 55, 23, 63, 31,
+    38, 6, 46, 14, 54, 22, 62, 30, 37, 5, 45, 13, 53, 21, 61, 29,
+    36, 4, 44, 12, 52, 20, 60, 28, 35, 3, 43, 11, 51, 19, 59, 27,
+    34, 2, 42, 10, 50, 18, 58, 26, 33, 1, 41, 9, 49, 17, 57, 25,
+};
+
+static const uint8_t des_p[32] = {
+    16, 7, 20, 21, 29, 12, 28, 17, 1, 15, 23, 26, 5, 18, 31, 10,
+    2, 8, 24, 14, 32, 27, 3, 9, 19, 13, 30, 6, 22, 11, 4, 25,
+};
+
+static const uint8_t des_pc1[56] = {
+    57, 49, 41, 33, 25, 17, 9, 1, 58, 50, 42, 34, 26, 18,
+    10, 2, 59, 51, 43, 35, 27, 19, 11, 3, 60, 52, 44, 36,
+    63, 55, 47, 39, 31, 23, 15, 7, 62, 54, 46, 38, 30, 22,
+    14, 6, 61, 53, 45, 37, 29, 21, 13, 5, 28, 20, 12, 4,
+};
+
+static const uint8_t des_pc2[48] = {
+    14, 17, 11, 24, 1, 5, 3, 28, 15, 6, 21, 10,
+    23, 19, 12, 4, 26, 8, 16, 7, 27, 20, 13, 2,
+    41, 52, 31, 37, 47, 55, 30, 40, 51, 45, 33, 48,
+    44, 49, 39, 56, 34, 53, 46, 42, 50, 36, 29, 32,
+};
+
+static const uint8_t des_shifts[16] = { 1, 1, 2, 2, 2, 2, 2, 2, 1, 2, 2, 2, 2, 2, 2, 1 };
+
+static const uint8_t des_sbox[8][64] = {
+    { 14, 4, 13, 1, 2, 15, 11, 8, 3, 10, 6, 12, 5, 9, 0, 7,
+      0, 15, 7, 4, 14, 2, 13, 1, 10, 6, 12, 11, 9, 5, 3, 8,
+      4, 1, 14, 8, 13, 6, 2, 11, 15, 12, 9, 7, 3, 10, 5, 0,
+      15, 12, 8, 2, 4, 9, 1, 7, 5, 11, 3, 14, 10, 0, 6, 13 },
+    { 15, 1, 8, 14, 6, 11, 3, 4, 9, 7, 2, 13, 12, 0, 5, 10,
+      3, 13, 4, 7, 15, 2, 8, 14, 12, 0, 1, 10, 6, 9, 11, 5,
+      0, 14, 7, 11, 10, 4, 13, 1, 5, 8, 12, 6, 9, 3, 2, 15,
+      13, 8, 10, 1, 3, 15, 4, 2, 11, 6, 7, 12, 0, 5, 14, 9 },
+    { 10, 0, 9, 14, 6, 3, 15, 5, 1, 13, 12, 7, 11, 4, 2, 8,
+      13, 7, 0, 9, 3, 4, 6, 10, 2, 8, 5, 14, 12, 11, 15, 1,
+      13, 6, 4, 9, 8, 15, 3, 0, 11, 1, 2, 12, 5, 10, 14, 7,
+      1, 10, 13, 0, 6, 9, 8, 7, 4, 15, 14, 3, 11, 5, 2, 12 },
+    { 7, 13, 14, 3, 0, 6, 9, 10, 1, 2, 8, 5, 11, 12, 4, 15,
+      13, 8, 11, 5, 6, 15, 0, 3, 4, 7, 2, 12, 1, 10, 14, 9,
+      10, 6, 9, 0, 12, 11, 7, 13, 15, 1, 3, 14, 5, 2, 8, 4,
+      3, 15, 0, 6, 10, 1, 13, 8, 9, 4, 5, 11, 12, 7, 2, 14 },
+    { 2, 12, 4, 1, 7, 10, 11, 6, 8, 5, 3, 15, 13, 0, 14, 9,
+      14, 11, 2, 12, 4, 7, 13, 1, 5, 0, 15, 10, 3, 9, 8, 6,
+      4, 2, 1, 11, 10, 13, 7, 8, 15, 9, 12, 5, 6, 3, 0, 14,
+      11, 8, 12, 7, 1, 14, 2, 13, 6, 15, 0, 9, 10, 4, 5, 3 },
+    { 12, 1, 10, 15, 9, 2, 6, 8, 0, 13, 3, 4, 14, 7, 5, 11,
+      10, 15, 4, 2, 7, 12, 9, 5, 6, 1, 13, 14, 0, 11, 3, 8,
+      9, 14, 15, 5, 2, 8, 12, 3, 7, 0, 4, 10, 1, 13, 11, 6,
+      4, 3, 2, 12, 9, 5, 15, 10, 11, 14, 1, 7, 6, 0, 8, 13 },
+    { 4, 11, 2, 14, 15, 0, 8, 13, 3, 12, 9, 7, 5, 10, 6, 1,
+      13, 0, 11, 7, 4, 9, 1, 10, 14, 3, 5, 12, 2, 15, 8, 6,
+      1, 4, 11, 13, 12, 3, 7, 14, 10, 15, 6, 8, 0, 5, 9, 2,
+      6, 11, 13, 8, 1, 4, 10, 7, 9, 5, 0, 15, 14, 2, 3, 12 },
+    { 13, 2, 8, 4, 6, 15, 11, 1, 10, 9, 3, 14, 5, 0, 12, 7,
+      1, 15, 13, 8, 10, 3, 7, 4, 12, 5, 6, 11, 0, 14, 9, 2,
+      7, 11, 4, 1, 9, 12, 14, 2, 0, 6, 10, 13, 15, 3, 5, 8,
+      2, 1, 14, 7, 4, 10, 8, 13, 15, 12, 9, 0, 3, 5, 6, 11 },
+};
+
+static uint64_t des_ip_tab[8][256];
+static uint64_t des_fp_tab[8][256];
+static uint32_t des_sp[8][64];
+
+// Software AES-128 (encryption), T-tables built from the S-box
+static uint8_t aes_sbox[256];
+static uint32_t aes_te[4][256];
+
+static pthread_once_t soft_once = PTHREAD_ONCE_INIT;
+
+static uint64_t permute(uint64_t in, int in_bits, const uint8_t *table, int n) {
+    uint64_t out = 0;
+    int i;
+
+    for (i = 0; i < n; i++)
+        out = (out << 1) | ((in >> (in_bits - table[i])) & 1);
+    return out;
+}
+
+static uint8_t aes_xtime(uint8_t x) {
+    return (x << 1) ^ ((x & 0x80) ? 0x1b : 0);
+}
+
+static void soft_init(void) {
+    uint8_t p = 1, q = 1, s;
+    int i, j, b;
+
+    // A 64-bit permutation is linear in the bits, so it is the XOR of the
+    // permutations of each input byte on its own
+    for (i = 0; i < 8; i++) {
+        for (b = 0; b < 256; b++) {
+            des_ip_tab[i][b] = permute((uint64_t)b << (56 - 8 * i), 64, des_ip, 64);
+            des_fp_tab[i][b] = permute((uint64_t)b << (56 - 8 * i), 64, des_fp, 64);
+        }
+    }
+    // S-box j feeds output bits 4j+1..4j+4; the row is the outer two input
+    // bits, the column the inner four
+    for (j = 0; j < 8; j++) {
+        for (b = 0; b < 64; b++) {
+            s = des_sbox[j][(((b >> 4) & 2) | (b & 1)) * 16 + ((b >> 1) & 0xf)];
+            des_sp[j][b] = (uint32_t)permute((uint64_t)s << (28 - 4 * j), 32, des_p, 32);
+        }
+    }
+
+    // S-box from the multiplicative inverse (walking 3^k and 3^-k) and the
+    // affine transform
+    do {
+        p = p ^ aes_xtime(p);
+        q ^= q << 1;
+        q ^= q << 2;
+        q ^= q << 4;
+        if (q & 0x80)
+            q ^= 0x09;
+        s = q ^ (uint8_t)((q << 1) | (q >> 7)) ^ (uint8_t)((q << 2) | (q >> 6)) ^
+            (uint8_t)((q << 3) | (q >> 5)) ^ (uint8_t)((q << 4) | (q >> 4));
+        aes_sbox[p] = s ^ 0x63;
+    } while (p != 1);
+    aes_sbox[0] = 0x63;
+
+    for (i = 0; i < 256; i++) {
+        s = aes_sbox[i];
+        aes_te[0][i] = ((uint32_t)aes_xtime(s) << 24) | ((uint32_t)s << 16) |
+                       ((uint32_t)s << 8) | (uint8_t)(aes_xtime(s) ^ s);
+        for (j = 1; j < 4; j++)
+            aes_te[j][i] = (aes_te[j - 1][i] >> 8) | (aes_te[j - 1][i] << 24);
+    }
+}
+
+static uint64_t des_perm_bytes(uint64_t in, uint64_t tab[8][256]) {
+    uint64_t out = 0;
+    int i;
+
+    for (i = 0; i < 8; i++)
+        out |= tab[i][(in >> (56 - 8 * i)) & 0xff];
+    return out;
+}
+
+struct soft_des_key {
+    uint64_t key;
+    int valid;
+    uint64_t k[16];     // 48-bit round keys
+};
+
+static void soft_des_setkey(struct soft_des_key *ks, uint64_t key) {
+    uint64_t cd = permute(key, 64, des_pc1, 56);
+    uint32_t c = cd >> 28, d = cd & 0xfffffff;
+    int i;
+
+    for (i = 0; i < 16; i++) {
+        c = ((c << des_shifts[i]) | (c >> (28 - des_shifts[i]))) & 0xfffffff;
+        d = ((d << des_shifts[i]) | (d >> (28 - des_shifts[i]))) & 0xfffffff;
+        ks->k[i] = permute(((uint64_t)c << 28) | d, 56, des_pc2, 48);
+    }
+    ks->key = key;
+    ks->valid = 1;
+}
+
+static uint64_t soft_des_block(const struct soft_des_key *ks, uint64_t in, int decrypt) {
+    uint64_t x = des_perm_bytes(in, des_ip_tab);
+    uint32_t l = x >> 32, r = (uint32_t)x, t, f;
+    uint64_t k;
+    int i, j;
+
+    for (i = 0; i < 16; i++) {
+        k = ks->k[decrypt ? 15 - i : i];
+        f = 0;
+        // Expansion: bits 4j..4j+5 of r, wrapping around
+        for (j = 0; j < 8; j++) {
+            t = (r >> ((27 - 4 * j) & 31)) | (r << ((5 + 4 * j) & 31));
+            f |= des_sp[j][(t ^ (uint32_t)(k >> (42 - 6 * j))) & 0x3f];
+        }
+        t = r;
+        r = l ^ f;
+        l = t;
+    }
+    return des_perm_bytes(((uint64_t)r << 32) | l, des_fp_tab);
+}
+
+struct soft_aes_key {
+    uint32_t key[4];
+    int valid;
+    uint32_t rk[44];
+};
+
+static void soft_aes_setkey(struct soft_aes_key *ks, const uint32_t key[4]) {
+    uint32_t t, rcon = 1;
+    int i;
+
+    memcpy(ks->rk, key, 16);
+    for (i = 4; i < 44; i++) {
+        t = ks->rk[i - 1];
+        if (i % 4 == 0) {
+            t = ((uint32_t)aes_sbox[(t >> 16) & 0xff] << 24) |
+                ((uint32_t)aes_sbox[(t >> 8) & 0xff] << 16) |
+                ((uint32_t)aes_sbox[t & 0xff] << 8) | aes_sbox[t >> 24];
+            t ^= rcon << 24;
+            rcon = aes_xtime(rcon);
+        }
+        ks->rk[i] = ks->rk[i - 4] ^ t;
+    }
+    memcpy(ks->key, key, 16);
+    ks->valid = 1;
+}
+
+static void soft_aes_block(const struct soft_aes_key *ks, const uint32_t in[4], uint32_t out[4]) {
+    const uint32_t *rk = ks->rk;
+    uint32_t s[4], t[4];
+    int r, i;
+
+    for (i = 0; i < 4; i++)
+        s[i] = in[i] ^ rk[i];
+    for (r = 1; r < 10; r++) {
+        rk += 4;
+        for (i = 0; i < 4; i++)
+            t[i] = aes_te[0][s[i] >> 24] ^ aes_te[1][(s[(i + 1) & 3] >> 16) & 0xff] ^
+                   aes_te[2][(s[(i + 2) & 3] >> 8) & 0xff] ^ aes_te[3][s[(i + 3) & 3] & 0xff] ^
+                   rk[i];
+        memcpy(s, t, sizeof(s));
+    }
+    rk += 4;
+    for (i = 0; i < 4; i++)
+        out[i] = (((uint32_t)aes_sbox[s[i] >> 24] << 24) |
+                  ((uint32_t)aes_sbox[(s[(i + 1) & 3] >> 16) & 0xff] << 16) |
+                  ((uint32_t)aes_sbox[(s[(i + 2) & 3] >> 8) & 0xff] << 8) |
+                  aes_sbox[s[(i + 3) & 3] & 0xff]) ^ rk[i];
+}
+
+uint64_t crypto_soft_des(uint64_t key, uint64_t input, int decrypt) {
+    struct soft_des_key ks;
+
+    pthread_once(&soft_once, soft_init);
+    soft_des_setkey(&ks, key);
+    return soft_des_block(&ks, input, decrypt);
+}
+
+void crypto_soft_aes_encrypt(const uint32_t key[4], const uint32_t input[4], uint32_t output[4]) {
+    struct soft_aes_key ks;
+
+    pthread_once(&soft_once, soft_init);
+    soft_aes_setkey(&ks, key);
+    soft_aes_block(&ks, input, output);
+}
+
+// The core works on 8-bit operands
+int crypto_soft_gcd(int x, int y) {
+    unsigned int a = x & 0xff, b = y & 0xff, t;
+
+    while (b) {
+        t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// Run a slice in software; the round keys are kept while the key repeats
+static void soft_run(struct soft_slice *s) {
+    struct soft_des_key dk = { .valid = 0 };
+    struct soft_aes_key ak = { .valid = 0 };
+    uint32_t i, end = s->first + s->count;
+    double start = now();
+
+    for (i = s->first; i < end; i++) {
+        if (s->kind == CRYPTO_HYBRID_DES) {
+            struct des_operation *op = (struct des_operation *)s->ops + i;
+
+            if (!dk.valid || dk.key != op->key)
+                soft_des_setkey(&dk, op->key);
+            op->output = soft_des_block(&dk, op->input, s->decrypt);
+        } else if (s->kind == CRYPTO_HYBRID_AES) {
+            struct aes_operation *op = (struct aes_operation *)s->ops + i;
+
+            if (!ak.valid || memcmp(ak.key, op->key, sizeof(ak.key)))
+                soft_aes_setkey(&ak, op->key);
+            soft_aes_block(&ak, op->input, op->output);
+        } else {
+            struct gcd_operation *op = (struct gcd_operation *)s->ops + i;
+
+            op->result = crypto_soft_gcd(op->x, op->y);
+        }
+        if (s->status)
+            s->status[i] = 0;
+    }
+    s->elapsed = now() - start;
+}
+
+static void *soft_thread(void *arg) {
+    soft_run(arg);
+    return NULL;
+}
+
+static int kind_of(unsigned int cmd, size_t *op_size) {
+    switch (cmd) {
+        case CRYPTO_DES_BATCH:
+            *op_size = sizeof(struct des_operation);
+            return CRYPTO_HYBRID_DES;
+        case CRYPTO_AES_BATCH:
+            *op_size = sizeof(struct aes_operation);
+            return CRYPTO_HYBRID_AES;
+        case CRYPTO_GCD_BATCH:
+            *op_size = sizeof(struct gcd_operation);
+            return CRYPTO_HYBRID_GCD;
+        default:
+            return -1;
+    }
+}
+
+// ops[first, first + count) through the core, CRYPTO_BATCH_MAX at a time.
+// *done counts the ops processed, including one that failed.
+static int hw_run(struct crypto_hybrid *h, unsigned int cmd, uint32_t flags, void *ops,
+                  size_t op_size, int32_t *status, uint32_t first, uint32_t count, uint32_t *done) {
+    struct crypto_batch b;
+    uint32_t n;
+
+    *done = 0;
+    while (*done < count) {
+        n = count - *done;
+        if (n > CRYPTO_BATCH_MAX)
+            n = CRYPTO_BATCH_MAX;
+        memset(&b, 0, sizeof(b));
+        b.ops = (uint64_t)(uintptr_t)((char *)ops + (size_t)(first + *done) * op_size);
+        b.status = status ? (uint64_t)(uintptr_t)(status + first + *done) : 0;
+        b.count = n;
+        b.flags = flags;
+        if (ioctl(h->fd, cmd, &b) < 0) {
+            *done += b.done;
+            return -1;
+        }
+        *done += n;
+    }
+    return 0;
+}
+
+static void fill_calibration(int kind, void *ops, uint32_t i) {
+    if (kind == CRYPTO_HYBRID_DES) {
+        struct des_operation *op = (struct des_operation *)ops + i;
+
+        op->key = 0x133457799BBCDFF1ULL;
+        op->input = 0x0123456789ABCDEFULL + i;
+    } else if (kind == CRYPTO_HYBRID_AES) {
+        struct aes_operation *op = (struct aes_operation *)ops + i;
+        static const uint32_t key[4] = { 0x2B7E1516, 0x28AED2A6, 0xABF71588, 0x09CF4F3C };
+
+        memcpy(op->key, key, sizeof(op->key));
+        op->input[0] = 0x3243F6A8;
+        op->input[1] = 0x885A308D;
+        op->input[2] = 0x313198A2;
+        op->input[3] = 0xE0370734 + i;
+    } else {
+        struct gcd_operation *op = (struct gcd_operation *)ops + i;
+
+        op->x = (i * 37) % 255 + 1;
+        op->y = (i * 91) % 255 + 1;
+    }
+}
+
+// Time the same ops on the core and on one software worker, and check that
+// both give the same results
+static int calibrate(struct crypto_hybrid *h, int kind) {
+    static const unsigned int cmds[] = { CRYPTO_DES_BATCH, CRYPTO_AES_BATCH, CRYPTO_GCD_BATCH };
+    struct soft_slice s = { .kind = kind, .count = CALIBRATE_OPS };
+    void *hw_ops, *sw_ops;
+    size_t op_size = 0;
+    uint32_t i, done;
+    double start, t_hw;
+
+    kind_of(cmds[kind], &op_size);
+    hw_ops = calloc(CALIBRATE_OPS, op_size);
+    sw_ops = calloc(CALIBRATE_OPS, op_size);
+    if (!hw_ops || !sw_ops) {
+        free(hw_ops);
+        free(sw_ops);
+        return -1;
+    }
+    for (i = 0; i < CALIBRATE_OPS; i++)
+        fill_calibration(kind, hw_ops, i);
+    memcpy(sw_ops, hw_ops, CALIBRATE_OPS * op_size);
+
+    start = now();
+    if (hw_run(h, cmds[kind], 0, hw_ops, op_size, NULL, 0, CALIBRATE_OPS, &done)) {
+        free(hw_ops);
+        free(sw_ops);
+        return -1;
+    }
+    t_hw = now() - start;
+
+    s.ops = sw_ops;
+    soft_run(&s);
+
+    h->hw_rate[kind] = CALIBRATE_OPS / t_hw;
+    h->sw_rate[kind] = CALIBRATE_OPS / (s.elapsed > 0 ? s.elapsed : 1e-9);
+    h->sw_ok[kind] = !memcmp(hw_ops, sw_ops, CALIBRATE_OPS * op_size);
+    if (!h->sw_ok[kind])
+        fprintf(stderr, "crypto_hybrid: software %s differs from the core, not splitting\n",
+                kind == CRYPTO_HYBRID_DES ? "DES" : kind == CRYPTO_HYBRID_AES ? "AES" : "GCD");
+
+    free(hw_ops);
+    free(sw_ops);
+    return 0;
+}
+
+struct crypto_hybrid *crypto_hybrid_open(const char *path, int workers) {
+    struct crypto_hybrid *h;
+    int kind, err;
+
+    pthread_once(&soft_once, soft_init);
+
+    h = calloc(1, sizeof(*h));
+    if (!h)
+        return NULL;
+    h->fd = open(path, O_RDWR);
+    if (h->fd < 0) {
+        free(h);
+        return NULL;
+    }
+    h->workers = workers > 0 ? workers : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (h->workers < 1)
+        h->workers = 1;
+    pthread_mutex_init(&h->lock, NULL);
+
+    for (kind = 0; kind < CRYPTO_HYBRID_KINDS; kind++) {
+        if (calibrate(h, kind)) {
+            err = errno;
+            crypto_hybrid_close(h);
+            errno = err;
+            return NULL;
+        }
+    }
+    return h;
+}
+
+void crypto_hybrid_close(struct crypto_hybrid *h) {
+    if (!h)
+        return;
+    close(h->fd);
+    pthread_mutex_destroy(&h->lock);
+    free(h);
+}
+
+static void update_rate(double *rate, double measured) {
+    *rate = (1 - RATE_WEIGHT) * *rate + RATE_WEIGHT * measured;
+}
+
+int crypto_hybrid_batch(struct crypto_hybrid *h, unsigned int cmd, struct crypto_batch *batch) {
+    struct soft_slice *slices;
+    void *ops = (void *)(uintptr_t)batch->ops;
+    int32_t *status = (int32_t *)(uintptr_t)batch->status;
+    uint32_t n_hw, n_sw, per, first, done;
+    double share, start, t_hw, t_sw;
+    size_t op_size;
+    int kind, w, n_workers, ret, err;
+
+    kind = kind_of(cmd, &op_size);
+    if (kind < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (batch->flags & ~CRYPTO_BATCH_DECRYPT || batch->count < CRYPTO_HYBRID_MIN_OPS ||
+        !h->sw_ok[kind])
+        return ioctl(h->fd, cmd, batch);
+
+    // Split in proportion to throughput: the core against all workers
+    pthread_mutex_lock(&h->lock);
+    share = h->hw_rate[kind] / (h->hw_rate[kind] + h->workers * h->sw_rate[kind]);
+    pthread_mutex_unlock(&h->lock);
+    if (share < SHARE_MIN)
+        share = SHARE_MIN;
+    if (share > SHARE_MAX)
+        share = SHARE_MAX;
+    n_hw = (uint32_t)(batch->count * share + 0.5);
+    n_sw = batch->count - n_hw;
+
+    n_workers = h->workers;
+    if ((uint32_t)n_workers > n_sw)
+        n_workers = n_sw ? n_sw : 1;
+    slices = calloc(n_workers, sizeof(*slices));
+    if (!slices)
+        return ioctl(h->fd, cmd, batch);
+
+    // The core takes the front of the batch, the workers the rest
+    per = (n_sw + n_workers - 1) / n_workers;
+    first = n_hw;
+    for (w = 0; w < n_workers; w++) {
+        slices[w].kind = kind;
+        slices[w].decrypt = batch->flags & CRYPTO_BATCH_DECRYPT;
+        slices[w].ops = ops;
+        slices[w].status = status;
+        slices[w].first = first;
+        slices[w].count = first + per <= batch->count ? per : batch->count - first;
+        first += slices[w].count;
+        // Without a thread the slice runs after the core part
+        slices[w].threaded = slices[w].count &&
+                             !pthread_create(&slices[w].thread, NULL, soft_thread, &slices[w]);
+    }
+
+    start = now();
+    ret = hw_run(h, cmd, batch->flags, ops, op_size, status, 0, n_hw, &done);
+    err = errno;
+    t_hw = now() - start;
+
+    t_sw = 0;
+    for (w = 0; w < n_workers; w++) {
+        if (!slices[w].count)
+            continue;
+        if (slices[w].threaded)
+            pthread_join(slices[w].thread, NULL);
+        else
+            soft_run(&slices[w]);
+        if (slices[w].elapsed > t_sw)
+            t_sw = slices[w].elapsed;
+    }
+
+    // Follow the measured rates, so a core shared with other clients gets
+    // a smaller part of the next batch
+    pthread_mutex_lock(&h->lock);
+    if (!ret && n_hw && t_hw > 0)
+        update_rate(&h->hw_rate[kind], n_hw / t_hw);
+    if (n_sw && t_sw > 0)
+        update_rate(&h->sw_rate[kind], (double)per / t_sw);
+    h->hw_share[kind] = (double)n_hw / batch->count;
+    pthread_mutex_unlock(&h->lock);
+    free(slices);
+
+    if (ret) {
+        batch->done = done;
+        errno = err;
+        return -1;
+    }
+    batch->done = batch->count;
+    return 0;
+}
+
+void crypto_hybrid_rates(struct crypto_hybrid *h, enum crypto_hybrid_kind kind,
+                         double *hw_rate, double *sw_rate) {
+    pthread_mutex_lock(&h->lock);
+    *hw_rate = h->hw_rate[kind];
+    *sw_rate = h->sw_rate[kind];
+    pthread_mutex_unlock(&h->lock);
+}
+
+double crypto_hybrid_hw_share(struct crypto_hybrid *h, enum crypto_hybrid_kind kind) {
+    double share;
+
+    pthread_mutex_lock(&h->lock);
+    share = h->hw_share[kind];
+    pthread_mutex_unlock(&h->lock);
+    return share;
+}
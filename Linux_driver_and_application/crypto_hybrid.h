@@ -0,0 +1,51 @@
+#ifndef CRYPTO_HYBRID_H
+#define CRYPTO_HYBRID_H
+
+#include "crypto_ioctl.h"
+
+// Hybrid batches: a large DES/AES/GCD batch is split between the PL core
+// (through the driver's batch ioctl) and software engines on the CPU
+// cores, in proportion to their measured throughput. The rates are
+// calibrated when the handle is opened and follow each batch afterwards,
+// so the hardware share shrinks while other clients keep the core busy.
+//
+// The software engines implement FIPS DES and AES-128 encryption in the
+// driver's word order (big-endian words, as the crypto API path uses).
+// Calibration runs a known-answer op through the core and keeps batches
+// hardware-only if the results disagree.
+
+#define CRYPTO_HYBRID_MIN_OPS  64   // smaller batches stay on the core
+
+enum crypto_hybrid_kind {
+    CRYPTO_HYBRID_DES,
+    CRYPTO_HYBRID_AES,
+    CRYPTO_HYBRID_GCD,
+    CRYPTO_HYBRID_KINDS,
+};
+
+struct crypto_hybrid;
+
+// Open the device and calibrate. workers is the number of software
+// threads, 0 for one per online CPU. Returns NULL with errno set.
+struct crypto_hybrid *crypto_hybrid_open(const char *path, int workers);
+void crypto_hybrid_close(struct crypto_hybrid *h);
+
+// Same contract as ioctl(fd, CRYPTO_*_BATCH, batch): results in place,
+// optional per-op status, batch->done is the processed prefix, -1 with
+// errno on failure. Session batches (CRYPTO_BATCH_SESSION) and batches
+// below CRYPTO_HYBRID_MIN_OPS go to the core unchanged.
+int crypto_hybrid_batch(struct crypto_hybrid *h, unsigned int cmd, struct crypto_batch *batch);
+
+// Current estimates in ops/s: the core, and one software worker
+void crypto_hybrid_rates(struct crypto_hybrid *h, enum crypto_hybrid_kind kind,
+                         double *hw_rate, double *sw_rate);
+
+// Share of the last batch of this kind that ran on the core, 0..1
+double crypto_hybrid_hw_share(struct crypto_hybrid *h, enum crypto_hybrid_kind kind);
+
+// The software engines on their own, for tests and benchmarks
+uint64_t crypto_soft_des(uint64_t key, uint64_t input, int decrypt);
+void crypto_soft_aes_encrypt(const uint32_t key[4], const uint32_t input[4], uint32_t output[4]);
+int crypto_soft_gcd(int x, int y);
+
+#endif // CRYPTO_HYBRID_H
@@ -2,7 +2,11 @@
 #define CRYPTO_IOCTL_H
 
 #include <linux/ioctl.h>
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
 #include <stdint.h>
+#endif
 
 // IOCTL command definitions
 #define CRYPTO_IOC_MAGIC 'c'
@@ -12,6 +16,20 @@
 #define CRYPTO_DES_DECRYPT     _IOWR(CRYPTO_IOC_MAGIC, 4, struct des_operation)
 #define CRYPTO_GCD_CALC        _IOWR(CRYPTO_IOC_MAGIC, 5, struct gcd_operation)
 #define CRYPTO_AES_ENCRYPT     _IOWR(CRYPTO_IOC_MAGIC, 6, struct aes_operation)
+#define CRYPTO_DES_BATCH       _IOWR(CRYPTO_IOC_MAGIC, 7, struct crypto_batch)
+#define CRYPTO_AES_BATCH       _IOWR(CRYPTO_IOC_MAGIC, 8, struct crypto_batch)
+#define CRYPTO_GCD_BATCH       _IOWR(CRYPTO_IOC_MAGIC, 9, struct crypto_batch)
+#define CRYPTO_ASYNC_SETUP     _IOW(CRYPTO_IOC_MAGIC, 10, struct crypto_async_setup)
+#define CRYPTO_SUBMIT          _IOWR(CRYPTO_IOC_MAGIC, 11, struct crypto_submit)
+#define CRYPTO_SET_KEY         _IOW(CRYPTO_IOC_MAGIC, 12, struct crypto_key)
+#define CRYPTO_DES_ENCRYPT_BLOCK _IOWR(CRYPTO_IOC_MAGIC, 13, struct des_block)
+#define CRYPTO_DES_DECRYPT_BLOCK _IOWR(CRYPTO_IOC_MAGIC, 14, struct des_block)
+#define CRYPTO_AES_ENCRYPT_BLOCK _IOWR(CRYPTO_IOC_MAGIC, 15, struct aes_block)
+#define CRYPTO_EVENT_SETUP     _IO(CRYPTO_IOC_MAGIC, 16)
+#define CRYPTO_STREAM_SETUP    _IOW(CRYPTO_IOC_MAGIC, 17, struct crypto_stream_setup)
+#define CRYPTO_FILE_XFORM      _IOWR(CRYPTO_IOC_MAGIC, 18, struct crypto_file_xform)
+#define CRYPTO_RUN_PROGRAM     _IOWR(CRYPTO_IOC_MAGIC, 19, struct crypto_program)
+#define CRYPTO_SET_QOS         _IOW(CRYPTO_IOC_MAGIC, 20, struct crypto_qos)
 
 // Data structures for operations
 struct des_operation {
@@ -32,4 +50,224 @@ struct aes_operation {
     uint32_t output[4];  // 128-bit output
 };
 
+// Batched operations: an array of des/aes/gcd_operation processed in one
+// ioctl. Processing stops at the first op that fails.
+#define CRYPTO_BATCH_MAX      4096  // ops per call
+#define CRYPTO_BATCH_DECRYPT  0x1   // DES only
+#define CRYPTO_BATCH_SESSION  0x2   // ops are des_block/aes_block, key from CRYPTO_SET_KEY
+#define CRYPTO_BATCH_PRIO(p)  (((p) + 1) << 8)  // CRYPTO_PRIO_* for this batch, else the fd's
+#define CRYPTO_BATCH_PRIO_MASK 0x300
+
+struct crypto_batch {
+    uint64_t ops;        // user pointer to count operations, updated in place
+    uint64_t status;     // user pointer to int32_t[count], 0 or -errno per op (optional)
+    uint32_t count;      // number of operations
+    uint32_t flags;      // CRYPTO_BATCH_*
+    uint32_t done;       // out: operations processed
+    uint32_t reserved;
+};
+
+// Session keys: CRYPTO_SET_KEY binds a key to the open file, after which
+// the *_BLOCK ioctls (and batches with CRYPTO_BATCH_SESSION) carry only
+// data. They fail with ENOKEY until a key is set for that engine.
+#define CRYPTO_KEY_DES  0
+#define CRYPTO_KEY_AES  1
+
+struct crypto_key {
+    uint32_t engine;     // CRYPTO_KEY_*
+    uint32_t reserved;
+    union {
+        uint64_t des;
+        uint32_t aes[4]; // same word order as aes_operation.key
+    };
+};
+
+struct des_block {
+    uint64_t input;
+    uint64_t output;
+};
+
+struct aes_block {
+    uint32_t input[4];
+    uint32_t output[4];
+};
+
+// Quality of service: CRYPTO_SET_QOS puts everything the fd submits (ops,
+// batches, async submits, programs, io_uring commands and stream buffers)
+// in a priority class. Each core runs queued requests of a higher class
+// first, in order within a class, and a running batch of a lower class
+// stops between blocks to let them through, then carries on. rate, if not
+// 0, limits the fd to that many blocks per second with bursts of up to
+// burst blocks (0: one second's worth). A call may overdraw the bucket; the
+// fd's next call then waits until it is paid back.
+#define CRYPTO_PRIO_HIGH      0     // interactive
+#define CRYPTO_PRIO_NORMAL    1     // the default
+#define CRYPTO_PRIO_BULK      2
+#define CRYPTO_PRIO_CNT       3
+#define CRYPTO_QOS_BURST_MAX  (1u << 20)
+
+struct crypto_qos {
+    uint32_t prio;       // CRYPTO_PRIO_*
+    uint32_t rate;       // blocks per second, 0 for no limit
+    uint32_t burst;      // blocks, up to CRYPTO_QOS_BURST_MAX
+    uint32_t reserved;
+};
+
+// Asynchronous ops: CRYPTO_ASYNC_SETUP switches the fd to async mode, after
+// which CRYPTO_SUBMIT queues an op and returns at once with a tag, and read()
+// returns struct crypto_completion records instead of the switch value.
+// poll() reports POLLIN while completions are waiting and POLLOUT while
+// there is room for another submit.
+#define CRYPTO_ASYNC_DEPTH    128   // ops in flight plus unread completions, per fd
+
+enum crypto_async_op {
+    CRYPTO_OP_DES_ENCRYPT,
+    CRYPTO_OP_DES_DECRYPT,
+    CRYPTO_OP_GCD_CALC,
+    CRYPTO_OP_AES_ENCRYPT,
+};
+
+struct crypto_async_setup {
+    int32_t eventfd;     // signalled once per completion, -1 for none
+    uint32_t flags;      // must be 0
+};
+
+struct crypto_submit {
+    uint32_t op;         // CRYPTO_OP_*
+    uint32_t tag;        // out: echoed in the completion
+    uint64_t user_data;  // echoed in the completion
+    union {
+        struct des_operation des;
+        struct gcd_operation gcd;
+        struct aes_operation aes;
+    };
+};
+
+struct crypto_completion {
+    uint32_t tag;
+    int32_t status;      // 0 or -errno
+    uint32_t op;
+    uint32_t reserved;
+    uint64_t user_data;
+    union {              // the submitted operation with its output filled in
+        struct des_operation des;
+        struct gcd_operation gcd;
+        struct aes_operation aes;
+    };
+};
+
+// Programs: CRYPTO_RUN_PROGRAM runs a small graph of CRYPTO_OP_* steps in
+// one call. A step's links copy 32-bit words of an earlier step's op struct
+// (after it ran) into its own before it starts, e.g. des_operation.output
+// of step 0 into the input of a decrypt. Steps start as soon as the steps
+// they link from are done, so independent ones run on different engines at
+// the same time. A failed step fails the steps that link from it with
+// -ECANCELED; the others still run. Every step comes back with its status
+// and its op with the outputs filled in.
+//
+// Word numbers: des_operation input 0-1, key 2-3, output 4-5 (low word
+// first); gcd_operation x 0, y 1, result 2; aes_operation key 0-3,
+// input 4-7, output 8-11.
+#define CRYPTO_PROGRAM_STEPS  32
+#define CRYPTO_PROGRAM_LINKS  4     // per step
+#define CRYPTO_PROGRAM_NONE   0xff  // unused link
+
+struct crypto_prog_link {
+    uint8_t step;        // an earlier step, or CRYPTO_PROGRAM_NONE
+    uint8_t from;        // first word in that step's op
+    uint8_t to;          // first word in this step's op
+    uint8_t count;       // words
+};
+
+struct crypto_prog_step {
+    uint32_t op;         // CRYPTO_OP_*
+    int32_t status;      // out: 0 or -errno
+    struct crypto_prog_link links[CRYPTO_PROGRAM_LINKS];
+    union {
+        struct des_operation des;
+        struct gcd_operation gcd;
+        struct aes_operation aes;
+    };
+};
+
+struct crypto_program {
+    uint64_t steps;      // user pointer to count crypto_prog_step, updated in place
+    uint32_t count;      // up to CRYPTO_PROGRAM_STEPS
+    uint32_t flags;      // must be 0
+    uint32_t done;       // out: steps that succeeded
+    uint32_t reserved;
+};
+
+// io_uring passthrough: IORING_OP_URING_CMD with sqe->cmd_op set to one of
+// CRYPTO_DES_ENCRYPT/DECRYPT, CRYPTO_GCD_CALC, CRYPTO_AES_ENCRYPT or the
+// batch ioctls, and the command area holding struct crypto_uring_cmd. The
+// operation is updated in place and cqe->res carries 0 or -errno.
+struct crypto_uring_cmd {
+    uint64_t addr;       // user pointer to the op struct or struct crypto_batch
+    uint64_t reserved;
+};
+
+// Button and switch events: CRYPTO_EVENT_SETUP subscribes the fd, after
+// which read() returns struct crypto_event records instead of the switch
+// value and poll() reports POLLIN while events are queued. With O_ASYNC
+// set (F_SETOWN, then F_SETFL) the owner also gets SIGIO per event. The
+// first record is the current switch value. An fd is either in async or
+// in event mode.
+#define CRYPTO_EVENT_DEPTH    64    // queued per fd; when full, new events are lost
+
+enum crypto_event_type {
+    CRYPTO_EVENT_BUTTON = 1,    // value: the switches at the press
+    CRYPTO_EVENT_SWITCH = 2,    // value: the new switch value
+};
+
+struct crypto_event {
+    uint64_t timestamp_ns;  // CLOCK_MONOTONIC, press: in the interrupt handler
+    uint32_t type;          // CRYPTO_EVENT_*
+    uint32_t value;         // switch register, SW0 in bit 0
+    uint32_t dropped;       // events lost to a full queue before this one
+    uint32_t reserved;
+};
+
+// Streaming sessions: CRYPTO_STREAM_SETUP binds a cipher to the fd, after
+// which write()/writev() take plaintext of any length and read()/readv()
+// return the ciphertext in the same order. Data bytes map to the registers
+// as big-endian words, as in the kernel crypto API: bytes 0-7 of a DES
+// block are des_operation.input == be64. CTR (the default) outputs every
+// byte written and decrypts by running the ciphertext through again; ECB
+// outputs whole blocks, holds a partial one until the rest is written and
+// decrypts with CRYPTO_STREAM_DECRYPT, on either core. read()
+// blocks while written data is still being processed and returns 0 once
+// everything written has been read. write() takes what fits in the free
+// buffers and blocks only while none is free, so one thread can alternate
+// write() and read(); short writes are normal. poll() reports POLLIN with
+// output ready and POLLOUT with a free buffer. Setting up again restarts
+// the stream. An fd is in only one of async, event or stream mode.
+#define CRYPTO_STREAM_DECRYPT  0x1   // ECB only
+#define CRYPTO_STREAM_ECB      0x2   // else CTR
+
+struct crypto_stream_setup {
+    struct crypto_key key;   // engine and key, as for CRYPTO_SET_KEY
+    uint32_t flags;          // CRYPTO_STREAM_*
+    uint32_t reserved;
+    uint8_t iv[16];          // CTR: initial counter block, first 8 bytes for DES
+};
+
+// File to file: CRYPTO_FILE_XFORM runs length bytes of in_fd from
+// in_offset through the cipher into out_fd at out_offset, inside the
+// kernel and on the stream buffers, so no data passes through user memory.
+// Works on any fd open on /dev/crypto_ips and leaves its mode alone; the
+// file positions of in_fd and out_fd don't move. Stops early at the end of
+// the input. ECB needs a length of whole blocks and fails with EINVAL after
+// the last whole block if the input ends inside one. done is what was
+// written, also when the call fails part way.
+struct crypto_file_xform {
+    struct crypto_stream_setup cipher;  // as for CRYPTO_STREAM_SETUP
+    int32_t in_fd;
+    int32_t out_fd;
+    uint64_t in_offset;
+    uint64_t out_offset;
+    uint64_t length;
+    uint64_t done;       // out: bytes written to out_fd
+};
+
 #endif // CRYPTO_IOCTL_H
\ No newline at end of file
@@ -1,422 +1,5192 @@
 #include <linux/kernel.h>
 #include <linux/module.h>
 #include <linux/fs.h>
+#include <linux/file.h>
 #include <linux/uaccess.h>
 #include <linux/io.h>
 #include <linux/interrupt.h>
 #include <linux/irq.h>
-#include <linux/of_irq.h>
 #include <linux/cdev.h>
 #include <linux/ioctl.h>
 #include <linux/delay.h>
 #include <linux/of.h>
+#include <linux/of_device.h>
+#include <linux/platform_device.h>
+#include <linux/mod_devicetable.h>
 #include <linux/slab.h>
+#include <linux/completion.h>
+#include <linux/hrtimer.h>
+#include <linux/iopoll.h>
+#include <linux/atomic.h>
+#include <linux/sched.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/list.h>
+#include <linux/rculist.h>
+#include <linux/kfifo.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/eventfd.h>
+#include <linux/workqueue.h>
+#include <linux/version.h>
+#include <linux/io_uring.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+#include <linux/io_uring/cmd.h>
+#endif
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
+#include <linux/percpu.h>
+#include <linux/u64_stats_sync.h>
+#include <linux/sysfs.h>
+#include <linux/sizes.h>
+#include <linux/uio.h>
+#include <linux/blkdev.h>
+#include <linux/blk-mq.h>
+#include <linux/random.h>
+#include <linux/hw_random.h>
+#include <linux/vmalloc.h>
+#include <linux/dmaengine.h>
+#include <linux/dma-mapping.h>
+#include <linux/gcd.h>
+#include <linux/sort.h>
+#include <linux/utsname.h>
+#include <asm/unaligned.h>
+#include <crypto/aes.h>
+#include <crypto/des.h>
+#include <crypto/engine.h>
+#include <crypto/algapi.h>
+#include <crypto/internal/des.h>
+#include <crypto/internal/skcipher.h>
+
+#include "crypto_ioctl.h"
+
+#define CREATE_TRACE_POINTS
+#include "crypto_ips_trace.h"
 
 #define DEVICE_NAME "crypto_ips"
 #define CLASS_NAME "crypto_class"
 #define DEVICE_CNT 1
 
-// IP base addresses (from your vivado address editor)
-#define INTER_IP_BASEADDR 0x43C00000
-#define AES_IP_BASEADDR   0x43C10000
-#define DES_IP_BASEADDR   0x43C20000
-#define GCD_IP_BASEADDR   0x43C30000
+// Register window of each IP, addresses and interrupts come from the DT
 #define IP_SIZE           0x1000
+#define MOCK_ENGINES_MAX  4
+#define IP_STREAM_SIZE    SZ_16K  // DMA buffer per direction, see ip_engine_stream()
+
+// AES IP registers
+#define AES_CTRL_REG      0x00
+#define AES_STATUS_REG    0x04
+#define AES_KEY_REG       0x08  // 4 words
+#define AES_DATA_IN_REG   0x18  // 4 words
+#define AES_DATA_OUT_REG  0x28  // 4 words
+#define AES_CTRL_START    BIT(0)
+#define AES_CTRL_ENCRYPT  BIT(1)
+#define AES_CTRL_IRQ_EN   BIT(2)
+#define AES_CTRL_STREAM   BIT(3)  // AXI-Stream variant: data from the DMA
+#define AES_STATUS_DONE   BIT(0)
+#define AES_STATUS_BUSY   BIT(1)
+
+// DES IP registers
+#define DES_DATA_LO_REG   0x00
+#define DES_DATA_HI_REG   0x04
+#define DES_KEY_LO_REG    0x08
+#define DES_KEY_HI_REG    0x0C
+#define DES_CTRL_REG      0x10
+#define DES_RES_LO_REG    0x14
+#define DES_RES_HI_REG    0x18
+#define DES_STATUS_REG    0x1C
+#define DES_CTRL_START    BIT(0)  // self-clearing
+#define DES_CTRL_DECRYPT  BIT(1)
+#define DES_CTRL_IRQ_EN   BIT(2)
+#define DES_CTRL_STREAM   BIT(3)  // AXI-Stream variant: data from the DMA
+#define DES_STATUS_DONE   BIT(0)
+#define DES_STATUS_READY  BIT(1)  // idle, next block can be started
+
+// GCD IP registers
+#define GCD_X_REG         0x00
+#define GCD_Y_REG         0x04
+#define GCD_CTRL_REG      0x08
+#define GCD_RESULT_REG    0x0C
+#define GCD_CTRL_START    BIT(0)
+#define GCD_CTRL_IRQ_EN   BIT(1)
+#define GCD_RESULT_MASK   0xFF
+#define GCD_RESULT_DONE   BIT(8)
+
+// Bit 31 of every core's control register is a soft reset of the core and
+// its wrapper logic, see the AXI wrappers. It reads back as 1 until the
+// reset is over; older bitstreams just store it.
+#define IP_CTRL_SOFT_RESET  BIT(31)
+#define IP_RESET_US         100
+
+// Inter IP registers
+#define INTER_LED_REG       0x00
+#define INTER_SWITCH_REG    0x04
+#define INTER_SWITCH_SHIFT  24
+
+enum ip_engine_id {
+    ENGINE_AES,
+    ENGINE_DES,
+    ENGINE_GCD,
+    ENGINE_CNT,
+};
+
+// Latency phases of one op, see the debugfs histograms
+enum ip_phase {
+    IP_PHASE_QUEUE,         // submitted until its burst runs it
+    IP_PHASE_PROGRAM,       // key/data registers until the start bit
+    IP_PHASE_WAIT,          // start bit until done
+    IP_PHASE_CNT,
+};
+
+#define IP_HIST_BUCKETS 32  // log2(ns), the last one catches the rest
+
+// Per-op counters of an instance. Each CPU has its own copy so the op path
+// never writes a cache line shared with other CPUs; readers add them up.
+struct ip_engine_stats {
+    // sysfs stats/, updated by the op path only
+    u64_stats_t ops;
+    u64_stats_t bytes;
+    u64_stats_t timeouts;
+    u64_stats_t busy_ns;    // start bit until done or timeout
+    struct u64_stats_sync syncp;
+    // How ops finished, sysfs stats/irq, spin and sleep
+    unsigned long irq;
+    unsigned long spin;
+    unsigned long sleep;
+    unsigned long key_reuse;
+    // debugfs; register reads also come from the done interrupt
+    unsigned long mmio_read;
+    unsigned long mmio_write;
+    unsigned long stream_bytes; // moved by DMA instead
+    unsigned int hist[IP_PHASE_CNT][IP_HIST_BUCKETS];
+};
+
+// One AES/DES/GCD core in the PL. The register layout is copied from
+// ip_engine_types[] when an instance is probed.
+struct ip_engine {
+    enum ip_engine_id id;
+    const char *name;
+    unsigned int index;     // instance number within the type
+    char label[16];         // name and index, e.g. "des0"
+    struct list_head node;  // crypto_dev.engines[id]
+    uint32_t ctrl_reg;
+    uint32_t start_bit;
+    uint32_t irq_en_bit;
+    uint32_t stream_bit;    // ctrl bit of the AXI-Stream variant, 0 for none
+    uint32_t status_reg;    // register carrying the done flag
+    uint32_t done_mask;     // any of these bits set means done
+    unsigned int timeout_us;
+    unsigned int block_bytes;   // data per op, for stats/bytes
+    void __iomem *base;
+    unsigned int irq;
+    bool use_irq;           // done interrupt wired up (or simulated)
+    struct mutex lock;      // held by the client running the queue
+    spinlock_t queue_lock;
+    struct list_head queue; // pending ip_requests, by class, FIFO within one
+    unsigned int queued[CRYPTO_PRIO_CNT];   // requests in queue per class
+    bool queue_running;     // a client is draining the queue
+    atomic_t load;          // requests dispatched here and not finished
+    atomic_t n_requests;
+    atomic_t n_bursts;
+    atomic_t n_coalesced;   // requests run by another client's burst
+    atomic_t n_preempted;   // batches that gave way to a higher class
+    // Health, see ip_engine_recover(). A wedged instance gets no requests
+    // until a reset takes, under the engine lock.
+    bool wedged;
+    atomic_t n_resets;
+    atomic_t n_redispatched;    // requests run again elsewhere after a timeout here
+    // What the key registers hold, under the engine lock. They keep their
+    // value between ops, so reloading the same key is skipped.
+    uint32_t key[4];
+    bool key_valid;
+    struct completion done;
+    struct ip_engine_stats __percpu *stats;
+    // Phase timestamps of the op in progress, under the engine lock
+    u64 t_program;          // started programming
+    u64 t_start;            // wrote its start bit
+    struct dentry *debugfs;
+    // Stream path, see ip_engine_stream(). Set up only for cores with DMA
+    // channels in the DT (or mock_dma=1); the buffers are DMA-coherent,
+    // plain memory for the register model.
+    struct dma_chan *dma_tx;    // memory to core, MM2S
+    struct dma_chan *dma_rx;    // core to memory, S2MM
+    uint8_t *stream_in;
+    uint8_t *stream_out;
+    dma_addr_t stream_in_dma;
+    dma_addr_t stream_out_dma;
+    struct completion dma_done;
+    // Register model state, only used with mock=1
+    uint32_t *mock_regs;
+    struct hrtimer mock_timer;
+    uint32_t mock_result;   // GCD result, published when the timer fires
+};
+
+struct crypto_device {
+    dev_t devid;
+    int major;
+    struct cdev cdev;
+    struct class *class;
+    struct device *dev;
+    void __iomem *inter_base;   // switches and LEDs, NULL until the inter IP probes
+    spinlock_t engines_lock;
+    struct list_head engines[ENGINE_CNT];   // probed instances per type, RCU
+    unsigned int n_engines[ENGINE_CNT];
+    atomic_t next_engine[ENGINE_CNT];       // tie-break rotation
+    struct crypto_engine *skcipher_engine;  // request queue for the crypto API
+    struct workqueue_struct *async_wq;      // runs CRYPTO_SUBMIT ops
+    struct dentry *debugfs;
+};
+
+static struct crypto_device crypto_dev;
+
+// Every probed instance, with engines_lock held
+#define for_each_ip_engine(eng, i) \
+    for (i = 0; i < ENGINE_CNT; i++) \
+        list_for_each_entry(eng, &crypto_dev.engines[i], node)
+
+static const struct ip_engine ip_engine_types[ENGINE_CNT] = {
+    [ENGINE_AES] = {
+        .id = ENGINE_AES,
+        .name = "aes",
+        .ctrl_reg = AES_CTRL_REG,
+        .start_bit = AES_CTRL_START,
+        .irq_en_bit = AES_CTRL_IRQ_EN,
+        .stream_bit = AES_CTRL_STREAM,
+        .status_reg = AES_STATUS_REG,
+        .done_mask = AES_STATUS_DONE,
+        .timeout_us = 1000000,
+        .block_bytes = AES_BLOCK_SIZE,
+    },
+    [ENGINE_DES] = {
+        .id = ENGINE_DES,
+        .name = "des",
+        .ctrl_reg = DES_CTRL_REG,
+        .start_bit = DES_CTRL_START,
+        .irq_en_bit = DES_CTRL_IRQ_EN,
+        .stream_bit = DES_CTRL_STREAM,
+        .status_reg = DES_STATUS_REG,
+        .done_mask = DES_STATUS_DONE,
+        .timeout_us = 100000,
+        .block_bytes = DES_BLOCK_SIZE,
+    },
+    [ENGINE_GCD] = {
+        .id = ENGINE_GCD,
+        .name = "gcd",
+        .ctrl_reg = GCD_CTRL_REG,
+        .start_bit = GCD_CTRL_START,
+        .irq_en_bit = GCD_CTRL_IRQ_EN,
+        .status_reg = GCD_RESULT_REG,
+        // The wrapper clears the result register on start, so only the
+        // done flag tells a new result from the previous op's
+        .done_mask = GCD_RESULT_DONE,
+        .timeout_us = 1000000,
+        .block_bytes = 2,       // two 8-bit operands
+    },
+};
+
+// Instances created by the register model (mock=1), indexed by engine id
+static const struct platform_device_id crypto_ips_engine_ids[] = {
+    { "crypto-ips-aes", (kernel_ulong_t)&ip_engine_types[ENGINE_AES] },
+    { "crypto-ips-des", (kernel_ulong_t)&ip_engine_types[ENGINE_DES] },
+    { "crypto-ips-gcd", (kernel_ulong_t)&ip_engine_types[ENGINE_GCD] },
+    { }
+};
+
+static struct platform_device *mock_pdevs[ENGINE_CNT * MOCK_ENGINES_MAX];
+
+static bool mock;
+module_param(mock, bool, 0444);
+MODULE_PARM_DESC(mock, "Use a software register model instead of the PL IPs");
+
+static bool skcipher = true;
+module_param(skcipher, bool, 0444);
+MODULE_PARM_DESC(skcipher, "Register ecb(aes), ctr(aes), ecb(des) and cbc(des) with the crypto API");
+
+static unsigned int mock_delay_ns = 1000;
+module_param(mock_delay_ns, uint, 0644);
+MODULE_PARM_DESC(mock_delay_ns, "Register model: delay from start to done (ns)");
+
+static unsigned int mock_engines = 1;
+module_param(mock_engines, uint, 0444);
+MODULE_PARM_DESC(mock_engines, "Register model: instances of each core (1-" __stringify(MOCK_ENGINES_MAX) ")");
+
+static unsigned int mock_stall;
+module_param(mock_stall, uint, 0644);
+MODULE_PARM_DESC(mock_stall, "Register model: this many of the next starts never finish, until a soft reset");
+
+static bool mock_dma;
+module_param(mock_dma, bool, 0444);
+MODULE_PARM_DESC(mock_dma, "Register model: AES/DES instances get a stream path like the AXI-Stream cores");
+
+static unsigned int stream_min = 256;
+module_param(stream_min, uint, 0644);
+MODULE_PARM_DESC(stream_min, "Smallest payload (bytes) sent over the DMA stream instead of the data registers, 0 = never");
+
+// How to wait for an engine to finish
+enum poll_mode {
+    POLL_AUTO,      // done interrupt if wired up, otherwise spin then sleep
+    POLL_HYBRID,    // spin then sleep, even if the interrupt is wired up
+    POLL_SPIN,      // busy-wait for the whole timeout
+    POLL_SLEEP,     // sleep between status reads from the start
+};
+
+static unsigned int poll_mode = POLL_AUTO;
+module_param(poll_mode, uint, 0644);
+MODULE_PARM_DESC(poll_mode, "Completion wait: 0=auto (irq or hybrid), 1=hybrid, 2=spin, 3=sleep");
+
+static unsigned int poll_spin_us = 50;
+module_param(poll_spin_us, uint, 0644);
+MODULE_PARM_DESC(poll_spin_us, "Hybrid polling: busy-wait window before sleeping (us)");
+
+static unsigned int poll_sleep_us = 20;
+module_param(poll_sleep_us, uint, 0644);
+MODULE_PARM_DESC(poll_sleep_us, "Polling: sleep between status reads after the spin window (us, upper bound)");
+
+static unsigned int op_deadline_us = 10000;
+module_param(op_deadline_us, uint, 0644);
+MODULE_PARM_DESC(op_deadline_us, "Longest wait for one op or DMA chunk before the core is reset (us), 0 = the core's own timeout");
+
+static unsigned int watchdog_ms = 1000;
+module_param(watchdog_ms, uint, 0444);
+MODULE_PARM_DESC(watchdog_ms, "Check idle cores for a wedged state every this many ms, 0 = off");
+
+// Ops answered in software because no core of their type was usable,
+// debugfs crypto_ips/fallbacks
+static atomic_t ip_fallbacks[ENGINE_CNT];
+
+// Sum of the per-CPU copies
+struct ip_engine_totals {
+    u64 ops;
+    u64 bytes;
+    u64 timeouts;
+    u64 busy_ns;
+    unsigned long irq;
+    unsigned long spin;
+    unsigned long sleep;
+    unsigned long key_reuse;
+    unsigned long mmio_read;
+    unsigned long mmio_write;
+    unsigned long stream_bytes;
+};
+
+static void ip_engine_totals(struct ip_engine *eng, struct ip_engine_totals *t) {
+    const struct ip_engine_stats *st;
+    u64 ops, bytes, timeouts, busy_ns;
+    unsigned int start;
+    int cpu;
+
+    memset(t, 0, sizeof(*t));
+    for_each_possible_cpu(cpu) {
+        st = per_cpu_ptr(eng->stats, cpu);
+        do {
+            start = u64_stats_fetch_begin(&st->syncp);
+            ops = u64_stats_read(&st->ops);
+            bytes = u64_stats_read(&st->bytes);
+            timeouts = u64_stats_read(&st->timeouts);
+            busy_ns = u64_stats_read(&st->busy_ns);
+        } while (u64_stats_fetch_retry(&st->syncp, start));
+        t->ops += ops;
+        t->bytes += bytes;
+        t->timeouts += timeouts;
+        t->busy_ns += busy_ns;
+        t->irq += READ_ONCE(st->irq);
+        t->spin += READ_ONCE(st->spin);
+        t->sleep += READ_ONCE(st->sleep);
+        t->key_reuse += READ_ONCE(st->key_reuse);
+        t->mmio_read += READ_ONCE(st->mmio_read);
+        t->mmio_write += READ_ONCE(st->mmio_write);
+        t->stream_bytes += READ_ONCE(st->stream_bytes);
+    }
+}
+
+static void mock_write(struct ip_engine *eng, uint32_t off, uint32_t val);
+
+// Register accessors for the AES/DES/GCD engines
+static inline uint32_t ip_read(struct ip_engine *eng, uint32_t off) {
+    this_cpu_inc(eng->stats->mmio_read);
+    if (mock)
+        return READ_ONCE(eng->mock_regs[off / 4]);
+    return readl(eng->base + off);
+}
+
+static inline void ip_write(struct ip_engine *eng, uint32_t off, uint32_t val) {
+    this_cpu_inc(eng->stats->mmio_write);
+    if (mock)
+        mock_write(eng, off, val);
+    else
+        writel(val, eng->base + off);
+}
+
+// Done interrupt: only claim it if the engine really has a result latched
+static irqreturn_t ip_engine_irq(int irq, void *dev_id) {
+    struct ip_engine *eng = dev_id;
+
+    if (!(ip_read(eng, eng->status_reg) & eng->done_mask))
+        return IRQ_NONE;
+    return IRQ_WAKE_THREAD;
+}
+
+static irqreturn_t ip_engine_irq_thread(int irq, void *dev_id) {
+    struct ip_engine *eng = dev_id;
+
+    complete(&eng->done);
+    return IRQ_HANDLED;
+}
+
+// The done interrupt is only used when it is wired up and not overridden
+static inline bool ip_engine_irq_mode(struct ip_engine *eng) {
+    return eng->use_irq && READ_ONCE(poll_mode) == POLL_AUTO;
+}
+
+static uint32_t ip_engine_status(struct ip_engine *eng) {
+    return ip_read(eng, eng->status_reg);
+}
+
+// How long one op (or DMA chunk) may take before the core counts as wedged
+static inline unsigned int ip_engine_deadline_us(struct ip_engine *eng) {
+    unsigned int deadline = READ_ONCE(op_deadline_us);
+
+    return deadline ? min(deadline, eng->timeout_us) : eng->timeout_us;
+}
+
+static void ip_engine_hist(struct ip_engine *eng, enum ip_phase phase, u64 ns) {
+    unsigned int b = ns ? min_t(unsigned int, ilog2(ns), IP_HIST_BUCKETS - 1) : 0;
+
+    this_cpu_inc(eng->stats->hist[phase][b]);
+}
+
+// An op starts touching the registers; called by every step that may come
+// first, only the first one counts
+static inline void ip_engine_begin(struct ip_engine *eng) {
+    if (!eng->t_program)
+        eng->t_program = ktime_get_ns();
+}
+
+// Kick off an operation; ctrl must already contain the start bit
+static void ip_engine_start(struct ip_engine *eng, uint32_t ctrl) {
+    u64 program_ns;
+
+    if (ip_engine_irq_mode(eng)) {
+        reinit_completion(&eng->done);
+        ctrl |= eng->irq_en_bit;
+    }
+    ip_write(eng, eng->ctrl_reg, ctrl);
+
+    eng->t_start = ktime_get_ns();
+    program_ns = eng->t_program ? eng->t_start - eng->t_program : 0;
+    eng->t_program = 0;
+    ip_engine_hist(eng, IP_PHASE_PROGRAM, program_ns);
+    trace_crypto_ips_start(eng->name, eng->index, ctrl, program_ns);
+}
+
+// Wait for the done flag. With the done interrupt the caller sleeps until
+// the IRQ thread signals completion. Otherwise the status register is
+// busy-polled for poll_spin_us, which catches the short DES/GCD ops without
+// a context switch, and then polled with usleep_range() between reads.
+static int ip_engine_wait_done(struct ip_engine *eng, uint32_t *status) {
+    unsigned int mode = READ_ONCE(poll_mode);
+    unsigned int timeout_us = ip_engine_deadline_us(eng);
+    unsigned int spin_us = min(READ_ONCE(poll_spin_us), timeout_us);
+    unsigned int sleep_us = max(READ_ONCE(poll_sleep_us), 1U);
+    int ret;
+
+    if (ip_engine_irq_mode(eng)) {
+        if (wait_for_completion_timeout(&eng->done, usecs_to_jiffies(timeout_us))) {
+            *status = ip_engine_status(eng);
+            this_cpu_inc(eng->stats->irq);
+            return 0;
+        }
+        // Late or lost edge: trust the status register over the IRQ
+        *status = ip_engine_status(eng);
+        if (*status & eng->done_mask) {
+            this_cpu_inc(eng->stats->irq);
+            return 0;
+        }
+        return -ETIMEDOUT;
+    }
+
+    if (mode == POLL_SPIN)
+        spin_us = timeout_us;
+    else if (mode == POLL_SLEEP)
+        spin_us = 0;
+
+    if (spin_us) {
+        ret = read_poll_timeout_atomic(ip_engine_status, *status, *status & eng->done_mask,
+                                       0, spin_us, false, eng);
+        if (!ret) {
+            this_cpu_inc(eng->stats->spin);
+            return 0;
+        }
+        if (spin_us >= timeout_us)
+            return -ETIMEDOUT;
+    }
+
+    ret = read_poll_timeout(ip_engine_status, *status, *status & eng->done_mask,
+                            sleep_us, timeout_us - spin_us, false, eng);
+    if (ret)
+        return ret;
+    this_cpu_inc(eng->stats->sleep);
+    return 0;
+}
+
+// Count ops (one failed op on error). Preemption is off so this CPU's
+// sequence count can't be left open by a migration.
+static void ip_engine_account(struct ip_engine *eng, int ret, unsigned int ops, u64 busy_ns) {
+    struct ip_engine_stats *st = get_cpu_ptr(eng->stats);
+
+    u64_stats_update_begin(&st->syncp);
+    if (ret) {
+        u64_stats_inc(&st->timeouts);
+    } else {
+        u64_stats_add(&st->ops, ops);
+        u64_stats_add(&st->bytes, (u64)ops * eng->block_bytes);
+    }
+    u64_stats_add(&st->busy_ns, busy_ns);
+    u64_stats_update_end(&st->syncp);
+    put_cpu_ptr(eng->stats);
+}
+
+static int ip_engine_wait(struct ip_engine *eng, uint32_t *status) {
+    int ret = ip_engine_wait_done(eng, status);
+    u64 wait_ns = ktime_get_ns() - eng->t_start;
+
+    ip_engine_account(eng, ret, 1, wait_ns);
+    if (ret) {
+        trace_crypto_ips_timeout(eng->name, eng->index, *status, wait_ns);
+        return ret;
+    }
+    ip_engine_hist(eng, IP_PHASE_WAIT, wait_ns);
+    trace_crypto_ips_done(eng->name, eng->index, *status, wait_ns);
+    return 0;
+}
+
+// Recovery
+//
+// An op that misses its deadline (op_deadline_us) leaves the core in an
+// unknown state, so the queue runner resets it through the soft reset bit
+// before running the next request: the following callers get a core that
+// works instead of waiting out the same deadline again. A core that is
+// still busy after the reset, or whose bitstream has no reset bit and
+// hasn't gone idle, is wedged. Dispatch passes it over, its queue is
+// failed at once, and the watchdog keeps resetting it until it comes back.
+
+// Busy with no op started, as far as the status register can tell
+static bool ip_engine_stuck(struct ip_engine *eng) {
+    uint32_t status = ip_engine_status(eng);
+
+    switch (eng->id) {
+    case ENGINE_AES:
+        return status & AES_STATUS_BUSY;
+    case ENGINE_DES:
+        return !(status & DES_STATUS_READY);
+    default:
+        return false;   // the GCD core has no busy flag
+    }
+}
+
+// Pulse the soft reset, with the engine lock held. Does not sleep, so the
+// watchdog can use it too.
+static int ip_engine_reset(struct ip_engine *eng) {
+    uint32_t ctrl;
+    int ret;
+
+    ip_write(eng, eng->ctrl_reg, IP_CTRL_SOFT_RESET);
+    ret = read_poll_timeout_atomic(ip_read, ctrl, !(ctrl & IP_CTRL_SOFT_RESET), 0, IP_RESET_US,
+                                   false, eng, eng->ctrl_reg);
+    if (ret)
+        ip_write(eng, eng->ctrl_reg, 0);  // no reset bit, it was stored
+
+    // Whatever the key registers hold, don't count on it
+    eng->key_valid = false;
+    eng->t_program = 0;
+    if (ip_engine_stuck(eng))
+        return ret ? -EOPNOTSUPP : -EIO;
+    return 0;
+}
+
+// After a timeout, or when the watchdog finds the core stuck or wedged
+static void ip_engine_recover(struct ip_engine *eng, const char *why) {
+    bool was_wedged = eng->wedged;
+    int ret = ip_engine_reset(eng);
+
+    atomic_inc(&eng->n_resets);
+    trace_crypto_ips_reset(eng->name, eng->index, ret);
+    if (!ret) {
+        WRITE_ONCE(eng->wedged, false);
+        printk_ratelimited(KERN_WARNING "%s: %s, reset%s\n", eng->label, why,
+                           was_wedged ? ", back in service" : "");
+        return;
+    }
+    WRITE_ONCE(eng->wedged, true);
+    if (!was_wedged)
+        printk(KERN_ERR "%s: %s and still busy after a reset (%d), out of service\n",
+               eng->label, why, ret);
+}
+
+// Request queue
+//
+// Every user of a core (ioctl ops, batches, crypto API requests) goes
+// through the engine's queue, ordered by CRYPTO_PRIO_* class and FIFO
+// within a class. The first client to find the queue idle becomes the
+// runner: it takes the engine lock and runs whatever is queued
+// back-to-back, including requests that other clients add meanwhile, while
+// those clients just sleep on their completion. After queue_burst requests
+// (and its own) the runner hands the queue to the next waiter so nobody
+// drains forever. A request that times out gets the core reset before the
+// next one runs.
+typedef int (*ip_request_fn)(struct ip_engine *eng, void *data);
+
+struct ip_request {
+    struct list_head node;
+    ip_request_fn run;
+    void *data;
+    unsigned int prio;      // CRYPTO_PRIO_*
+    int ret;
+    u64 queued;
+    bool handoff;           // woken to take over the queue, not finished
+    struct completion done;
+};
+
+static unsigned int queue_burst = 32;
+module_param(queue_burst, uint, 0644);
+MODULE_PARM_DESC(queue_burst, "Requests one client runs for others before handing the queue on");
+
+// Behind everything queued of the same or a higher class, with queue_lock
+static void ip_engine_enqueue(struct ip_engine *eng, struct ip_request *rq) {
+    struct ip_request *pos;
+
+    list_for_each_entry_reverse(pos, &eng->queue, node) {
+        if (pos->prio <= rq->prio)
+            break;
+    }
+    list_add(&rq->node, &pos->node);
+    eng->queued[rq->prio]++;
+}
+
+// For requests that run many blocks: a higher class than prio is waiting.
+// Read without queue_lock, a stale answer only moves the switch one block.
+static bool ip_engine_preempted(struct ip_engine *eng, unsigned int prio) {
+    unsigned int p;
+
+    for (p = 0; p < prio; p++) {
+        if (READ_ONCE(eng->queued[p]))
+            return true;
+    }
+    return false;
+}
+
+static int ip_engine_submit(struct ip_engine *eng, unsigned int prio, ip_request_fn run,
+                            void *data) {
+    struct ip_request rq = { .run = run, .data = data, .prio = prio, .queued = ktime_get_ns() };
+    struct ip_request *cur;
+    unsigned int budget;
+    bool ran = false;
+
+    init_completion(&rq.done);
+    trace_crypto_ips_submit(eng->name, eng->index);
+
+    spin_lock(&eng->queue_lock);
+    ip_engine_enqueue(eng, &rq);
+    if (eng->queue_running) {
+        spin_unlock(&eng->queue_lock);
+        wait_for_completion(&rq.done);
+        if (!rq.handoff)
+            return rq.ret;
+        // The previous runner left our request at the head of the queue
+    } else {
+        eng->queue_running = true;
+        spin_unlock(&eng->queue_lock);
+    }
+
+    mutex_lock(&eng->lock);
+    atomic_inc(&eng->n_bursts);
+    budget = max(READ_ONCE(queue_burst), 1U);
+
+    // Higher classes may have been queued ahead of our own request, which
+    // still runs before the queue is handed on
+    spin_lock(&eng->queue_lock);
+    while (!list_empty(&eng->queue) && (budget || !ran)) {
+        cur = list_first_entry(&eng->queue, struct ip_request, node);
+        list_del(&cur->node);
+        eng->queued[cur->prio]--;
+        spin_unlock(&eng->queue_lock);
+
+        ip_engine_hist(eng, IP_PHASE_QUEUE, ktime_get_ns() - cur->queued);
+        // A wedged core fails what was queued on it without another wait
+        if (eng->wedged) {
+            cur->ret = -ETIMEDOUT;
+        } else {
+            cur->ret = cur->run(eng, cur->data);
+            if (cur->ret == -ETIMEDOUT)
+                ip_engine_recover(eng, "timed out");
+        }
+        if (budget)
+            budget--;
+        if (cur == &rq) {
+            ran = true;
+        } else {
+            atomic_inc(&eng->n_coalesced);
+            complete(&cur->done);
+        }
+
+        spin_lock(&eng->queue_lock);
+    }
+
+    cur = list_first_entry_or_null(&eng->queue, struct ip_request, node);
+    if (!cur)
+        eng->queue_running = false;
+    spin_unlock(&eng->queue_lock);
+    mutex_unlock(&eng->lock);
+
+    // Budget used up: the next waiter carries on, queue_running stays set
+    if (cur) {
+        cur->handoff = true;
+        complete(&cur->done);
+    }
+
+    return rq.ret;
+}
+
+// Dispatch
+//
+// A request goes to the instance of its type with the fewest requests
+// dispatched and not yet finished (eng->load); ties rotate so idle
+// instances share the work. Wedged instances are left out. The instance
+// lists only change at probe and unload, so dispatch walks them under RCU
+// and claims the pick with an atomic increment, without a lock shared by
+// all clients. Two clients may race for the same instance; the engine
+// queue then serialises them.
+//
+// avoid, if set, is only picked when no other instance is usable: a
+// request that just timed out there goes elsewhere if it can.
+static struct ip_engine *ip_engine_pick(enum ip_engine_id id, struct ip_engine *avoid) {
+    struct ip_engine *eng, *pick = NULL;
+    unsigned int n, start, key, best = UINT_MAX;
+
+    rcu_read_lock();
+    n = READ_ONCE(crypto_dev.n_engines[id]);
+    if (n) {
+        start = (unsigned int)atomic_inc_return(&crypto_dev.next_engine[id]) % n;
+        list_for_each_entry_rcu(eng, &crypto_dev.engines[id], node) {
+            if (READ_ONCE(eng->wedged))
+                continue;
+            key = atomic_read(&eng->load) * n + (eng->index + n - start) % n;
+            if (eng == avoid)
+                key |= 1U << 31;
+            if (key < best) {
+                best = key;
+                pick = eng;
+            }
+        }
+        if (pick)
+            atomic_inc(&pick->load);
+    }
+    rcu_read_unlock();
+    return pick;
+}
+
+static struct ip_engine *ip_engine_get(enum ip_engine_id id) {
+    return ip_engine_pick(id, NULL);
+}
+
+static void ip_engine_put(struct ip_engine *eng) {
+    atomic_dec(&eng->load);
+}
+
+// Queue a request on the least-loaded instance of the type
+static int ip_type_submit(enum ip_engine_id id, unsigned int prio, ip_request_fn run,
+                          void *data) {
+    struct ip_engine *eng = ip_engine_get(id);
+    int ret;
+
+    if (!eng)
+        return -ENODEV;
+    atomic_inc(&eng->n_requests);
+    ret = ip_engine_submit(eng, prio, run, data);
+    ip_engine_put(eng);
+    return ret;
+}
+
+// Queue a request on instance index of the type, or on the least-loaded
+// one if there is no such instance or it is wedged
+static int ip_instance_submit(enum ip_engine_id id, unsigned int index, ip_request_fn run,
+                              void *data) {
+    struct ip_engine *eng, *pick = NULL;
+    int ret;
+
+    rcu_read_lock();
+    list_for_each_entry_rcu(eng, &crypto_dev.engines[id], node) {
+        if (eng->index == index && !READ_ONCE(eng->wedged)) {
+            pick = eng;
+            atomic_inc(&pick->load);
+            break;
+        }
+    }
+    rcu_read_unlock();
+    if (!pick)
+        return ip_type_submit(id, CRYPTO_PRIO_NORMAL, run, data);
+
+    atomic_inc(&pick->n_requests);
+    ret = ip_engine_submit(pick, CRYPTO_PRIO_NORMAL, run, data);
+    ip_engine_put(pick);
+    return ret;
+}
+
+// Submit to eng, already claimed by ip_engine_get(), for requests that can
+// run again from the start: their inputs are intact and a second run just
+// writes the same outputs. One that times out runs once more, on another
+// instance if there is a healthy one, else on eng after its reset.
+static int ip_engine_submit_retry(struct ip_engine *eng, unsigned int prio, ip_request_fn run,
+                                  void *data) {
+    struct ip_engine *next;
+    int ret;
+
+    atomic_inc(&eng->n_requests);
+    ret = ip_engine_submit(eng, prio, run, data);
+    ip_engine_put(eng);
+    if (ret != -ETIMEDOUT)
+        return ret;
+
+    next = ip_engine_pick(eng->id, eng);
+    if (!next)
+        return ret;
+    atomic_inc(&eng->n_redispatched);
+    atomic_inc(&next->n_requests);
+    ret = ip_engine_submit(next, prio, run, data);
+    ip_engine_put(next);
+    return ret;
+}
+
+typedef int (*ip_fallback_fn)(void *data);
+
+// A single op: queued like ip_type_submit(), run again after a timeout,
+// and done by sw (if any) when the cores of the type are all wedged
+static int ip_op_submit(enum ip_engine_id id, unsigned int prio, ip_request_fn run,
+                        ip_fallback_fn sw, void *data) {
+    struct ip_engine *eng = ip_engine_get(id);
+    int ret;
+
+    if (eng)
+        ret = ip_engine_submit_retry(eng, prio, run, data);
+    else
+        ret = READ_ONCE(crypto_dev.n_engines[id]) ? -ETIMEDOUT : -ENODEV;
+    if (ret != -ETIMEDOUT || !sw)
+        return ret;
+    atomic_inc(&ip_fallbacks[id]);
+    return sw(data);
+}
+
+// Watchdog
+//
+// Every watchdog_ms the instances nobody is using are looked at. One that
+// reports busy with no op started is reset before the next request has to
+// wait out its deadline, and a wedged one gets another reset. Instances in
+// use are covered by the op deadline instead.
+static void ip_watchdog_fn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(ip_watchdog_work, ip_watchdog_fn);
+
+static void ip_watchdog_fn(struct work_struct *work) {
+    struct ip_engine *eng;
+    int i;
+
+    rcu_read_lock();
+    for (i = 0; i < ENGINE_CNT; i++) {
+        list_for_each_entry_rcu(eng, &crypto_dev.engines[i], node) {
+            if (!mutex_trylock(&eng->lock))
+                continue;
+            if (eng->wedged)
+                ip_engine_recover(eng, "wedged");
+            else if (ip_engine_stuck(eng))
+                ip_engine_recover(eng, "stuck while idle");
+            mutex_unlock(&eng->lock);
+        }
+    }
+    rcu_read_unlock();
+
+    schedule_delayed_work(&ip_watchdog_work, msecs_to_jiffies(watchdog_ms));
+}
+
+// The DES core raises ready once the previous block is out, so there is
+// nothing to reset between blocks
+static int des_wait_ready(struct ip_engine *eng) {
+    uint32_t status;
+
+    return read_poll_timeout_atomic(ip_engine_status, status, status & DES_STATUS_READY,
+                                    0, ip_engine_deadline_us(eng), false, eng);
+}
+
+// True if the key registers already hold key, otherwise remember it as
+// loaded; the caller writes the registers right after
+static bool ip_engine_key_loaded(struct ip_engine *eng, const uint32_t *key, int words) {
+    if (eng->key_valid && !memcmp(eng->key, key, words * sizeof(*key))) {
+        this_cpu_inc(eng->stats->key_reuse);
+        return true;
+    }
+    memcpy(eng->key, key, words * sizeof(*key));
+    eng->key_valid = true;
+    return false;
+}
+
+// Load the DES key registers
+static void des_hw_setkey(struct ip_engine *eng, uint64_t key) {
+    uint32_t words[2] = { (uint32_t)key, (uint32_t)(key >> 32) };
+
+    ip_engine_begin(eng);
+    if (ip_engine_key_loaded(eng, words, 2))
+        return;
+    ip_write(eng, DES_KEY_LO_REG, words[0]);
+    ip_write(eng, DES_KEY_HI_REG, words[1]);
+}
+
+// Run one block through the DES core, the key must already be loaded
+static int des_hw_crypt(struct ip_engine *eng, uint64_t in, uint64_t *out, bool decrypt) {
+    uint32_t res_high, res_low;
+    uint32_t status;
+
+    ip_engine_begin(eng);
+
+    // Back-to-back blocks only need the core to report ready
+    if (des_wait_ready(eng)) {
+        printk(KERN_ERR "DES core not ready!\n");
+        return -ETIMEDOUT;
+    }
+
+    // Write plaintext/ciphertext
+    ip_write(eng, DES_DATA_LO_REG, (uint32_t)in);
+    ip_write(eng, DES_DATA_HI_REG, (uint32_t)(in >> 32));
+
+    // Start encryption/decryption
+    ip_engine_start(eng, DES_CTRL_START | (decrypt ? DES_CTRL_DECRYPT : 0));
+
+    // Wait for completion
+    if (ip_engine_wait(eng, &status)) {
+        printk(KERN_ERR "DES %s timeout!\n", decrypt ? "decryption" : "encryption");
+        return -ETIMEDOUT;
+    }
+
+    // Read result
+    res_low = ip_read(eng, DES_RES_LO_REG);
+    res_high = ip_read(eng, DES_RES_HI_REG);
+    *out = ((uint64_t)res_high << 32) | res_low;
+
+    return 0;
+}
+
+// DES encrypt/decrypt function.
+// All *_op functions run with the engine lock held.
+static int des_crypt_op(struct ip_engine *eng, struct des_operation *op, bool decrypt) {
+    des_hw_setkey(eng, op->key);
+    return des_hw_crypt(eng, op->input, &op->output, decrypt);
+}
+
+// GCD calculation function
+static int gcd_calc_op(struct ip_engine *eng, struct gcd_operation *op) {
+    uint32_t result;
+
+    ip_engine_begin(eng);
+
+    // Ensure start signal is 0
+    ip_write(eng, GCD_CTRL_REG, 0);
+
+    // Write X and Y values
+    ip_write(eng, GCD_X_REG, op->x);
+    ip_write(eng, GCD_Y_REG, op->y);
+
+    // Start calculation
+    ip_engine_start(eng, GCD_CTRL_START);
+
+    // Wait for result
+    if (ip_engine_wait(eng, &result)) {
+        printk(KERN_ERR "GCD calculation timeout!\n");
+        return -ETIMEDOUT;
+    }
+
+    // Clear start signal
+    ip_write(eng, GCD_CTRL_REG, 0);
+
+    op->result = result & GCD_RESULT_MASK;
+    return 0;
+}
+
+// Load the AES key registers (4 x 32-bit words)
+static void aes_hw_setkey(struct ip_engine *eng, const uint32_t key[4]) {
+    int i;
+
+    ip_engine_begin(eng);
+    if (ip_engine_key_loaded(eng, key, 4))
+        return;
+    for (i = 0; i < 4; i++) {
+        ip_write(eng, AES_KEY_REG + (i * 4), key[i]);
+    }
+}
+
+// Run one block through the AES core, the key must already be loaded
+static int aes_hw_crypt(struct ip_engine *eng, const uint32_t in[4], uint32_t out[4], bool encrypt) {
+    uint32_t status;
+    int i;
+
+    ip_engine_begin(eng);
+
+    // Write input data (4 x 32-bit words)
+    for (i = 0; i < 4; i++) {
+        ip_write(eng, AES_DATA_IN_REG + (i * 4), in[i]);
+    }
+
+    // Start encryption/decryption
+    ip_engine_start(eng, AES_CTRL_START | (encrypt ? AES_CTRL_ENCRYPT : 0));
+
+    // Wait for completion
+    if (ip_engine_wait(eng, &status)) {
+        printk(KERN_ERR "AES %s timeout!\n", encrypt ? "encryption" : "decryption");
+        return -ETIMEDOUT;
+    }
+
+    // Read result (4 x 32-bit words)
+    for (i = 0; i < 4; i++) {
+        out[i] = ip_read(eng, AES_DATA_OUT_REG + (i * 4));
+    }
+
+    return 0;
+}
+
+// AES encrypt function
+static int aes_encrypt_op(struct ip_engine *eng, struct aes_operation *op) {
+    aes_hw_setkey(eng, op->key);
+    return aes_hw_crypt(eng, op->input, op->output, true);
+}
+
+#if IS_ENABLED(CONFIG_CRYPTO_LIB_DES) && IS_ENABLED(CONFIG_CRYPTO_LIB_AES)
+// The cores in software through lib/crypto, same arguments as
+// des_hw_crypt()/aes_hw_crypt(). Register words map to bytes big-endian,
+// as in crypto_ips_block().
+static void des_sw_crypt(uint64_t key, uint64_t in, uint64_t *out, bool decrypt) {
+    struct des_ctx ctx;
+    uint8_t k[DES_KEY_SIZE], src[DES_BLOCK_SIZE], dst[DES_BLOCK_SIZE];
+
+    put_unaligned_be64(key, k);
+    put_unaligned_be64(in, src);
+    des_expand_key(&ctx, k, DES_KEY_SIZE);  // weak keys are expanded anyway, as by the core
+    if (decrypt)
+        des_decrypt(&ctx, dst, src);
+    else
+        des_encrypt(&ctx, dst, src);
+    *out = get_unaligned_be64(dst);
+    memzero_explicit(&ctx, sizeof(ctx));
+}
+
+static void aes_sw_crypt(const uint32_t key[4], const uint32_t in[4], uint32_t out[4],
+                         bool encrypt) {
+    struct crypto_aes_ctx ctx;
+    uint8_t k[AES_KEYSIZE_128], src[AES_BLOCK_SIZE], dst[AES_BLOCK_SIZE];
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        put_unaligned_be32(key[i], k + i * 4);
+        put_unaligned_be32(in[i], src + i * 4);
+    }
+    aes_expandkey(&ctx, k, AES_KEYSIZE_128);
+    if (encrypt)
+        aes_encrypt(&ctx, dst, src);
+    else
+        aes_decrypt(&ctx, dst, src);
+    for (i = 0; i < 4; i++)
+        out[i] = get_unaligned_be32(dst + i * 4);
+    memzero_explicit(&ctx, sizeof(ctx));
+}
+#endif
+
+// Register model (mock=1)
+//
+// Stands in for the PL so the driver can be exercised without the board.
+// Each engine gets a plain register file. Writing the start bit computes
+// the result in software and arms an hrtimer; when it fires the done flag
+// is raised and, if the done interrupt is enabled in the control register,
+// the same handlers as the real interrupt run. DES/AES are computed with
+// the register words as big-endian bytes, as crypto_ips_block() feeds the
+// cores; see crypto_ips_kat() for the check that the cores agree.
+#if IS_ENABLED(CONFIG_CRYPTO_LIB_DES) && IS_ENABLED(CONFIG_CRYPTO_LIB_AES)
+static void mock_compute(struct ip_engine *eng, uint32_t ctrl) {
+    uint32_t *r = eng->mock_regs;
+    uint64_t val;
+
+    switch (eng->id) {
+    case ENGINE_DES:
+        des_sw_crypt(((uint64_t)r[DES_KEY_HI_REG / 4] << 32) | r[DES_KEY_LO_REG / 4],
+                     ((uint64_t)r[DES_DATA_HI_REG / 4] << 32) | r[DES_DATA_LO_REG / 4], &val,
+                     ctrl & DES_CTRL_DECRYPT);
+        r[DES_RES_LO_REG / 4] = (uint32_t)val;
+        r[DES_RES_HI_REG / 4] = (uint32_t)(val >> 32);
+        r[DES_STATUS_REG / 4] = 0;  // busy: neither done nor ready
+        break;
+    case ENGINE_AES:
+        aes_sw_crypt(&r[AES_KEY_REG / 4], &r[AES_DATA_IN_REG / 4], &r[AES_DATA_OUT_REG / 4],
+                     ctrl & AES_CTRL_ENCRYPT);
+        r[AES_STATUS_REG / 4] = AES_STATUS_BUSY;
+        break;
+    case ENGINE_GCD:
+        // Like the wrapper: cleared on start, result and done flag together
+        eng->mock_result = gcd(r[GCD_X_REG / 4] & 0xFF, r[GCD_Y_REG / 4] & 0xFF);
+        r[GCD_RESULT_REG / 4] = 0;
+        break;
+    default:
+        break;
+    }
+}
+
+// The AXI-Stream variant: each block of stream_in goes through the data
+// registers and mock_compute() as if it had arrived on the stream
+static void mock_stream(struct ip_engine *eng, size_t len, uint32_t ctrl) {
+    uint32_t *r = eng->mock_regs;
+    uint64_t val;
+    size_t off;
+    int i;
+
+    for (off = 0; off < len; off += eng->block_bytes) {
+        if (eng->id == ENGINE_DES) {
+            val = get_unaligned_be64(eng->stream_in + off);
+            r[DES_DATA_LO_REG / 4] = (uint32_t)val;
+            r[DES_DATA_HI_REG / 4] = (uint32_t)(val >> 32);
+            mock_compute(eng, ctrl);
+            val = ((uint64_t)r[DES_RES_HI_REG / 4] << 32) | r[DES_RES_LO_REG / 4];
+            put_unaligned_be64(val, eng->stream_out + off);
+        } else {
+            for (i = 0; i < 4; i++)
+                r[AES_DATA_IN_REG / 4 + i] = get_unaligned_be32(eng->stream_in + off + i * 4);
+            mock_compute(eng, ctrl);
+            for (i = 0; i < 4; i++)
+                put_unaligned_be32(r[AES_DATA_OUT_REG / 4 + i], eng->stream_out + off + i * 4);
+        }
+    }
+    r[eng->status_reg / 4] = eng->id == ENGINE_DES ? DES_STATUS_DONE | DES_STATUS_READY :
+                                                     AES_STATUS_DONE;
+}
+
+static bool mock_supported(void) {
+    return true;
+}
+#else
+static void mock_compute(struct ip_engine *eng, uint32_t ctrl) {
+}
+
+static void mock_stream(struct ip_engine *eng, size_t len, uint32_t ctrl) {
+}
+
+static bool mock_supported(void) {
+    return false;
+}
+#endif
+
+// Take one of the mock_stall starts, if any are left
+static bool mock_take_stall(void) {
+    unsigned int n = READ_ONCE(mock_stall), old;
+
+    while (n) {
+        old = cmpxchg(&mock_stall, n, n - 1);
+        if (old == n)
+            return true;
+        n = old;
+    }
+    return false;
+}
+
+static void mock_write(struct ip_engine *eng, uint32_t off, uint32_t val) {
+    uint32_t prev = eng->mock_regs[off / 4];
+
+    // Status and result registers are read-only in the PL
+    if (off == eng->status_reg)
+        return;
+
+    // Soft reset: state after probe, over before the next register access
+    if (off == eng->ctrl_reg && (val & IP_CTRL_SOFT_RESET)) {
+        hrtimer_try_to_cancel(&eng->mock_timer);
+        WRITE_ONCE(eng->mock_regs[off / 4], 0);
+        WRITE_ONCE(eng->mock_regs[eng->status_reg / 4],
+                   eng->id == ENGINE_DES ? DES_STATUS_READY : 0);
+        return;
+    }
+
+    WRITE_ONCE(eng->mock_regs[off / 4], val);
+    if (off != eng->ctrl_reg || !(val & eng->start_bit) || (prev & eng->start_bit))
+        return;
+
+    // A wedged core: busy, no result, no done interrupt
+    if (mock_take_stall()) {
+        WRITE_ONCE(eng->mock_regs[eng->status_reg / 4],
+                   eng->id == ENGINE_AES ? AES_STATUS_BUSY : 0);
+        return;
+    }
+
+    mock_compute(eng, val);
+    // The AES and DES cores clear their start bit by themselves
+    if (eng->id == ENGINE_AES || eng->id == ENGINE_DES)
+        eng->mock_regs[off / 4] &= ~eng->start_bit;
+    hrtimer_start(&eng->mock_timer, ns_to_ktime(mock_delay_ns), HRTIMER_MODE_REL);
+}
+
+static enum hrtimer_restart mock_timer_fn(struct hrtimer *timer) {
+    struct ip_engine *eng = container_of(timer, struct ip_engine, mock_timer);
+    uint32_t *r = eng->mock_regs;
+
+    switch (eng->id) {
+    case ENGINE_AES:
+        WRITE_ONCE(r[AES_STATUS_REG / 4], AES_STATUS_DONE);
+        break;
+    case ENGINE_DES:
+        WRITE_ONCE(r[DES_STATUS_REG / 4], DES_STATUS_DONE | DES_STATUS_READY);
+        break;
+    case ENGINE_GCD:
+        WRITE_ONCE(r[GCD_RESULT_REG / 4], eng->mock_result | GCD_RESULT_DONE);
+        break;
+    default:
+        break;
+    }
+
+    if ((r[eng->ctrl_reg / 4] & eng->irq_en_bit) &&
+        ip_engine_irq(0, eng) == IRQ_WAKE_THREAD)
+        ip_engine_irq_thread(0, eng);
+
+    return HRTIMER_NORESTART;
+}
+
+// Probe of a register model instance: a register file instead of MMIO
+static int mock_engine_init(struct device *dev, struct ip_engine *eng) {
+    eng->mock_regs = devm_kzalloc(dev, IP_SIZE, GFP_KERNEL);
+    if (!eng->mock_regs)
+        return -ENOMEM;
+    if (eng->id == ENGINE_DES)
+        eng->mock_regs[DES_STATUS_REG / 4] = DES_STATUS_READY;
+    hrtimer_init(&eng->mock_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    eng->mock_timer.function = mock_timer_fn;
+    // The hrtimer plays the part of the done interrupt
+    eng->use_irq = true;
+
+    if (mock_dma && eng->stream_bit) {
+        eng->stream_in = devm_kzalloc(dev, IP_STREAM_SIZE, GFP_KERNEL);
+        eng->stream_out = devm_kzalloc(dev, IP_STREAM_SIZE, GFP_KERNEL);
+        if (!eng->stream_in || !eng->stream_out)
+            return -ENOMEM;
+    }
+    return 0;
+}
+
+// Create mock_engines platform devices per core; they probe like DT nodes
+static int mock_init(void) {
+    struct platform_device *pdev;
+    int i, n;
+
+    if (!mock_supported()) {
+        printk(KERN_ERR "mock=1 needs CONFIG_CRYPTO_LIB_DES and CONFIG_CRYPTO_LIB_AES\n");
+        return -EINVAL;
+    }
+    if (mock_engines < 1 || mock_engines > MOCK_ENGINES_MAX) {
+        printk(KERN_ERR "mock_engines must be 1-%d\n", MOCK_ENGINES_MAX);
+        return -EINVAL;
+    }
+
+    crypto_dev.inter_base = (void __iomem *)kzalloc(IP_SIZE, GFP_KERNEL);
+    if (!crypto_dev.inter_base)
+        return -ENOMEM;
+
+    for (i = 0; i < ENGINE_CNT; i++) {
+        for (n = 0; n < mock_engines; n++) {
+            pdev = platform_device_register_simple(crypto_ips_engine_ids[i].name,
+                                                   PLATFORM_DEVID_AUTO, NULL, 0);
+            if (IS_ERR(pdev))
+                return PTR_ERR(pdev);
+            mock_pdevs[i * MOCK_ENGINES_MAX + n] = pdev;
+        }
+    }
+
+    printk(KERN_INFO "Crypto IPs using register model, %u of each core, done after %u ns\n",
+           mock_engines, mock_delay_ns);
+    return 0;
+}
+
+static void mock_exit(void) {
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(mock_pdevs); i++) {
+        if (mock_pdevs[i]) {
+            platform_device_unregister(mock_pdevs[i]);
+            mock_pdevs[i] = NULL;
+        }
+    }
+    kfree((void __force *)crypto_dev.inter_base);
+    crypto_dev.inter_base = NULL;
+}
+
+// Stream path
+//
+// The AXI-Stream variants of the AES and DES cores keep the AXI-Lite map
+// for the key and control registers but take their data from an AXI DMA
+// instead of the data registers. While the stream bit is set in the
+// control register, every block arriving on the slave stream (MM2S) is run
+// under the loaded key and direction, and its result leaves on the master
+// stream (S2MM). Blocks travel in memory order, the byte order of the
+// crypto API; the core forms its big-endian words itself. A transfer is
+// over when S2MM has written the last result, so the done flag is not
+// involved, and clearing the stream bit returns the core to register mode.
+//
+// Payloads are staged in the engine's coherent buffers, IP_STREAM_SIZE at
+// a time: a 16 KiB chunk costs two memcpys and one DMA round trip instead
+// of two MMIO accesses per 32-bit word.
+static inline bool ip_engine_can_stream(struct ip_engine *eng, size_t len) {
+    unsigned int min = READ_ONCE(stream_min);
+
+    return eng->stream_in && min && len >= min;
+}
+
+// Direction bits as the register path sets them
+static inline uint32_t ip_engine_stream_dir(struct ip_engine *eng, bool decrypt) {
+    if (eng->id == ENGINE_AES)
+        return decrypt ? 0 : AES_CTRL_ENCRYPT;
+    return decrypt ? DES_CTRL_DECRYPT : 0;
+}
+
+static void ip_engine_dma_callback(void *data) {
+    struct ip_engine *eng = data;
+
+    complete(&eng->dma_done);
+}
+
+// One chunk through the AXI DMA. The receive side is queued first so the
+// results have somewhere to go as soon as the first block is in.
+static int ip_engine_dma_run(struct ip_engine *eng, size_t len, uint32_t ctrl) {
+    struct dma_async_tx_descriptor *tx, *rx;
+    int ret = -EIO;
+
+    reinit_completion(&eng->dma_done);
+    rx = dmaengine_prep_slave_single(eng->dma_rx, eng->stream_out_dma, len, DMA_DEV_TO_MEM,
+                                     DMA_PREP_INTERRUPT | DMA_CTRL_ACK);
+    if (!rx)
+        return ret;
+    rx->callback = ip_engine_dma_callback;
+    rx->callback_param = eng;
+    if (dma_submit_error(dmaengine_submit(rx)))
+        return ret;
+
+    tx = dmaengine_prep_slave_single(eng->dma_tx, eng->stream_in_dma, len, DMA_MEM_TO_DEV,
+                                     DMA_CTRL_ACK);
+    if (!tx || dma_submit_error(dmaengine_submit(tx)))
+        goto out;
+
+    ip_write(eng, eng->ctrl_reg, eng->stream_bit | ctrl);
+    dma_async_issue_pending(eng->dma_rx);
+    dma_async_issue_pending(eng->dma_tx);
+
+    if (wait_for_completion_timeout(&eng->dma_done, usecs_to_jiffies(ip_engine_deadline_us(eng))))
+        ret = 0;
+    else
+        ret = -ETIMEDOUT;
+out:
+    if (ret) {
+        dmaengine_terminate_sync(eng->dma_tx);
+        dmaengine_terminate_sync(eng->dma_rx);
+    }
+    ip_write(eng, eng->ctrl_reg, 0);
+    return ret;
+}
+
+// Run len bytes (whole blocks) from stream_in to stream_out under the
+// loaded key. ctrl carries the direction bits; with the engine lock held.
+static int ip_engine_stream(struct ip_engine *eng, size_t len, uint32_t ctrl) {
+    u64 busy_ns;
+    int ret = 0;
+
+    ip_engine_begin(eng);
+    eng->t_start = ktime_get_ns();
+    trace_crypto_ips_start(eng->name, eng->index, eng->stream_bit | ctrl,
+                           eng->t_start - eng->t_program);
+    eng->t_program = 0;
+
+    if (mock)
+        mock_stream(eng, len, ctrl);
+    else
+        ret = ip_engine_dma_run(eng, len, ctrl);
+
+    busy_ns = ktime_get_ns() - eng->t_start;
+    ip_engine_account(eng, ret, ret ? 1 : len / eng->block_bytes, busy_ns);
+    if (ret) {
+        trace_crypto_ips_timeout(eng->name, eng->index, 0, busy_ns);
+        printk(KERN_ERR "%s: stream of %zu bytes failed, ret = %d\n", eng->label, len, ret);
+        return ret;
+    }
+    this_cpu_add(eng->stats->stream_bytes, len);
+    trace_crypto_ips_done(eng->name, eng->index, 0, busy_ns);
+    return 0;
+}
+
+static void ip_engine_dma_release(void *data) {
+    struct ip_engine *eng = data;
+
+    if (eng->stream_in)
+        dma_free_coherent(eng->dma_tx->device->dev, IP_STREAM_SIZE, eng->stream_in,
+                          eng->stream_in_dma);
+    if (eng->stream_out)
+        dma_free_coherent(eng->dma_rx->device->dev, IP_STREAM_SIZE, eng->stream_out,
+                          eng->stream_out_dma);
+    dma_release_channel(eng->dma_rx);
+    dma_release_channel(eng->dma_tx);
+}
+
+// Cores with "tx" and "rx" DMA channels in the DT are AXI-Stream variants.
+// Nodes without them keep the register path; a DMA controller that hasn't
+// probed yet defers the core.
+static int ip_engine_dma_init(struct device *dev, struct ip_engine *eng) {
+    int ret;
+
+    if (!eng->stream_bit)
+        return 0;
+
+    eng->dma_tx = dma_request_chan(dev, "tx");
+    if (IS_ERR(eng->dma_tx)) {
+        ret = PTR_ERR(eng->dma_tx);
+        eng->dma_tx = NULL;
+        return ret == -ENODEV ? 0 : ret;
+    }
+    eng->dma_rx = dma_request_chan(dev, "rx");
+    if (IS_ERR(eng->dma_rx)) {
+        ret = PTR_ERR(eng->dma_rx);
+        eng->dma_rx = NULL;
+        dma_release_channel(eng->dma_tx);
+        eng->dma_tx = NULL;
+        if (ret == -ENODEV)
+            printk(KERN_WARNING "%s: tx DMA channel without rx, using registers\n", dev_name(dev));
+        return ret == -ENODEV ? 0 : ret;
+    }
+    init_completion(&eng->dma_done);
+
+    ret = devm_add_action_or_reset(dev, ip_engine_dma_release, eng);
+    if (ret)
+        return ret;
+
+    // Each buffer belongs to the DMA controller that walks it
+    eng->stream_in = dma_alloc_coherent(eng->dma_tx->device->dev, IP_STREAM_SIZE,
+                                        &eng->stream_in_dma, GFP_KERNEL);
+    eng->stream_out = dma_alloc_coherent(eng->dma_rx->device->dev, IP_STREAM_SIZE,
+                                         &eng->stream_out_dma, GFP_KERNEL);
+    if (!eng->stream_in || !eng->stream_out)
+        return -ENOMEM;
+    return 0;
+}
+
+// Blocks in the byte order of the crypto API, big-endian words in the
+// registers. Shared by the skcipher algorithms and the streaming sessions.
+enum crypto_ips_mode {
+    CIPHER_ECB,
+    CIPHER_CBC,
+    CIPHER_CTR,
+};
+
+static int crypto_ips_block(struct ip_engine *eng, uint8_t *dst, const uint8_t *src, bool decrypt) {
+    uint32_t in[4], out[4];
+    uint64_t res;
+    int i, ret;
+
+    if (eng->id == ENGINE_DES) {
+        ret = des_hw_crypt(eng, get_unaligned_be64(src), &res, decrypt);
+        if (!ret)
+            put_unaligned_be64(res, dst);
+        return ret;
+    }
+
+    for (i = 0; i < 4; i++)
+        in[i] = get_unaligned_be32(src + i * 4);
+    ret = aes_hw_crypt(eng, in, out, !decrypt);
+    for (i = 0; !ret && i < 4; i++)
+        put_unaligned_be32(out[i], dst + i * 4);
+    return ret;
+}
+
+// ECB and CTR over the stream path, whole blocks only. CTR streams the
+// counter blocks and XORs the keystream on the way out.
+static int crypto_ips_stream(struct ip_engine *eng, enum crypto_ips_mode mode, bool decrypt,
+                             uint8_t *iv, uint8_t *dst, const uint8_t *src, unsigned int len) {
+    unsigned int bs = eng->block_bytes, n, i;
+    int ret = 0;
+
+    for (; !ret && len; len -= n, src += n, dst += n) {
+        n = min_t(unsigned int, len, IP_STREAM_SIZE);
+        if (mode == CIPHER_CTR) {
+            for (i = 0; i < n; i += bs) {
+                memcpy(eng->stream_in + i, iv, bs);
+                crypto_inc(iv, bs);
+            }
+            ret = ip_engine_stream(eng, n, ip_engine_stream_dir(eng, false));
+            if (!ret)
+                crypto_xor_cpy(dst, src, eng->stream_out, n);
+        } else {
+            memcpy(eng->stream_in, src, n);
+            ret = ip_engine_stream(eng, n, ip_engine_stream_dir(eng, decrypt));
+            if (!ret)
+                memcpy(dst, eng->stream_out, n);
+        }
+    }
+    return ret;
+}
+
+// Kernel crypto API (skcipher)
+//
+// ecb(aes), ctr(aes), ecb(des) and cbc(des) are served by the cores through
+// crypto_engine, whose worker feeds one request at a time to the hardware.
+// CTR and CBC are done here around the single-block cores, so the generic
+// templates don't split every request into one-block sub-requests. The AES
+// core only takes 128-bit keys; 192/256-bit keys go to a software fallback.
+// The crypto manager self-tests each algorithm when it is registered.
+#if IS_ENABLED(CONFIG_CRYPTO_ENGINE) && IS_ENABLED(CONFIG_CRYPTO_LIB_DES)
+#define CRYPTO_IPS_PRIORITY 300  // above the generic C implementations (100)
+
+struct crypto_ips_alg {
+    enum ip_engine_id id;
+    enum crypto_ips_mode mode;
+    bool registered;
+    struct skcipher_alg alg;
+};
+
+struct crypto_ips_tfm_ctx {
+    struct crypto_engine_ctx enginectx;  // must be first
+    uint8_t key[AES_MAX_KEY_SIZE];
+    unsigned int keylen;
+    struct crypto_skcipher *fallback;    // AES only
+};
+
+struct crypto_ips_req_ctx {
+    bool decrypt;
+    struct skcipher_request fallback_req;  // must be last
+};
+
+static struct crypto_ips_alg *crypto_ips_alg_of(struct crypto_skcipher *tfm) {
+    return container_of(crypto_skcipher_alg(tfm), struct crypto_ips_alg, alg);
+}
+
+// Key in the byte order of the crypto API, big-endian words in the
+// registers
+static void crypto_ips_load_key(struct ip_engine *eng, const struct crypto_ips_tfm_ctx *ctx) {
+    uint32_t key[4];
+    int i;
+
+    if (eng->id == ENGINE_DES) {
+        des_hw_setkey(eng, get_unaligned_be64(ctx->key));
+        return;
+    }
+    for (i = 0; i < 4; i++)
+        key[i] = get_unaligned_be32(ctx->key + i * 4);
+    aes_hw_setkey(eng, key);
+}
+
+// Queue callback for a crypto API request, runs with the engine lock held
+static int crypto_ips_run(struct ip_engine *eng, void *data) {
+    struct skcipher_request *req = data;
+    struct crypto_skcipher *tfm = crypto_skcipher_reqtfm(req);
+    struct crypto_ips_tfm_ctx *ctx = crypto_skcipher_ctx(tfm);
+    struct crypto_ips_req_ctx *rctx = skcipher_request_ctx(req);
+    struct crypto_ips_alg *ialg = crypto_ips_alg_of(tfm);
+    unsigned int bs = ialg->id == ENGINE_AES ? AES_BLOCK_SIZE : DES_BLOCK_SIZE;
+    uint8_t buf[AES_BLOCK_SIZE], *src, *dst;
+    struct skcipher_walk walk;
+    unsigned int nbytes;
+    int ret;
+
+    ret = skcipher_walk_virt(&walk, req, false);
+    if (ret)
+        return ret;
+
+    crypto_ips_load_key(eng, ctx);
+
+    while (!ret && (nbytes = walk.nbytes) >= bs) {
+        src = walk.src.virt.addr;
+        dst = walk.dst.virt.addr;
+
+        // Runs of whole ECB/CTR blocks go over the stream if the core has one
+        if (ialg->mode != CIPHER_CBC && ip_engine_can_stream(eng, nbytes - nbytes % bs)) {
+            ret = crypto_ips_stream(eng, ialg->mode, rctx->decrypt, walk.iv, dst, src,
+                                    nbytes - nbytes % bs);
+            nbytes %= bs;
+        }
+
+        for (; !ret && nbytes >= bs; nbytes -= bs, src += bs, dst += bs) {
+            switch (ialg->mode) {
+            case CIPHER_ECB:
+                ret = crypto_ips_block(eng, dst, src, rctx->decrypt);
+                break;
+            case CIPHER_CBC:
+                if (rctx->decrypt) {
+                    memcpy(buf, src, bs);  // src may be dst
+                    ret = crypto_ips_block(eng, dst, src, true);
+                    crypto_xor(dst, walk.iv, bs);
+                    memcpy(walk.iv, buf, bs);
+                } else {
+                    crypto_xor_cpy(buf, src, walk.iv, bs);
+                    ret = crypto_ips_block(eng, dst, buf, false);
+                    memcpy(walk.iv, dst, bs);
+                }
+                break;
+            case CIPHER_CTR:
+                ret = crypto_ips_block(eng, buf, walk.iv, false);
+                crypto_xor_cpy(dst, src, buf, bs);
+                crypto_inc(walk.iv, bs);
+                break;
+            }
+        }
+        // A negative count aborts the walk
+        ret = skcipher_walk_done(&walk, ret ? ret : nbytes);
+        cond_resched();
+    }
+
+    // CTR: keystream for the final partial block
+    if (!ret && walk.nbytes) {
+        ret = crypto_ips_block(eng, buf, walk.iv, false);
+        if (!ret) {
+            crypto_xor_cpy(walk.dst.virt.addr, walk.src.virt.addr, buf, walk.nbytes);
+            crypto_inc(walk.iv, bs);
+        }
+        ret = skcipher_walk_done(&walk, ret);
+    }
+
+    memzero_explicit(buf, sizeof(buf));
+    return ret;
+}
+
+static int crypto_ips_do_one_request(struct crypto_engine *engine, void *areq) {
+    struct skcipher_request *req = container_of(areq, struct skcipher_request, base);
+    enum ip_engine_id id = crypto_ips_alg_of(crypto_skcipher_reqtfm(req))->id;
+
+    // The crypto_engine worker is just one more client of the core's queue
+    crypto_finalize_skcipher_request(engine, req,
+                                     ip_type_submit(id, CRYPTO_PRIO_NORMAL, crypto_ips_run, req));
+    return 0;
+}
+
+static int crypto_ips_crypt(struct skcipher_request *req, bool decrypt) {
+    struct crypto_skcipher *tfm = crypto_skcipher_reqtfm(req);
+    struct crypto_ips_tfm_ctx *ctx = crypto_skcipher_ctx(tfm);
+    struct crypto_ips_req_ctx *rctx = skcipher_request_ctx(req);
+
+    if (crypto_ips_alg_of(tfm)->mode != CIPHER_CTR &&
+        req->cryptlen % crypto_skcipher_blocksize(tfm))
+        return -EINVAL;
+    if (!req->cryptlen)
+        return 0;
+
+    if (ctx->fallback && ctx->keylen != AES_KEYSIZE_128) {
+        skcipher_request_set_tfm(&rctx->fallback_req, ctx->fallback);
+        skcipher_request_set_callback(&rctx->fallback_req, req->base.flags,
+                                      req->base.complete, req->base.data);
+        skcipher_request_set_crypt(&rctx->fallback_req, req->src, req->dst,
+                                   req->cryptlen, req->iv);
+        return decrypt ? crypto_skcipher_decrypt(&rctx->fallback_req) :
+                         crypto_skcipher_encrypt(&rctx->fallback_req);
+    }
+
+    rctx->decrypt = decrypt;
+    return crypto_transfer_skcipher_request_to_engine(crypto_dev.skcipher_engine, req);
+}
+
+static int crypto_ips_encrypt(struct skcipher_request *req) {
+    return crypto_ips_crypt(req, false);
+}
+
+static int crypto_ips_decrypt(struct skcipher_request *req) {
+    return crypto_ips_crypt(req, true);
+}
+
+static int crypto_ips_aes_setkey(struct crypto_skcipher *tfm, const uint8_t *key, unsigned int keylen) {
+    struct crypto_ips_tfm_ctx *ctx = crypto_skcipher_ctx(tfm);
+
+    if (keylen != AES_KEYSIZE_128 && keylen != AES_KEYSIZE_192 && keylen != AES_KEYSIZE_256)
+        return -EINVAL;
+    memcpy(ctx->key, key, keylen);
+    ctx->keylen = keylen;
+
+    crypto_skcipher_clear_flags(ctx->fallback, CRYPTO_TFM_REQ_MASK);
+    crypto_skcipher_set_flags(ctx->fallback, crypto_skcipher_get_flags(tfm) & CRYPTO_TFM_REQ_MASK);
+    return crypto_skcipher_setkey(ctx->fallback, key, keylen);
+}
+
+static int crypto_ips_des_setkey(struct crypto_skcipher *tfm, const uint8_t *key, unsigned int keylen) {
+    struct crypto_ips_tfm_ctx *ctx = crypto_skcipher_ctx(tfm);
+    int ret;
+
+    ret = verify_skcipher_des_key(tfm, key);
+    if (ret)
+        return ret;
+    memcpy(ctx->key, key, DES_KEY_SIZE);
+    ctx->keylen = DES_KEY_SIZE;
+    return 0;
+}
+
+static int crypto_ips_init_tfm(struct crypto_skcipher *tfm) {
+    struct crypto_ips_tfm_ctx *ctx = crypto_skcipher_ctx(tfm);
+    unsigned int reqsize = sizeof(struct crypto_ips_req_ctx);
+
+    ctx->enginectx.op.do_one_request = crypto_ips_do_one_request;
+
+    if (crypto_ips_alg_of(tfm)->id == ENGINE_AES) {
+        ctx->fallback = crypto_alloc_skcipher(crypto_tfm_alg_name(crypto_skcipher_tfm(tfm)),
+                                              0, CRYPTO_ALG_NEED_FALLBACK);
+        if (IS_ERR(ctx->fallback))
+            return PTR_ERR(ctx->fallback);
+        reqsize += crypto_skcipher_reqsize(ctx->fallback);
+    }
+    crypto_skcipher_set_reqsize(tfm, reqsize);
+    return 0;
+}
+
+static void crypto_ips_exit_tfm(struct crypto_skcipher *tfm) {
+    struct crypto_ips_tfm_ctx *ctx = crypto_skcipher_ctx(tfm);
+
+    if (ctx->fallback)
+        crypto_free_skcipher(ctx->fallback);
+    memzero_explicit(ctx->key, sizeof(ctx->key));
+}
+
+#define CRYPTO_IPS_ALG(_id, _mode, _name, _drv, _bs, _chunk, _keymin, _keymax, _ivsize, _setkey, _flags) \
+    {                                                                   \
+        .id = _id,                                                      \
+        .mode = _mode,                                                  \
+        .alg = {                                                        \
+            .base = {                                                   \
+                .cra_name = _name,                                      \
+                .cra_driver_name = _drv,                                \
+                .cra_priority = CRYPTO_IPS_PRIORITY,                    \
+                .cra_flags = CRYPTO_ALG_ASYNC | CRYPTO_ALG_KERN_DRIVER_ONLY | (_flags), \
+                .cra_blocksize = _bs,                                   \
+                .cra_ctxsize = sizeof(struct crypto_ips_tfm_ctx),       \
+                .cra_module = THIS_MODULE,                              \
+            },                                                          \
+            .min_keysize = _keymin,                                     \
+            .max_keysize = _keymax,                                     \
+            .ivsize = _ivsize,                                          \
+            .chunksize = _chunk,                                        \
+            .setkey = _setkey,                                          \
+            .encrypt = crypto_ips_encrypt,                              \
+            .decrypt = crypto_ips_decrypt,                              \
+            .init = crypto_ips_init_tfm,                                \
+            .exit = crypto_ips_exit_tfm,                                \
+        },                                                              \
+    }
+
+static struct crypto_ips_alg crypto_ips_algs[] = {
+    CRYPTO_IPS_ALG(ENGINE_AES, CIPHER_ECB, "ecb(aes)", "ecb-aes-crypto-ips", AES_BLOCK_SIZE, 0,
+                   AES_MIN_KEY_SIZE, AES_MAX_KEY_SIZE, 0, crypto_ips_aes_setkey,
+                   CRYPTO_ALG_NEED_FALLBACK),
+    CRYPTO_IPS_ALG(ENGINE_AES, CIPHER_CTR, "ctr(aes)", "ctr-aes-crypto-ips", 1, AES_BLOCK_SIZE,
+                   AES_MIN_KEY_SIZE, AES_MAX_KEY_SIZE, AES_BLOCK_SIZE, crypto_ips_aes_setkey,
+                   CRYPTO_ALG_NEED_FALLBACK),
+    CRYPTO_IPS_ALG(ENGINE_DES, CIPHER_ECB, "ecb(des)", "ecb-des-crypto-ips", DES_BLOCK_SIZE, 0,
+                   DES_KEY_SIZE, DES_KEY_SIZE, 0, crypto_ips_des_setkey, 0),
+    CRYPTO_IPS_ALG(ENGINE_DES, CIPHER_CBC, "cbc(des)", "cbc-des-crypto-ips", DES_BLOCK_SIZE, 0,
+                   DES_KEY_SIZE, DES_KEY_SIZE, DES_BLOCK_SIZE, crypto_ips_des_setkey, 0),
+};
+
+static DEFINE_MUTEX(crypto_ips_algs_lock);
+
+static int crypto_ips_kat_run(struct ip_engine *eng, void *op) {
+    return eng->id == ENGINE_DES ? des_crypt_op(eng, op, false) : aes_encrypt_op(eng, op);
+}
+
+// Standard names, the block device and the hwrng are only offered by cores
+// that compute the standard: the FIPS 46 example and the FIPS 197 appendix
+// C.1 vector, in the word order of crypto_ips_block()
+static bool crypto_ips_kat(enum ip_engine_id id) {
+    static const uint32_t aes_expect[4] = { 0x69c4e0d8, 0x6a7b0430, 0xd8cdb780, 0x70b4c55a };
+    struct des_operation des = { .input = 0x0123456789ABCDEFULL, .key = 0x133457799BBCDFF1ULL };
+    struct aes_operation aes = {
+        .key = { 0x00010203, 0x04050607, 0x08090a0b, 0x0c0d0e0f },
+        .input = { 0x00112233, 0x44556677, 0x8899aabb, 0xccddeeff },
+    };
+    int ret;
+
+    if (id == ENGINE_DES) {
+        ret = ip_type_submit(id, CRYPTO_PRIO_NORMAL, crypto_ips_kat_run, &des);
+        if (!ret && des.output == 0x85E813540F0AB405ULL)
+            return true;
+    } else if (id == ENGINE_AES) {
+        ret = ip_type_submit(id, CRYPTO_PRIO_NORMAL, crypto_ips_kat_run, &aes);
+        if (!ret && !memcmp(aes.output, aes_expect, sizeof(aes_expect)))
+            return true;
+    } else {
+        return true;
+    }
+    printk(KERN_ERR "%s: known-answer test failed (%d)\n", ip_engine_types[id].name, ret);
+    return false;
+}
+
+// Called when the first instance of a core type probes, so the self-tests
+// run at registration have hardware to run on
+static void crypto_ips_register_algs(enum ip_engine_id id) {
+    int i, ret;
+
+    if (!skcipher)
+        return;
+    if (!crypto_ips_kat(id)) {
+        printk(KERN_ERR "%s: crypto API algorithms not registered\n", ip_engine_types[id].name);
+        return;
+    }
+
+    mutex_lock(&crypto_ips_algs_lock);
+    if (!crypto_dev.skcipher_engine) {
+        crypto_dev.skcipher_engine = crypto_engine_alloc_init(crypto_dev.dev, true);
+        if (!crypto_dev.skcipher_engine) {
+            printk(KERN_ERR "crypto_engine allocation failed, crypto API disabled\n");
+            goto out;
+        }
+        ret = crypto_engine_start(crypto_dev.skcipher_engine);
+        if (ret) {
+            printk(KERN_ERR "crypto_engine start failed, ret = %d\n", ret);
+            crypto_engine_exit(crypto_dev.skcipher_engine);
+            crypto_dev.skcipher_engine = NULL;
+            goto out;
+        }
+    }
+
+    for (i = 0; i < ARRAY_SIZE(crypto_ips_algs); i++) {
+        struct crypto_ips_alg *ialg = &crypto_ips_algs[i];
+
+        if (ialg->id != id || ialg->registered)
+            continue;
+        ret = crypto_register_skcipher(&ialg->alg);
+        if (ret) {
+            printk(KERN_ERR "registering %s failed, ret = %d\n", ialg->alg.base.cra_driver_name, ret);
+            continue;
+        }
+        ialg->registered = true;
+        printk(KERN_INFO "%s registered as %s\n", ialg->alg.base.cra_driver_name, ialg->alg.base.cra_name);
+    }
+out:
+    mutex_unlock(&crypto_ips_algs_lock);
+}
+
+static void crypto_ips_unregister_algs(void) {
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(crypto_ips_algs); i++) {
+        if (crypto_ips_algs[i].registered) {
+            crypto_unregister_skcipher(&crypto_ips_algs[i].alg);
+            crypto_ips_algs[i].registered = false;
+        }
+    }
+    if (crypto_dev.skcipher_engine) {
+        crypto_engine_exit(crypto_dev.skcipher_engine);
+        crypto_dev.skcipher_engine = NULL;
+    }
+}
+#else
+static void crypto_ips_register_algs(enum ip_engine_id id) {
+    if (skcipher)
+        printk_once(KERN_INFO "crypto API registration needs CONFIG_CRYPTO_ENGINE and CONFIG_CRYPTO_LIB_DES\n");
+}
+
+static void crypto_ips_unregister_algs(void) {
+}
+#endif
+
+// Per-fd state for the asynchronous interface
+struct crypto_client {
+    spinlock_t lock;
+    bool async;                 // CRYPTO_ASYNC_SETUP done, read() returns completions
+    uint32_t next_tag;
+    unsigned int inflight;      // submitted, completion not queued yet
+    struct mutex read_lock;     // kfifo_to_user() and the stream want a single reader
+    wait_queue_head_t wait;     // readers, pollers and release
+    struct eventfd_ctx *eventfd;
+    DECLARE_KFIFO(done, struct crypto_completion, CRYPTO_ASYNC_DEPTH);
+    // Session keys from CRYPTO_SET_KEY, indexed by CRYPTO_KEY_*, under lock
+    struct crypto_key keys[2];
+    bool key_set[2];
+    // CRYPTO_EVENT_SETUP done, read() returns events; queue under event_lock
+    bool events_on;
+    struct list_head event_node;
+    uint32_t events_dropped;
+    DECLARE_KFIFO(events, struct crypto_event, CRYPTO_EVENT_DEPTH);
+    struct fasync_struct *fasync;
+    // CRYPTO_STREAM_SETUP done, read() and write() carry the stream
+    struct crypto_stream *stream;
+    struct mutex write_lock;    // one writer fills the stream buffers
+    // CRYPTO_SET_QOS: class of everything submitted, and the token bucket
+    // in 1/NSEC_PER_SEC blocks, negative while overdrawn; under lock
+    unsigned int prio;
+    uint32_t qos_rate;          // blocks per second, 0 for no limit
+    s64 qos_tokens;
+    s64 qos_cap;
+    u64 qos_stamp;              // last refill
+};
+
+// Quality of service
+//
+// The class rides along with each request into the engine queues. The
+// bucket is charged when an ioctl or write submits, by the blocks it
+// carries; it may go negative by one call, so a batch is never held back
+// part way, and the next call waits until the bucket is back above zero.
+static long crypto_qos_ioctl(struct file *filp, unsigned long arg) {
+    struct crypto_client *client = filp->private_data;
+    struct crypto_qos qos;
+    uint32_t burst;
+
+    if (copy_from_user(&qos, (void __user *)arg, sizeof(qos)))
+        return -EFAULT;
+    if (qos.prio >= CRYPTO_PRIO_CNT || qos.burst > CRYPTO_QOS_BURST_MAX || qos.reserved)
+        return -EINVAL;
+    burst = qos.burst ?: clamp_t(uint32_t, qos.rate, 1, CRYPTO_QOS_BURST_MAX);
+
+    spin_lock(&client->lock);
+    WRITE_ONCE(client->prio, qos.prio);
+    client->qos_rate = qos.rate;
+    client->qos_cap = (s64)burst * NSEC_PER_SEC;
+    client->qos_tokens = client->qos_cap;
+    client->qos_stamp = ktime_get_ns();
+    spin_unlock(&client->lock);
+    return 0;
+}
+
+// Charge blocks to the fd's bucket, first waiting out any overdraft.
+// 0, -EAGAIN with nonblock, or -ERESTARTSYS on a signal.
+static int crypto_client_throttle(struct crypto_client *client, uint32_t blocks, bool nonblock) {
+    u64 now, need, wait;
+    ktime_t t;
+
+    for (;;) {
+        spin_lock(&client->lock);
+        if (!client->qos_rate) {
+            spin_unlock(&client->lock);
+            return 0;
+        }
+        // Refill; need/rate bounds the product, so it cannot overflow
+        now = ktime_get_ns();
+        need = client->qos_cap - client->qos_tokens;
+        if (now - client->qos_stamp >= div_u64(need, client->qos_rate))
+            client->qos_tokens = client->qos_cap;
+        else
+            client->qos_tokens += (now - client->qos_stamp) * client->qos_rate;
+        client->qos_stamp = now;
+        if (client->qos_tokens >= 0) {
+            client->qos_tokens -= (s64)blocks * NSEC_PER_SEC;
+            spin_unlock(&client->lock);
+            return 0;
+        }
+        wait = div_u64(-client->qos_tokens + client->qos_rate - 1, client->qos_rate);
+        spin_unlock(&client->lock);
+
+        if (nonblock)
+            return -EAGAIN;
+        t = ns_to_ktime(wait);
+        set_current_state(TASK_INTERRUPTIBLE);
+        schedule_hrtimeout(&t, HRTIMER_MODE_REL);
+        if (signal_pending(current))
+            return -ERESTARTSYS;
+    }
+}
+
+// Button and switch events
+//
+// CRYPTO_EVENT_SETUP subscribes an fd to the inter IP: read() then returns
+// struct crypto_event records, poll() reports POLLIN while some are queued
+// and, with O_ASYNC, the owner gets SIGIO for each one. Presses come from
+// the button interrupt and are stamped in the handler. The inter IP raises
+// no interrupt for the switches, so they are sampled every switch_poll_ms
+// while anyone is subscribed.
+static LIST_HEAD(event_clients);
+static DEFINE_SPINLOCK(event_lock);     // event_clients and their queues, also taken in the IRQ
+static int switch_last = -1;            // last sampled value, under event_lock
+static u64 button_last;                 // last press accepted, button IRQ only
+
+static unsigned int switch_poll_ms = 10;
+module_param(switch_poll_ms, uint, 0644);
+MODULE_PARM_DESC(switch_poll_ms, "Switch sampling period for event subscribers (ms)");
+
+static unsigned int button_debounce_ms = 20;
+module_param(button_debounce_ms, uint, 0644);
+MODULE_PARM_DESC(button_debounce_ms, "Button edges closer than this to the last press are bounce (ms)");
+
+static inline int inter_switches(void __iomem *base) {
+    return (readl(base + INTER_SWITCH_REG) >> INTER_SWITCH_SHIFT) & 0xff;
+}
+
+static bool crypto_events_pending(struct crypto_client *client) {
+    unsigned long flags;
+    bool pending;
+
+    spin_lock_irqsave(&event_lock, flags);
+    pending = !kfifo_is_empty(&client->events);
+    spin_unlock_irqrestore(&event_lock, flags);
+    return pending;
+}
+
+// Queue an event for every subscriber, with event_lock held. A full queue
+// keeps its older events and the next one that fits reports the loss.
+static void crypto_event_post_locked(uint32_t type, uint32_t value, u64 ts) {
+    struct crypto_event ev = { .timestamp_ns = ts, .type = type, .value = value };
+    struct crypto_client *client;
+
+    list_for_each_entry(client, &event_clients, event_node) {
+        ev.dropped = client->events_dropped;
+        if (kfifo_put(&client->events, ev))
+            client->events_dropped = 0;
+        else
+            client->events_dropped++;
+        wake_up_interruptible(&client->wait);
+        kill_fasync(&client->fasync, SIGIO, POLL_IN);
+    }
+}
+
+static void crypto_button_press(u64 ts) {
+    void __iomem *base = READ_ONCE(crypto_dev.inter_base);
+    unsigned long flags;
+
+    // Contact bounce: one press per button_debounce_ms
+    if (button_last && ts - button_last < (u64)READ_ONCE(button_debounce_ms) * NSEC_PER_MSEC)
+        return;
+    button_last = ts;
+
+    spin_lock_irqsave(&event_lock, flags);
+    crypto_event_post_locked(CRYPTO_EVENT_BUTTON, base ? inter_switches(base) : 0, ts);
+    spin_unlock_irqrestore(&event_lock, flags);
+}
+
+// Interrupt handler
+static irqreturn_t btn_handler(int irq, void *dev_id) {
+    crypto_button_press(ktime_get_ns());
+    return IRQ_HANDLED;
+}
+
+static void switch_poll_fn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(switch_poll_work, switch_poll_fn);
+
+// Runs while the subscriber list is not empty
+static void switch_poll_fn(struct work_struct *work) {
+    void __iomem *base = READ_ONCE(crypto_dev.inter_base);
+    int value = base ? inter_switches(base) : -1;
+    u64 ts = ktime_get_ns();
+    bool more;
+
+    spin_lock_irq(&event_lock);
+    if (value >= 0 && value != switch_last) {
+        switch_last = value;
+        crypto_event_post_locked(CRYPTO_EVENT_SWITCH, value, ts);
+    }
+    more = !list_empty(&event_clients);
+    spin_unlock_irq(&event_lock);
+
+    if (more)
+        schedule_delayed_work(&switch_poll_work,
+                              msecs_to_jiffies(max(READ_ONCE(switch_poll_ms), 1U)));
+}
+
+static long crypto_event_setup_ioctl(struct file *filp) {
+    struct crypto_client *client = filp->private_data;
+    void __iomem *base = READ_ONCE(crypto_dev.inter_base);
+    struct crypto_event ev = { .type = CRYPTO_EVENT_SWITCH };
+    bool first;
+
+    if (!base)
+        return -ENODEV;
+    if (READ_ONCE(client->async) || READ_ONCE(client->stream))
+        return -EBUSY;
+
+    spin_lock_irq(&event_lock);
+    if (client->events_on) {
+        spin_unlock_irq(&event_lock);
+        return 0;
+    }
+    // The current switches come first, so a reader starts from a known state
+    ev.timestamp_ns = ktime_get_ns();
+    ev.value = inter_switches(base);
+    kfifo_put(&client->events, ev);
+    first = list_empty(&event_clients);
+    if (first)
+        switch_last = ev.value;
+    list_add_tail(&client->event_node, &event_clients);
+    WRITE_ONCE(client->events_on, true);
+    spin_unlock_irq(&event_lock);
+
+    if (first)
+        mod_delayed_work(system_wq, &switch_poll_work,
+                         msecs_to_jiffies(max(READ_ONCE(switch_poll_ms), 1U)));
+    return 0;
+}
+
+// Event mode: as many whole records as fit in buf
+static ssize_t crypto_event_read(struct file *filp, char __user *buf, size_t size) {
+    struct crypto_client *client = filp->private_data;
+    struct crypto_event ev[8];
+    unsigned int n;
+
+    if (size < sizeof(ev[0]))
+        return -EINVAL;
+
+    for (;;) {
+        spin_lock_irq(&event_lock);
+        n = kfifo_out(&client->events, ev, min(ARRAY_SIZE(ev), size / sizeof(ev[0])));
+        spin_unlock_irq(&event_lock);
+        if (n)
+            break;
+        if (filp->f_flags & O_NONBLOCK)
+            return -EAGAIN;
+        if (wait_event_interruptible(client->wait, crypto_events_pending(client)))
+            return -ERESTARTSYS;
+    }
+
+    if (copy_to_user(buf, ev, n * sizeof(ev[0])))
+        return -EFAULT;
+    return n * sizeof(ev[0]);
+}
+
+static int crypto_fasync(int fd, struct file *filp, int on) {
+    struct crypto_client *client = filp->private_data;
+
+    return fasync_helper(fd, filp, on, &client->fasync);
+}
+
+static void crypto_event_release(struct crypto_client *client) {
+    if (!client->events_on)
+        return;
+    spin_lock_irq(&event_lock);
+    list_del(&client->event_node);
+    spin_unlock_irq(&event_lock);
+}
+
+// debugfs crypto_ips/button: a press without touching the board; with
+// mock=1 also crypto_ips/switches, the model's switch register
+static ssize_t button_write(struct file *file, const char __user *buf, size_t len, loff_t *ppos) {
+    crypto_button_press(ktime_get_ns());
+    return len;
+}
+
+static ssize_t switches_write(struct file *file, const char __user *buf, size_t len,
+                              loff_t *ppos) {
+    unsigned int value;
+    int ret;
+
+    ret = kstrtouint_from_user(buf, len, 0, &value);
+    if (ret)
+        return ret;
+    writel((value & 0xff) << INTER_SWITCH_SHIFT, crypto_dev.inter_base + INTER_SWITCH_REG);
+    return len;
+}
+
+static const struct file_operations button_fops = {
+    .owner = THIS_MODULE,
+    .write = button_write,
+};
+
+static const struct file_operations switches_fops = {
+    .owner = THIS_MODULE,
+    .write = switches_write,
+};
+
+static void crypto_events_debugfs_init(void) {
+    debugfs_create_file("button", 0200, crypto_dev.debugfs, NULL, &button_fops);
+    if (mock)
+        debugfs_create_file("switches", 0200, crypto_dev.debugfs, NULL, &switches_fops);
+}
+
+// Streaming sessions
+//
+// CRYPTO_STREAM_SETUP turns an fd into a cipher pipe. write() copies into a
+// ring of page buffers and hands each one to a worker on async_wq, which
+// runs it through an instance in place while the writer fills the next one
+// and the reader drains the one before. One worker per fd keeps the CTR
+// counter and the output in order. Every write() hands over what it
+// copied, so its output can be read back without writing more.
+#define CRYPTO_STREAM_BUFS      4
+#define CRYPTO_STREAM_BUF_SIZE  IP_STREAM_SIZE  // one transfer on the stream path
+
+enum crypto_stream_state {
+    STREAM_FREE,        // the writer's to fill
+    STREAM_QUEUED,      // waiting for or on the engine
+    STREAM_DONE,        // output, the reader's to drain
+};
+
+struct crypto_stream_buf {
+    struct crypto_stream *st;
+    uint8_t *data;
+    size_t len;
+    size_t pos;         // bytes already read
+    enum crypto_stream_state state;
+};
+
+struct crypto_stream {
+    struct crypto_client *client;
+    enum ip_engine_id id;
+    unsigned int bs;
+    struct crypto_key key;
+    bool decrypt;
+    bool ctr;
+    // Worker only: the counter and the last keystream block
+    uint8_t ctr_blk[AES_BLOCK_SIZE];
+    uint8_t ks[AES_BLOCK_SIZE];
+    unsigned int ks_used;
+    // Writer only: ECB bytes short of a whole block
+    uint8_t tail[AES_BLOCK_SIZE];
+    unsigned int tail_len;
+    // Ring positions and buffer states, under client->lock
+    unsigned int fill, run, drain;
+    bool running;       // work queued or running
+    int err;            // engine error, the stream is dead until set up again
+    struct work_struct work;
+    struct crypto_stream_buf bufs[CRYPTO_STREAM_BUFS];
+};
+
+// Queue callback: one buffer in place, with the engine lock held
+static int crypto_stream_run(struct ip_engine *eng, void *data) {
+    struct crypto_stream_buf *b = data;
+    struct crypto_stream *st = b->st;
+    unsigned int bs = st->bs;
+    uint8_t *p = b->data;
+    size_t len = b->len, n;
+    int ret = 0;
+
+    if (eng->id == ENGINE_DES)
+        des_hw_setkey(eng, st->key.des);
+    else
+        aes_hw_setkey(eng, st->key.aes);
+
+    if (!st->ctr) {
+        if (ip_engine_can_stream(eng, len))
+            return crypto_ips_stream(eng, CIPHER_ECB, st->decrypt, NULL, p, p, len);
+        for (; !ret && len; len -= bs, p += bs)
+            ret = crypto_ips_block(eng, p, p, st->decrypt);
+        return ret;
+    }
+
+    // CTR: the rest of the last keystream block, whole blocks, then a
+    // partial one whose unused keystream is kept for the next buffer
+    for (; len && st->ks_used < bs; len--)
+        *p++ ^= st->ks[st->ks_used++];
+    n = len - len % bs;
+    if (n && ip_engine_can_stream(eng, n)) {
+        ret = crypto_ips_stream(eng, CIPHER_CTR, false, st->ctr_blk, p, p, n);
+        p += n;
+        len -= n;
+    }
+    while (!ret && len) {
+        ret = crypto_ips_block(eng, st->ks, st->ctr_blk, false);
+        if (ret)
+            break;
+        crypto_inc(st->ctr_blk, bs);
+        n = min_t(size_t, len, bs);
+        crypto_xor(p, st->ks, n);
+        st->ks_used = n;
+        p += n;
+        len -= n;
+    }
+    return ret;
+}
+
+static void crypto_stream_work(struct work_struct *work) {
+    struct crypto_stream *st = container_of(work, struct crypto_stream, work);
+    struct crypto_client *client = st->client;
+    struct crypto_stream_buf *b;
+    int ret;
+
+    for (;;) {
+        spin_lock(&client->lock);
+        b = &st->bufs[st->run % CRYPTO_STREAM_BUFS];
+        if (b->state != STREAM_QUEUED || st->err) {
+            st->running = false;
+            spin_unlock(&client->lock);
+            wake_up(&client->wait);
+            return;
+        }
+        spin_unlock(&client->lock);
+
+        ret = ip_type_submit(st->id, READ_ONCE(client->prio), crypto_stream_run, b);
+
+        spin_lock(&client->lock);
+        if (ret) {
+            st->err = ret;
+        } else {
+            b->pos = 0;
+            b->state = STREAM_DONE;
+            st->run++;
+        }
+        spin_unlock(&client->lock);
+        wake_up(&client->wait);
+    }
+}
+
+static bool crypto_stream_idle(struct crypto_stream *st) {
+    bool idle;
+
+    spin_lock(&st->client->lock);
+    idle = !st->running;
+    spin_unlock(&st->client->lock);
+    return idle;
+}
+
+static bool crypto_stream_readable(struct crypto_stream *st) {
+    bool ready;
+
+    spin_lock(&st->client->lock);
+    ready = st->bufs[st->drain % CRYPTO_STREAM_BUFS].state == STREAM_DONE ||
+            st->drain == st->fill || st->err;
+    spin_unlock(&st->client->lock);
+    return ready;
+}
+
+static bool crypto_stream_writable(struct crypto_stream *st) {
+    bool ready;
+
+    spin_lock(&st->client->lock);
+    ready = st->bufs[st->fill % CRYPTO_STREAM_BUFS].state == STREAM_FREE || st->err;
+    spin_unlock(&st->client->lock);
+    return ready;
+}
+
+static void crypto_stream_free(struct crypto_stream *st) {
+    int i;
+
+    if (!st)
+        return;
+    for (i = 0; i < CRYPTO_STREAM_BUFS; i++)
+        free_pages((unsigned long)st->bufs[i].data, get_order(CRYPTO_STREAM_BUF_SIZE));
+    kfree(st);
+}
+
+static struct crypto_stream *crypto_stream_alloc(struct crypto_client *client) {
+    struct crypto_stream *st;
+    int i;
+
+    st = kzalloc(sizeof(*st), GFP_KERNEL);
+    if (!st)
+        return NULL;
+    st->client = client;
+    INIT_WORK(&st->work, crypto_stream_work);
+    for (i = 0; i < CRYPTO_STREAM_BUFS; i++) {
+        st->bufs[i].st = st;
+        st->bufs[i].data = (uint8_t *)__get_free_pages(GFP_KERNEL,
+                                                       get_order(CRYPTO_STREAM_BUF_SIZE));
+        if (!st->bufs[i].data) {
+            crypto_stream_free(st);
+            return NULL;
+        }
+    }
+    return st;
+}
+
+static int crypto_stream_check(const struct crypto_stream_setup *setup) {
+    if (setup->key.engine > CRYPTO_KEY_AES || setup->key.reserved || setup->reserved ||
+        (setup->flags & ~(CRYPTO_STREAM_DECRYPT | CRYPTO_STREAM_ECB)))
+        return -EINVAL;
+    // CTR is its own inverse
+    if ((setup->flags & CRYPTO_STREAM_DECRYPT) && !(setup->flags & CRYPTO_STREAM_ECB))
+        return -EINVAL;
+    return 0;
+}
+
+// Cipher state and an empty ring; the worker must be idle
+static void crypto_stream_init(struct crypto_stream *st, const struct crypto_stream_setup *setup) {
+    int i;
+
+    st->id = setup->key.engine == CRYPTO_KEY_AES ? ENGINE_AES : ENGINE_DES;
+    st->bs = st->id == ENGINE_AES ? AES_BLOCK_SIZE : DES_BLOCK_SIZE;
+    st->key = setup->key;
+    st->decrypt = setup->flags & CRYPTO_STREAM_DECRYPT;
+    st->ctr = !(setup->flags & CRYPTO_STREAM_ECB);
+    memcpy(st->ctr_blk, setup->iv, st->bs);
+    st->ks_used = st->bs;
+    st->tail_len = 0;
+
+    spin_lock(&st->client->lock);
+    st->fill = st->run = st->drain = 0;
+    st->err = 0;
+    for (i = 0; i < CRYPTO_STREAM_BUFS; i++)
+        st->bufs[i].state = STREAM_FREE;
+    spin_unlock(&st->client->lock);
+}
+
+// Hand a filled buffer to the worker
+static void crypto_stream_queue(struct crypto_stream *st, struct crypto_stream_buf *b) {
+    spin_lock(&st->client->lock);
+    b->state = STREAM_QUEUED;
+    st->fill++;
+    if (!st->running) {
+        st->running = true;
+        queue_work(crypto_dev.async_wq, &st->work);
+    }
+    spin_unlock(&st->client->lock);
+}
+
+// A drained buffer goes back to the writer
+static void crypto_stream_release_buf(struct crypto_stream *st, struct crypto_stream_buf *b) {
+    spin_lock(&st->client->lock);
+    b->state = STREAM_FREE;
+    st->drain++;
+    spin_unlock(&st->client->lock);
+    wake_up(&st->client->wait);
+}
+
+static long crypto_stream_setup_ioctl(struct file *filp, unsigned long arg) {
+    struct crypto_client *client = filp->private_data;
+    struct crypto_stream_setup setup;
+    struct crypto_stream *st, *new = NULL;
+    long ret;
+
+    if (copy_from_user(&setup, (void __user *)arg, sizeof(setup)))
+        return -EFAULT;
+    ret = crypto_stream_check(&setup);
+    if (ret)
+        return ret;
+    if (READ_ONCE(client->async) || READ_ONCE(client->events_on))
+        return -EBUSY;
+
+    // With both I/O locks held only the worker can touch the ring
+    if (mutex_lock_interruptible(&client->write_lock))
+        return -ERESTARTSYS;
+    if (mutex_lock_interruptible(&client->read_lock)) {
+        mutex_unlock(&client->write_lock);
+        return -ERESTARTSYS;
+    }
+    st = client->stream;
+    if (!st) {
+        st = new = crypto_stream_alloc(client);
+        if (!st) {
+            ret = -ENOMEM;
+            goto out;
+        }
+    }
+    wait_event(client->wait, crypto_stream_idle(st));
+    crypto_stream_init(st, &setup);
+
+    spin_lock(&client->lock);
+    if (client->async) {
+        ret = -EBUSY;
+    } else {
+        WRITE_ONCE(client->stream, st);
+        new = NULL;
+    }
+    spin_unlock(&client->lock);
+    wake_up(&client->wait);
+
+out:
+    mutex_unlock(&client->read_lock);
+    mutex_unlock(&client->write_lock);
+    crypto_stream_free(new);
+    return ret;
+}
+
+// Stream mode: copy into free buffers and queue each one; blocks only while
+// none is free. ECB keeps bytes short of a block back for the next write.
+static ssize_t crypto_stream_write(struct file *filp, struct iov_iter *from, bool nonblock) {
+    struct crypto_client *client = filp->private_data;
+    struct crypto_stream *st = client->stream;
+    struct crypto_stream_buf *b;
+    size_t total = iov_iter_count(from), copied = 0, n, keep;
+    ssize_t ret = 0;
+
+    if (mutex_lock_interruptible(&client->write_lock))
+        return -ERESTARTSYS;
+
+    while (copied < total) {
+        b = &st->bufs[st->fill % CRYPTO_STREAM_BUFS];
+        if (!crypto_stream_writable(st)) {
+            // Short write rather than wait with data taken, so a single
+            // thread can alternate write() and read()
+            if (copied)
+                break;
+            if (nonblock) {
+                ret = -EAGAIN;
+                break;
+            }
+            if (wait_event_interruptible(client->wait, crypto_stream_writable(st))) {
+                ret = -ERESTARTSYS;
+                break;
+            }
+            continue;
+        }
+        spin_lock(&client->lock);
+        ret = st->err;
+        spin_unlock(&client->lock);
+        if (ret)
+            break;
+        // Charged for what fits in the buffer; short write, as above,
+        // rather than wait for the bucket with data taken
+        n = min(total - copied, CRYPTO_STREAM_BUF_SIZE - st->tail_len);
+        ret = crypto_client_throttle(client, DIV_ROUND_UP(n, st->bs), nonblock || copied);
+        if (ret)
+            break;
+
+        // A free buffer is the writer's until it is queued
+        memcpy(b->data, st->tail, st->tail_len);
+        b->len = st->tail_len;
+        n = copy_from_iter(b->data + b->len,
+                           min(total - copied, CRYPTO_STREAM_BUF_SIZE - b->len), from);
+        b->len += n;
+        copied += n;
+
+        keep = st->ctr ? 0 : b->len % st->bs;
+        b->len -= keep;
+        memcpy(st->tail, b->data + b->len, keep);
+        st->tail_len = keep;
+        if (b->len)
+            crypto_stream_queue(st, b);
+        if (!n) {
+            ret = -EFAULT;
+            break;
+        }
+    }
+
+    mutex_unlock(&client->write_lock);
+    return copied ? copied : ret;
+}
+
+// Stream mode: drain finished buffers in order. Blocks while written data
+// is still on its way, 0 once everything written has been read.
+static ssize_t crypto_stream_read(struct file *filp, struct iov_iter *to, bool nonblock) {
+    struct crypto_client *client = filp->private_data;
+    struct crypto_stream *st = client->stream;
+    struct crypto_stream_buf *b;
+    size_t copied = 0, n;
+    ssize_t ret = 0;
+    bool done, pending;
+
+    if (mutex_lock_interruptible(&client->read_lock))
+        return -ERESTARTSYS;
+
+    while (iov_iter_count(to)) {
+        b = &st->bufs[st->drain % CRYPTO_STREAM_BUFS];
+        spin_lock(&client->lock);
+        done = b->state == STREAM_DONE;
+        pending = st->drain != st->fill;
+        ret = st->err;
+        spin_unlock(&client->lock);
+
+        if (!done) {
+            if (copied || !pending || ret)
+                break;
+            if (nonblock) {
+                ret = -EAGAIN;
+                break;
+            }
+            if (wait_event_interruptible(client->wait, crypto_stream_readable(st))) {
+                ret = -ERESTARTSYS;
+                break;
+            }
+            continue;
+        }
+
+        n = copy_to_iter(b->data + b->pos, b->len - b->pos, to);
+        if (!n) {
+            ret = -EFAULT;
+            break;
+        }
+        b->pos += n;
+        copied += n;
+        if (b->pos == b->len)
+            crypto_stream_release_buf(st, b);
+    }
+
+    mutex_unlock(&client->read_lock);
+    return copied ? copied : ret;
+}
+
+// CRYPTO_FILE_XFORM: the stream ring with kernel_read() filling free buffers
+// and kernel_write() draining finished ones. The file reads run while the
+// core works on the buffers before them.
+static long crypto_file_xform_ioctl(struct file *filp, unsigned long arg) {
+    struct crypto_client *client = filp->private_data;
+    struct crypto_file_xform __user *uxf = (void __user *)arg;
+    struct crypto_file_xform xf;
+    struct crypto_stream_buf *b;
+    struct crypto_stream *st;
+    struct file *in, *out = NULL;
+    loff_t in_pos, out_pos;
+    uint64_t left;
+    size_t want;
+    ssize_t n;
+    long ret, tail = 0;
+
+    if (copy_from_user(&xf, uxf, sizeof(xf)))
+        return -EFAULT;
+    ret = crypto_stream_check(&xf.cipher);
+    if (ret)
+        return ret;
+    in = fget(xf.in_fd);
+    if (!in)
+        return -EBADF;
+    out = fget(xf.out_fd);
+    if (!out) {
+        ret = -EBADF;
+        goto out_files;
+    }
+    if (!(in->f_mode & FMODE_READ) || !(out->f_mode & FMODE_WRITE)) {
+        ret = -EBADF;
+        goto out_files;
+    }
+    st = crypto_stream_alloc(client);
+    if (!st) {
+        ret = -ENOMEM;
+        goto out_files;
+    }
+    crypto_stream_init(st, &xf.cipher);
+    // ECB runs whole blocks only
+    if (!st->ctr && xf.length % st->bs) {
+        crypto_stream_free(st);
+        ret = -EINVAL;
+        goto out_files;
+    }
+
+    in_pos = xf.in_offset;
+    out_pos = xf.out_offset;
+    left = xf.length;
+    xf.done = 0;
+    while (left || st->drain != st->fill) {
+        if (fatal_signal_pending(current)) {
+            ret = -EINTR;
+            break;
+        }
+
+        // Read ahead into every free buffer, then write out the oldest
+        b = &st->bufs[st->fill % CRYPTO_STREAM_BUFS];
+        if (left && crypto_stream_writable(st) && !st->err) {
+            want = min_t(uint64_t, left, CRYPTO_STREAM_BUF_SIZE);
+            ret = crypto_client_throttle(client, DIV_ROUND_UP(want, st->bs), false);
+            if (ret)
+                break;
+            for (b->len = 0; b->len < want; b->len += n) {
+                n = kernel_read(in, b->data + b->len, want - b->len, &in_pos);
+                if (n <= 0)
+                    break;
+            }
+            if (n < 0) {
+                ret = n;
+                break;
+            }
+            if (b->len < want)
+                left = 0;       // end of the input
+            else
+                left -= b->len;
+            // Input ended inside an ECB block: write the whole ones, then fail
+            if (!st->ctr && b->len % st->bs) {
+                b->len -= b->len % st->bs;
+                tail = -EINVAL;
+            }
+            if (b->len)
+                crypto_stream_queue(st, b);
+            continue;
+        }
+
+        if (wait_event_killable(client->wait, crypto_stream_readable(st))) {
+            ret = -EINTR;
+            break;
+        }
+        ret = st->err;
+        if (ret)
+            break;
+        b = &st->bufs[st->drain % CRYPTO_STREAM_BUFS];
+        if (b->state != STREAM_DONE)
+            continue;
+        for (b->pos = 0; b->pos < b->len; b->pos += n) {
+            n = kernel_write(out, b->data + b->pos, b->len - b->pos, &out_pos);
+            if (n <= 0)
+                break;
+            xf.done += n;
+        }
+        if (b->pos < b->len) {
+            ret = n < 0 ? n : -EIO;
+            break;
+        }
+        crypto_stream_release_buf(st, b);
+    }
+
+    // The worker may still hold a buffer after an error or a signal
+    wait_event(client->wait, crypto_stream_idle(st));
+    crypto_stream_free(st);
+    if (!ret)
+        ret = tail;
+    if (put_user(xf.done, &uxf->done))
+        ret = -EFAULT;
+
+out_files:
+    if (out)
+        fput(out);
+    fput(in);
+    return ret;
+}
+
+// readv()/writev() and io_uring reads and writes; stream fds only
+static ssize_t crypto_read_iter(struct kiocb *iocb, struct iov_iter *to) {
+    struct file *filp = iocb->ki_filp;
+    struct crypto_client *client = filp->private_data;
+
+    if (!READ_ONCE(client->stream))
+        return -EINVAL;
+    return crypto_stream_read(filp, to, (filp->f_flags & O_NONBLOCK) ||
+                                        (iocb->ki_flags & IOCB_NOWAIT));
+}
+
+static ssize_t crypto_write_iter(struct kiocb *iocb, struct iov_iter *from) {
+    struct file *filp = iocb->ki_filp;
+    struct crypto_client *client = filp->private_data;
+
+    if (!READ_ONCE(client->stream))
+        return -EINVAL;
+    return crypto_stream_write(filp, from, (filp->f_flags & O_NONBLOCK) ||
+                                           (iocb->ki_flags & IOCB_NOWAIT));
+}
+
+// Device file operations
+static int crypto_open(struct inode *node, struct file *filp) {
+    struct crypto_client *client;
+
+    client = kzalloc(sizeof(*client), GFP_KERNEL);
+    if (!client)
+        return -ENOMEM;
+    spin_lock_init(&client->lock);
+    mutex_init(&client->read_lock);
+    mutex_init(&client->write_lock);
+    init_waitqueue_head(&client->wait);
+    client->prio = CRYPTO_PRIO_NORMAL;
+    INIT_KFIFO(client->done);
+    INIT_KFIFO(client->events);
+    filp->private_data = client;
+    return nonseekable_open(node, filp);
+}
+
+// Async mode: hand out as many whole completion records as fit in buf
+static ssize_t crypto_async_read(struct file *filp, char __user *buf, size_t size) {
+    struct crypto_client *client = filp->private_data;
+    unsigned int copied;
+    int ret;
+
+    if (size < sizeof(struct crypto_completion))
+        return -EINVAL;
+
+    for (;;) {
+        if (mutex_lock_interruptible(&client->read_lock))
+            return -ERESTARTSYS;
+        ret = kfifo_to_user(&client->done, buf, size, &copied);
+        mutex_unlock(&client->read_lock);
+        if (ret)
+            return ret;
+        if (copied)
+            break;
+        if (filp->f_flags & O_NONBLOCK)
+            return -EAGAIN;
+        if (wait_event_interruptible(client->wait, !kfifo_is_empty(&client->done)))
+            return -ERESTARTSYS;
+    }
+
+    // Reading frees submit slots
+    wake_up(&client->wait);
+    return copied;
+}
+
+static ssize_t crypto_read(struct file *filp, char *buf, size_t size, loff_t *offset) {
+    struct crypto_client *client = filp->private_data;
+    int value;
+
+    if (READ_ONCE(client->async))
+        return crypto_async_read(filp, (char __user *)buf, size);
+    if (READ_ONCE(client->events_on))
+        return crypto_event_read(filp, (char __user *)buf, size);
+    if (READ_ONCE(client->stream)) {
+        struct iovec iov = { .iov_base = (void __user *)buf, .iov_len = size };
+        struct iov_iter iter;
+
+        iov_iter_init(&iter, READ, &iov, 1, size);
+        return crypto_stream_read(filp, &iter, filp->f_flags & O_NONBLOCK);
+    }
+    if (!crypto_dev.inter_base)
+        return -ENODEV;
+
+    // Read switch value (similar to myhwip), at most one int of it
+    value = inter_switches(crypto_dev.inter_base);
+    size = min(size, sizeof(value));
+    if (copy_to_user(buf, &value, size))
+        return -EFAULT;
+    return size;
+}
+
+static ssize_t crypto_write(struct file *filp, const char __user *buf, size_t size, loff_t *offset) {
+    struct crypto_client *client = filp->private_data;
+    int value = 0;
+
+    if (READ_ONCE(client->stream)) {
+        struct iovec iov = { .iov_base = (void __user *)buf, .iov_len = size };
+        struct iov_iter iter;
+
+        iov_iter_init(&iter, WRITE, &iov, 1, size);
+        return crypto_stream_write(filp, &iter, filp->f_flags & O_NONBLOCK);
+    }
+    if (!crypto_dev.inter_base)
+        return -ENODEV;
+    // Write LED value (similar to myhwip): the first int, the rest is consumed
+    if (copy_from_user(&value, buf, min(size, sizeof(value))))
+        return -EFAULT;
+    writel(value & 0xff, crypto_dev.inter_base + INTER_LED_REG);
+    return size;
+}
+
+// Queue callbacks for the single-op ioctls
+static int des_encrypt_run(struct ip_engine *eng, void *op) {
+    return des_crypt_op(eng, op, false);
+}
+
+static int des_decrypt_run(struct ip_engine *eng, void *op) {
+    return des_crypt_op(eng, op, true);
+}
+
+static int gcd_calc_run(struct ip_engine *eng, void *op) {
+    return gcd_calc_op(eng, op);
+}
+
+static int aes_encrypt_run(struct ip_engine *eng, void *op) {
+    return aes_encrypt_op(eng, op);
+}
+
+// Software ops for when every core of the type is wedged. GCD takes the
+// 8-bit operands the core does; a zero operand is exactly what wedges the
+// core's subtraction loop.
+static int gcd_calc_sw(void *data) {
+    struct gcd_operation *op = data;
+
+    op->result = gcd(op->x & GCD_RESULT_MASK, op->y & GCD_RESULT_MASK);
+    return 0;
+}
+
+#if IS_ENABLED(CONFIG_CRYPTO_LIB_DES) && IS_ENABLED(CONFIG_CRYPTO_LIB_AES)
+static int des_encrypt_sw(void *data) {
+    struct des_operation *op = data;
+
+    des_sw_crypt(op->key, op->input, &op->output, false);
+    return 0;
+}
+
+static int des_decrypt_sw(void *data) {
+    struct des_operation *op = data;
+
+    des_sw_crypt(op->key, op->input, &op->output, true);
+    return 0;
+}
+
+static int aes_encrypt_sw(void *data) {
+    struct aes_operation *op = data;
+
+    aes_sw_crypt(op->key, op->input, op->output, true);
+    return 0;
+}
+#else
+#define des_encrypt_sw NULL
+#define des_decrypt_sw NULL
+#define aes_encrypt_sw NULL
+#endif
+
+static long crypto_set_key_ioctl(struct file *filp, unsigned long arg) {
+    struct crypto_client *client = filp->private_data;
+    struct crypto_key key;
+
+    if (copy_from_user(&key, (void __user *)arg, sizeof(key)))
+        return -EFAULT;
+    if (key.engine > CRYPTO_KEY_AES || key.reserved)
+        return -EINVAL;
+
+    spin_lock(&client->lock);
+    client->keys[key.engine] = key;
+    client->key_set[key.engine] = true;
+    spin_unlock(&client->lock);
+    return 0;
+}
+
+// Copy the fd's session key for engine (CRYPTO_KEY_*)
+static int crypto_client_key(struct crypto_client *client, uint32_t engine, struct crypto_key *key) {
+    int ret = 0;
+
+    spin_lock(&client->lock);
+    if (client->key_set[engine])
+        *key = client->keys[engine];
+    else
+        ret = -ENOKEY;
+    spin_unlock(&client->lock);
+    return ret;
+}
+
+// Data-only single ops under the session key
+static long crypto_block_ioctl(struct file *filp, unsigned int cmd, unsigned long arg) {
+    struct crypto_client *client = filp->private_data;
+    unsigned int prio = READ_ONCE(client->prio);
+    struct crypto_key key;
+    long ret;
+
+    ret = crypto_client_throttle(client, 1, false);
+    if (ret)
+        return ret;
+
+    if (cmd == CRYPTO_AES_ENCRYPT_BLOCK) {
+        struct aes_block blk;
+        struct aes_operation op;
+
+        ret = crypto_client_key(client, CRYPTO_KEY_AES, &key);
+        if (ret)
+            return ret;
+        if (copy_from_user(&blk, (void __user *)arg, sizeof(blk)))
+            return -EFAULT;
+        memcpy(op.key, key.aes, sizeof(op.key));
+        memcpy(op.input, blk.input, sizeof(op.input));
+        ret = ip_op_submit(ENGINE_AES, prio, aes_encrypt_run, aes_encrypt_sw, &op);
+        if (ret)
+            return ret;
+        memcpy(blk.output, op.output, sizeof(blk.output));
+        return copy_to_user((void __user *)arg, &blk, sizeof(blk)) ? -EFAULT : 0;
+    } else {
+        struct des_block blk;
+        struct des_operation op;
+
+        ret = crypto_client_key(client, CRYPTO_KEY_DES, &key);
+        if (ret)
+            return ret;
+        if (copy_from_user(&blk, (void __user *)arg, sizeof(blk)))
+            return -EFAULT;
+        op.key = key.des;
+        op.input = blk.input;
+        ret = ip_op_submit(ENGINE_DES, prio,
+                           cmd == CRYPTO_DES_DECRYPT_BLOCK ? des_decrypt_run : des_encrypt_run,
+                           cmd == CRYPTO_DES_DECRYPT_BLOCK ? des_decrypt_sw : des_encrypt_sw, &op);
+        if (ret)
+            return ret;
+        blk.output = op.output;
+        return copy_to_user((void __user *)arg, &blk, sizeof(blk)) ? -EFAULT : 0;
+    }
+}
+
+struct ip_batch {
+    unsigned int cmd;
+    unsigned int prio;      // CRYPTO_PRIO_*
+    uint32_t count;
+    uint32_t done;
+    bool decrypt;
+    bool session;           // ops are des_block/aes_block using key
+    struct crypto_key key;
+    void *ops;
+    int32_t *status;
+};
+
+// A contiguous slice of a batch, run by one instance. Every stripe writes
+// results and status in place, so the batch stays in submission order
+// whichever instance finishes first, and a stripe that timed out can run
+// again from its start elsewhere. A stripe that gave way to a higher class
+// (-EAGAIN from its run) is queued again for the rest.
+struct ip_stripe {
+    struct work_struct work;
+    struct ip_batch *b;
+    struct ip_engine *eng;
+    uint32_t first;
+    uint32_t count;
+    uint32_t done;
+    int ret;
+};
+
+#define IP_BATCH_STRIPES_MAX 8
+
+static unsigned int batch_stripe_min = 16;
+module_param(batch_stripe_min, uint, 0644);
+MODULE_PARM_DESC(batch_stripe_min, "Smallest batch slice worth handing to another instance of the core");
+
+// Session batches carry only data; run each block under the session key
+static int ip_batch_run_block(struct ip_engine *eng, struct ip_batch *b, uint32_t i) {
+    int ret;
+
+    if (b->cmd == CRYPTO_DES_BATCH) {
+        struct des_block *blk = (struct des_block *)b->ops + i;
+        struct des_operation op = { .input = blk->input, .key = b->key.des };
+
+        ret = des_crypt_op(eng, &op, b->decrypt);
+        blk->output = op.output;
+    } else {
+        struct aes_block *blk = (struct aes_block *)b->ops + i;
+        struct aes_operation op;
+
+        memcpy(op.key, b->key.aes, sizeof(op.key));
+        memcpy(op.input, blk->input, sizeof(op.input));
+        ret = aes_encrypt_op(eng, &op);
+        memcpy(blk->output, op.output, sizeof(blk->output));
+    }
+    return ret;
+}
+
+// Session stripes over the stream path: the inputs are gathered into the
+// stream buffer in register word order, IP_STREAM_SIZE per DMA round trip,
+// and the results scattered back. A failed chunk fails all of its ops.
+static int ip_batch_run_stream(struct ip_engine *eng, struct ip_stripe *s) {
+    struct ip_batch *b = s->b;
+    unsigned int bs = eng->block_bytes;
+    uint32_t i, j, k, n, end = s->first + s->count;
+    int ret = 0;
+
+    if (b->cmd == CRYPTO_DES_BATCH)
+        des_hw_setkey(eng, b->key.des);
+    else
+        aes_hw_setkey(eng, b->key.aes);
+
+    for (i = s->first; i < end && !ret; i += n) {
+        if (i > s->first && ip_engine_preempted(eng, b->prio)) {
+            ret = -EAGAIN;
+            break;
+        }
+        n = min_t(uint32_t, end - i, IP_STREAM_SIZE / bs);
+        for (j = 0; j < n; j++) {
+            uint8_t *p = eng->stream_in + j * bs;
+
+            if (b->cmd == CRYPTO_DES_BATCH) {
+                put_unaligned_be64(((struct des_block *)b->ops)[i + j].input, p);
+                continue;
+            }
+            for (k = 0; k < 4; k++)
+                put_unaligned_be32(((struct aes_block *)b->ops)[i + j].input[k], p + k * 4);
+        }
+
+        ret = ip_engine_stream(eng, n * bs, ip_engine_stream_dir(eng, b->decrypt));
+
+        for (j = 0; j < n; j++) {
+            const uint8_t *p = eng->stream_out + j * bs;
+
+            b->status[i + j] = ret;
+            if (ret)
+                continue;
+            if (b->cmd == CRYPTO_DES_BATCH) {
+                ((struct des_block *)b->ops)[i + j].output = get_unaligned_be64(p);
+                continue;
+            }
+            for (k = 0; k < 4; k++)
+                ((struct aes_block *)b->ops)[i + j].output[k] = get_unaligned_be32(p + k * 4);
+        }
+        cond_resched();
+    }
+    s->done = i - s->first;
+    return ret;
+}
+
+// One queue request runs the whole stripe, so the key stays in the core
+static int ip_batch_run(struct ip_engine *eng, void *data) {
+    struct ip_stripe *s = data;
+    struct ip_batch *b = s->b;
+    uint32_t i, end = s->first + s->count;
+    int ret = 0;
+
+    if (b->session && ip_engine_can_stream(eng, (size_t)s->count * eng->block_bytes))
+        return ip_batch_run_stream(eng, s);
+
+    for (i = s->first; i < end && !ret; i++) {
+        // At least one block per run, so a preempted stripe moves on
+        if (i > s->first && ip_engine_preempted(eng, b->prio)) {
+            ret = -EAGAIN;
+            break;
+        }
+        if (b->session)
+            ret = ip_batch_run_block(eng, b, i);
+        else if (b->cmd == CRYPTO_DES_BATCH)
+            ret = des_crypt_op(eng, (struct des_operation *)b->ops + i, b->decrypt);
+        else if (b->cmd == CRYPTO_AES_BATCH)
+            ret = aes_encrypt_op(eng, (struct aes_operation *)b->ops + i);
+        else
+            ret = gcd_calc_op(eng, (struct gcd_operation *)b->ops + i);
+        b->status[i] = ret;
+        cond_resched();
+    }
+    s->done = i - s->first;
+    return ret;
+}
+
+// The rest of a preempted stripe goes to whichever instance is least
+// loaded by then; the one it left has the higher class queued
+static void ip_stripe_submit(struct ip_stripe *s) {
+    enum ip_engine_id id = s->eng->id;
+    uint32_t first = s->first, count = s->count, done = 0;
+
+    for (;;) {
+        s->ret = ip_engine_submit_retry(s->eng, s->b->prio, ip_batch_run, s);
+        done += s->done;
+        if (s->ret != -EAGAIN)
+            break;
+        atomic_inc(&s->eng->n_preempted);
+        s->first += s->done;
+        s->count -= s->done;
+        s->eng = ip_engine_get(id);
+        if (!s->eng) {
+            s->ret = -ETIMEDOUT;
+            break;
+        }
+    }
+    s->first = first;
+    s->count = count;
+    s->done = done;
+}
+
+static void ip_stripe_work(struct work_struct *work) {
+    ip_stripe_submit(container_of(work, struct ip_stripe, work));
+}
+
+// Split a batch over the instances of its type, batch_stripe_min ops or
+// more per stripe. The first stripe runs in the caller, the others on the
+// async workqueue. done and the return value cover the longest prefix of
+// the batch that succeeded, plus the op that failed, as with one instance.
+static int ip_batch_submit(enum ip_engine_id id, struct ip_batch *b) {
+    struct ip_stripe one = { .b = b, .count = b->count }, *s = &one;
+    unsigned int n, i, per;
+    int ret = 0;
+
+    n = min3(READ_ONCE(crypto_dev.n_engines[id]), (unsigned int)IP_BATCH_STRIPES_MAX,
+             b->count / max(READ_ONCE(batch_stripe_min), 1U));
+    if (n > 1)
+        s = kcalloc(n, sizeof(*s), GFP_KERNEL);
+    if (n <= 1 || !s) {
+        // Too small to split, or no memory for the stripes
+        n = 1;
+        s = &one;
+    }
+
+    per = DIV_ROUND_UP(b->count, n);
+    for (i = 0; i < n; i++) {
+        s[i].b = b;
+        s[i].first = i * per;
+        s[i].count = min(per, b->count - s[i].first);
+        // Each pick raises the instance's load, so the stripes spread out
+        s[i].eng = ip_engine_get(id);
+        if (!s[i].eng) {
+            while (i--)
+                ip_engine_put(s[i].eng);
+            ret = -ENODEV;
+            goto out;
+        }
+    }
+
+    for (i = 1; i < n; i++) {
+        INIT_WORK(&s[i].work, ip_stripe_work);
+        queue_work(crypto_dev.async_wq, &s[i].work);
+    }
+    ip_stripe_submit(&s[0]);
+    for (i = 1; i < n; i++)
+        flush_work(&s[i].work);
+
+    for (i = 0; i < n && !ret; i++) {
+        b->done += s[i].done;
+        ret = s[i].ret;
+    }
+
+out:
+    if (s != &one)
+        kfree(s);
+    return ret;
+}
+
+// Batched ops: the array is copied in once, the engine runs back-to-back
+// and results plus per-op status are copied out once
+static long crypto_batch_ioctl(struct file *filp, unsigned int cmd, unsigned long arg) {
+    struct crypto_client *client = filp->private_data;
+    struct crypto_batch batch;
+    struct ip_batch b = { .cmd = cmd };
+    enum ip_engine_id id;
+    size_t op_size;
+    long ret = 0;
+
+    if (copy_from_user(&batch, (void __user *)arg, sizeof(batch)))
+        return -EFAULT;
+    if (batch.count == 0 || batch.count > CRYPTO_BATCH_MAX)
+        return -EINVAL;
+    b.count = batch.count;
+    b.decrypt = batch.flags & CRYPTO_BATCH_DECRYPT;
+    b.session = batch.flags & CRYPTO_BATCH_SESSION;
+    if ((batch.flags & ~(CRYPTO_BATCH_DECRYPT | CRYPTO_BATCH_SESSION | CRYPTO_BATCH_PRIO_MASK)) ||
+        (b.decrypt && cmd != CRYPTO_DES_BATCH) || (b.session && cmd == CRYPTO_GCD_BATCH))
+        return -EINVAL;
+    if (batch.flags & CRYPTO_BATCH_PRIO_MASK)
+        b.prio = ((batch.flags & CRYPTO_BATCH_PRIO_MASK) >> 8) - 1;
+    else
+        b.prio = READ_ONCE(client->prio);
+    if (b.session) {
+        ret = crypto_client_key(client, cmd == CRYPTO_DES_BATCH ? CRYPTO_KEY_DES : CRYPTO_KEY_AES,
+                                &b.key);
+        if (ret)
+            return ret;
+    }
+
+    switch (cmd) {
+        case CRYPTO_DES_BATCH:
+            id = ENGINE_DES;
+            op_size = b.session ? sizeof(struct des_block) : sizeof(struct des_operation);
+            break;
+        case CRYPTO_AES_BATCH:
+            id = ENGINE_AES;
+            op_size = b.session ? sizeof(struct aes_block) : sizeof(struct aes_operation);
+            break;
+        default:
+            id = ENGINE_GCD;
+            op_size = sizeof(struct gcd_operation);
+            break;
+    }
+
+    b.ops = kvmalloc_array(batch.count, op_size, GFP_KERNEL);
+    b.status = kvmalloc_array(batch.count, sizeof(*b.status), GFP_KERNEL);
+    if (!b.ops || !b.status) {
+        ret = -ENOMEM;
+        goto out;
+    }
+    if (copy_from_user(b.ops, u64_to_user_ptr(batch.ops), batch.count * op_size)) {
+        ret = -EFAULT;
+        goto out;
+    }
+    trace_crypto_ips_copy_in(cmd, batch.count * op_size);
+
+    ret = crypto_client_throttle(client, batch.count, false);
+    if (ret)
+        goto out;
+    ret = ip_batch_submit(id, &b);
+    batch.done = b.done;
+
+    // Results of the ops that ran are returned even if a later one failed
+    if (copy_to_user(u64_to_user_ptr(batch.ops), b.ops, batch.done * op_size) ||
+        (batch.status && copy_to_user(u64_to_user_ptr(batch.status), b.status,
+                                      batch.done * sizeof(*b.status))) ||
+        copy_to_user((void __user *)arg, &batch, sizeof(batch)))
+        ret = -EFAULT;
+    trace_crypto_ips_copy_out(cmd, batch.done * op_size);
+out:
+    kvfree(b.status);
+    kvfree(b.ops);
+    return ret;
+}
+
+struct crypto_async_req {
+    struct work_struct work;
+    struct crypto_client *client;
+    unsigned int prio;
+    struct crypto_completion c;
+};
+
+// Run one CRYPTO_OP_* through its engine's queue
+static int crypto_op_run(uint32_t op, unsigned int prio, void *data) {
+    switch (op) {
+        case CRYPTO_OP_DES_ENCRYPT:
+            return ip_op_submit(ENGINE_DES, prio, des_encrypt_run, des_encrypt_sw, data);
+        case CRYPTO_OP_DES_DECRYPT:
+            return ip_op_submit(ENGINE_DES, prio, des_decrypt_run, des_decrypt_sw, data);
+        case CRYPTO_OP_GCD_CALC:
+            return ip_op_submit(ENGINE_GCD, prio, gcd_calc_run, gcd_calc_sw, data);
+        default:
+            return ip_op_submit(ENGINE_AES, prio, aes_encrypt_run, aes_encrypt_sw, data);
+    }
+}
+
+// Runs on async_wq; several workers on one engine coalesce in its queue
+static void crypto_async_work(struct work_struct *work) {
+    struct crypto_async_req *areq = container_of(work, struct crypto_async_req, work);
+    struct crypto_client *client = areq->client;
+    struct crypto_completion *c = &areq->c;
+
+    c->status = crypto_op_run(c->op, areq->prio, &c->aes);
+
+    // The slot was reserved at submit time, so the put cannot fail. Wake
+    // under the lock: once release sees inflight drop to zero it frees client.
+    spin_lock(&client->lock);
+    kfifo_put(&client->done, *c);
+    client->inflight--;
+    if (client->eventfd)
+        eventfd_signal(client->eventfd, 1);
+    wake_up(&client->wait);
+    spin_unlock(&client->lock);
+    kfree(areq);
+}
+
+static long crypto_async_setup_ioctl(struct file *filp, unsigned long arg) {
+    struct crypto_client *client = filp->private_data;
+    struct crypto_async_setup setup;
+    struct eventfd_ctx *ctx = NULL, *old;
+
+    if (copy_from_user(&setup, (void __user *)arg, sizeof(setup)))
+        return -EFAULT;
+    if (setup.flags)
+        return -EINVAL;
+    if (READ_ONCE(client->events_on) || READ_ONCE(client->stream))
+        return -EBUSY;
+    if (setup.eventfd >= 0) {
+        ctx = eventfd_ctx_fdget(setup.eventfd);
+        if (IS_ERR(ctx))
+            return PTR_ERR(ctx);
+    }
+
+    spin_lock(&client->lock);
+    old = client->eventfd;
+    client->eventfd = ctx;
+    client->async = true;
+    spin_unlock(&client->lock);
+
+    if (old)
+        eventfd_ctx_put(old);
+    return 0;
+}
+
+// Queue one op and return its tag; the result arrives through read()
+static long crypto_submit_ioctl(struct file *filp, unsigned long arg) {
+    struct crypto_client *client = filp->private_data;
+    struct crypto_submit __user *usub = (void __user *)arg;
+    struct crypto_submit sub;
+    struct crypto_async_req *areq;
+    int ret;
+
+    if (!READ_ONCE(client->async))
+        return -EINVAL;
+    if (copy_from_user(&sub, usub, sizeof(sub)))
+        return -EFAULT;
+    if (sub.op > CRYPTO_OP_AES_ENCRYPT)
+        return -EINVAL;
+    ret = crypto_client_throttle(client, 1, filp->f_flags & O_NONBLOCK);
+    if (ret)
+        return ret;
+
+    areq = kmalloc(sizeof(*areq), GFP_KERNEL);
+    if (!areq)
+        return -ENOMEM;
+
+    // Every op in flight owns a completion slot, unread ones included
+    spin_lock(&client->lock);
+    if (client->inflight + kfifo_len(&client->done) >= CRYPTO_ASYNC_DEPTH) {
+        spin_unlock(&client->lock);
+        kfree(areq);
+        return -EAGAIN;
+    }
+    client->inflight++;
+    sub.tag = client->next_tag++;
+    spin_unlock(&client->lock);
+
+    if (put_user(sub.tag, &usub->tag)) {
+        spin_lock(&client->lock);
+        client->inflight--;
+        wake_up(&client->wait);
+        spin_unlock(&client->lock);
+        kfree(areq);
+        return -EFAULT;
+    }
+
+    INIT_WORK(&areq->work, crypto_async_work);
+    areq->client = client;
+    areq->prio = READ_ONCE(client->prio);
+    areq->c = (struct crypto_completion) {
+        .tag = sub.tag,
+        .op = sub.op,
+        .user_data = sub.user_data,
+    };
+    // aes_operation is the largest member, so this copies the whole union
+    memcpy(&areq->c.aes, &sub.aes, sizeof(sub.aes));
+    queue_work(crypto_dev.async_wq, &areq->work);
+    return 0;
+}
+
+// Programs (CRYPTO_RUN_PROGRAM)
+//
+// Each step is a work item on async_wq that runs its op through
+// crypto_op_run(), so steps on different engines overlap and steps on one
+// engine coalesce in its queue like async ops. A finished step copies its
+// linked words into the steps waiting for it and queues the ones that have
+// nothing left to wait for.
+struct crypto_prog_run;
+
+struct crypto_prog_job {
+    struct work_struct work;
+    struct crypto_prog_run *run;
+    unsigned int index;
+    unsigned int waiting;       // links to steps not done yet, under run->lock
+    bool cancelled;             // a linked step failed
+    struct crypto_prog_step step;
+};
+
+struct crypto_prog_run {
+    spinlock_t lock;
+    unsigned int prio;
+    unsigned int count;
+    unsigned int left;          // steps not finished, under lock
+    struct completion done;
+    struct crypto_prog_job jobs[];
+};
+
+static unsigned int crypto_prog_words(uint32_t op) {
+    switch (op) {
+        case CRYPTO_OP_DES_ENCRYPT:
+        case CRYPTO_OP_DES_DECRYPT:
+            return sizeof(struct des_operation) / 4;
+        case CRYPTO_OP_GCD_CALC:
+            return sizeof(struct gcd_operation) / 4;
+        default:
+            return sizeof(struct aes_operation) / 4;
+    }
+}
+
+// The op struct as words; every member of the union starts there
+static uint32_t *crypto_prog_op(struct crypto_prog_step *step) {
+    return (uint32_t *)&step->aes;
+}
+
+static void crypto_prog_work(struct work_struct *work) {
+    struct crypto_prog_job *job = container_of(work, struct crypto_prog_job, work);
+    struct crypto_prog_run *run = job->run;
+    struct crypto_prog_job *next;
+    struct crypto_prog_link *l;
+    unsigned int j, k;
+    bool last;
+
+    if (job->cancelled)
+        job->step.status = -ECANCELED;
+    else
+        job->step.status = crypto_op_run(job->step.op, run->prio, crypto_prog_op(&job->step));
+
+    // Only later steps link from this one
+    spin_lock(&run->lock);
+    for (j = job->index + 1; j < run->count; j++) {
+        next = &run->jobs[j];
+        for (k = 0; k < CRYPTO_PROGRAM_LINKS; k++) {
+            l = &next->step.links[k];
+            if (l->step != job->index)
+                continue;
+            if (job->step.status)
+                next->cancelled = true;
+            else
+                memcpy(crypto_prog_op(&next->step) + l->to,
+                       crypto_prog_op(&job->step) + l->from, l->count * 4);
+            if (--next->waiting == 0)
+                queue_work(crypto_dev.async_wq, &next->work);
+        }
+    }
+    last = --run->left == 0;
+    spin_unlock(&run->lock);
+    if (last)
+        complete(&run->done);
+}
+
+// Links only point back, so the steps form a DAG in submission order
+static int crypto_prog_check(const struct crypto_prog_step *steps, unsigned int count) {
+    const struct crypto_prog_link *l;
+    unsigned int i, k;
+
+    for (i = 0; i < count; i++) {
+        if (steps[i].op > CRYPTO_OP_AES_ENCRYPT)
+            return -EINVAL;
+        for (k = 0; k < CRYPTO_PROGRAM_LINKS; k++) {
+            l = &steps[i].links[k];
+            if (l->step == CRYPTO_PROGRAM_NONE)
+                continue;
+            if (l->step >= i || !l->count ||
+                l->from + l->count > crypto_prog_words(steps[l->step].op) ||
+                l->to + l->count > crypto_prog_words(steps[i].op))
+                return -EINVAL;
+        }
+    }
+    return 0;
+}
+
+static long crypto_program_ioctl(struct file *filp, unsigned long arg) {
+    struct crypto_client *client = filp->private_data;
+    struct crypto_program prog;
+    struct crypto_prog_step *steps;
+    struct crypto_prog_run *run;
+    struct crypto_prog_job *job;
+    uint32_t ready = 0;
+    size_t size;
+    unsigned int i, k;
+    long ret;
+
+    if (copy_from_user(&prog, (void __user *)arg, sizeof(prog)))
+        return -EFAULT;
+    if (!prog.count || prog.count > CRYPTO_PROGRAM_STEPS || prog.flags || prog.reserved)
+        return -EINVAL;
+
+    size = prog.count * sizeof(*steps);
+    steps = memdup_user(u64_to_user_ptr(prog.steps), size);
+    if (IS_ERR(steps))
+        return PTR_ERR(steps);
+    trace_crypto_ips_copy_in(CRYPTO_RUN_PROGRAM, size);
+    ret = crypto_prog_check(steps, prog.count);
+    if (ret)
+        goto out;
+    ret = crypto_client_throttle(client, prog.count, false);
+    if (ret)
+        goto out;
+
+    run = kzalloc(struct_size(run, jobs, prog.count), GFP_KERNEL);
+    if (!run) {
+        ret = -ENOMEM;
+        goto out;
+    }
+    spin_lock_init(&run->lock);
+    init_completion(&run->done);
+    run->prio = READ_ONCE(client->prio);
+    run->count = run->left = prog.count;
+    for (i = 0; i < prog.count; i++) {
+        job = &run->jobs[i];
+        INIT_WORK(&job->work, crypto_prog_work);
+        job->run = run;
+        job->index = i;
+        job->step = steps[i];
+        for (k = 0; k < CRYPTO_PROGRAM_LINKS; k++)
+            if (steps[i].links[k].step != CRYPTO_PROGRAM_NONE)
+                job->waiting++;
+        if (!job->waiting)
+            ready |= BIT(i);
+    }
+
+    // From the first queue_work() on, the workers own the jobs
+    for (i = 0; i < prog.count; i++)
+        if (ready & BIT(i))
+            queue_work(crypto_dev.async_wq, &run->jobs[i].work);
+    // The workers point into run, so no early return
+    wait_for_completion(&run->done);
+
+    prog.done = 0;
+    for (i = 0; i < prog.count; i++) {
+        steps[i] = run->jobs[i].step;
+        if (!steps[i].status)
+            prog.done++;
+    }
+    kfree(run);
+
+    if (copy_to_user(u64_to_user_ptr(prog.steps), steps, size) ||
+        copy_to_user((void __user *)arg, &prog, sizeof(prog)))
+        ret = -EFAULT;
+    trace_crypto_ips_copy_out(CRYPTO_RUN_PROGRAM, size);
+out:
+    kfree(steps);
+    return ret;
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 19, 0) && LINUX_VERSION_CODE < KERNEL_VERSION(6, 15, 0)
+// io_uring passthrough (IORING_OP_URING_CMD). Single ops are copied in at
+// issue time, run on async_wq like CRYPTO_SUBMIT, and copied back from task
+// work in the submitter's context, so the ring never blocks on the engine.
+// Batches are punted to io-wq and take the ioctl path. Written against the
+// uring_cmd interface of 5.19 to 6.14: 6.3 added issue_flags to the
+// completion calls and 6.5 moved the command into the SQE; later kernels
+// changed the task work callback again and build without it.
+struct crypto_uring_req {
+    struct work_struct work;
+    struct io_uring_cmd *ioucmd;
+    void __user *uptr;
+    size_t size;
+    uint32_t op;
+    unsigned int prio;
+    int ret;
+    union {
+        struct des_operation des;
+        struct gcd_operation gcd;
+        struct aes_operation aes;
+    };
+};
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+static void crypto_uring_complete(struct io_uring_cmd *ioucmd, unsigned int issue_flags) {
+#else
+static void crypto_uring_complete(struct io_uring_cmd *ioucmd) {
+#endif
+    struct crypto_uring_req *req = *(struct crypto_uring_req **)ioucmd->pdu;
+    int ret = req->ret;
+
+    if (!ret && copy_to_user(req->uptr, &req->aes, req->size))
+        ret = -EFAULT;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+    io_uring_cmd_done(ioucmd, ret, 0, issue_flags);
+#else
+    io_uring_cmd_done(ioucmd, ret, 0);
+#endif
+    kfree(req);
+}
+
+static void crypto_uring_work(struct work_struct *work) {
+    struct crypto_uring_req *req = container_of(work, struct crypto_uring_req, work);
+
+    req->ret = crypto_op_run(req->op, req->prio, &req->aes);
+    io_uring_cmd_complete_in_task(req->ioucmd, crypto_uring_complete);
+}
+
+static int crypto_uring_cmd(struct io_uring_cmd *ioucmd, unsigned int issue_flags) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+    const struct crypto_uring_cmd *ucmd = io_uring_sqe_cmd(ioucmd->sqe);
+#else
+    const struct crypto_uring_cmd *ucmd = ioucmd->cmd;
+#endif
+    struct crypto_client *client = ioucmd->file->private_data;
+    struct crypto_uring_req *req;
+    uint32_t op;
+    size_t size;
+    int ret;
+
+    switch (ioucmd->cmd_op) {
+        case CRYPTO_DES_ENCRYPT:
+            op = CRYPTO_OP_DES_ENCRYPT;
+            size = sizeof(struct des_operation);
+            break;
+        case CRYPTO_DES_DECRYPT:
+            op = CRYPTO_OP_DES_DECRYPT;
+            size = sizeof(struct des_operation);
+            break;
+        case CRYPTO_GCD_CALC:
+            op = CRYPTO_OP_GCD_CALC;
+            size = sizeof(struct gcd_operation);
+            break;
+        case CRYPTO_AES_ENCRYPT:
+            op = CRYPTO_OP_AES_ENCRYPT;
+            size = sizeof(struct aes_operation);
+            break;
+        case CRYPTO_DES_BATCH:
+        case CRYPTO_AES_BATCH:
+        case CRYPTO_GCD_BATCH:
+            if (issue_flags & IO_URING_F_NONBLOCK)
+                return -EAGAIN;
+            return crypto_batch_ioctl(ioucmd->file, ioucmd->cmd_op, READ_ONCE(ucmd->addr));
+        default:
+            return -ENOTTY;
+    }
+
+    // Overdrawn: io_uring issues again from a worker that may wait
+    ret = crypto_client_throttle(client, 1, issue_flags & IO_URING_F_NONBLOCK);
+    if (ret)
+        return ret;
+
+    req = kmalloc(sizeof(*req), GFP_KERNEL);
+    if (!req)
+        return -ENOMEM;
+    req->uptr = u64_to_user_ptr(READ_ONCE(ucmd->addr));
+    req->size = size;
+    req->op = op;
+    req->prio = READ_ONCE(client->prio);
+    if (copy_from_user(&req->aes, req->uptr, size)) {
+        kfree(req);
+        return -EFAULT;
+    }
+
+    INIT_WORK(&req->work, crypto_uring_work);
+    req->ioucmd = ioucmd;
+    *(struct crypto_uring_req **)ioucmd->pdu = req;
+    queue_work(crypto_dev.async_wq, &req->work);
+    return -EIOCBQUEUED;
+}
+#endif
+
+static long crypto_ioctl(struct file *filp, unsigned int cmd, unsigned long arg) {
+    struct crypto_client *client = filp->private_data;
+    unsigned int prio = READ_ONCE(client->prio);
+    int ret = 0;
+    struct des_operation des_op;
+    struct gcd_operation gcd_op;
+    struct aes_operation aes_op;
+    int value;
+
+    // The single ops below pay for their block first
+    if (cmd == CRYPTO_DES_ENCRYPT || cmd == CRYPTO_DES_DECRYPT || cmd == CRYPTO_GCD_CALC ||
+        cmd == CRYPTO_AES_ENCRYPT) {
+        ret = crypto_client_throttle(client, 1, false);
+        if (ret)
+            return ret;
+    }
+
+    switch (cmd) {
+        case CRYPTO_READ_SWITCH:
+            if (!crypto_dev.inter_base)
+                return -ENODEV;
+            value = inter_switches(crypto_dev.inter_base);
+            ret = copy_to_user((int *)arg, &value, sizeof(int));
+            break;
+
+        case CRYPTO_WRITE_LED:
+            if (!crypto_dev.inter_base)
+                return -ENODEV;
+            ret = copy_from_user(&value, (int *)arg, sizeof(int));
+            if (!ret) {
+                writel(value & 0xff, crypto_dev.inter_base + INTER_LED_REG);
+            }
+            break;
+
+        case CRYPTO_DES_ENCRYPT:
+            ret = copy_from_user(&des_op, (struct des_operation *)arg, sizeof(des_op));
+            if (!ret) {
+                trace_crypto_ips_copy_in(cmd, sizeof(des_op));
+                ret = ip_op_submit(ENGINE_DES, prio, des_encrypt_run, des_encrypt_sw, &des_op);
+                if (!ret) {
+                    ret = copy_to_user((struct des_operation *)arg, &des_op, sizeof(des_op));
+                    trace_crypto_ips_copy_out(cmd, sizeof(des_op));
+                }
+            }
+            break;
+
+        case CRYPTO_DES_DECRYPT:
+            ret = copy_from_user(&des_op, (struct des_operation *)arg, sizeof(des_op));
+            if (!ret) {
+                trace_crypto_ips_copy_in(cmd, sizeof(des_op));
+                ret = ip_op_submit(ENGINE_DES, prio, des_decrypt_run, des_decrypt_sw, &des_op);
+                if (!ret) {
+                    ret = copy_to_user((struct des_operation *)arg, &des_op, sizeof(des_op));
+                    trace_crypto_ips_copy_out(cmd, sizeof(des_op));
+                }
+            }
+            break;
+
+        case CRYPTO_GCD_CALC:
+            ret = copy_from_user(&gcd_op, (struct gcd_operation *)arg, sizeof(gcd_op));
+            if (!ret) {
+                trace_crypto_ips_copy_in(cmd, sizeof(gcd_op));
+                ret = ip_op_submit(ENGINE_GCD, prio, gcd_calc_run, gcd_calc_sw, &gcd_op);
+                if (!ret) {
+                    ret = copy_to_user((struct gcd_operation *)arg, &gcd_op, sizeof(gcd_op));
+                    trace_crypto_ips_copy_out(cmd, sizeof(gcd_op));
+                }
+            }
+            break;
+
+        case CRYPTO_AES_ENCRYPT:
+            ret = copy_from_user(&aes_op, (struct aes_operation *)arg, sizeof(aes_op));
+            if (!ret) {
+                trace_crypto_ips_copy_in(cmd, sizeof(aes_op));
+                ret = ip_op_submit(ENGINE_AES, prio, aes_encrypt_run, aes_encrypt_sw, &aes_op);
+                if (!ret) {
+                    ret = copy_to_user((struct aes_operation *)arg, &aes_op, sizeof(aes_op));
+                    trace_crypto_ips_copy_out(cmd, sizeof(aes_op));
+                }
+            }
+            break;
+
+        case CRYPTO_DES_BATCH:
+        case CRYPTO_AES_BATCH:
+        case CRYPTO_GCD_BATCH:
+            ret = crypto_batch_ioctl(filp, cmd, arg);
+            break;
+
+        case CRYPTO_SET_KEY:
+            ret = crypto_set_key_ioctl(filp, arg);
+            break;
+
+        case CRYPTO_DES_ENCRYPT_BLOCK:
+        case CRYPTO_DES_DECRYPT_BLOCK:
+        case CRYPTO_AES_ENCRYPT_BLOCK:
+            ret = crypto_block_ioctl(filp, cmd, arg);
+            break;
+
+        case CRYPTO_ASYNC_SETUP:
+            ret = crypto_async_setup_ioctl(filp, arg);
+            break;
+
+        case CRYPTO_SUBMIT:
+            ret = crypto_submit_ioctl(filp, arg);
+            break;
+
+        case CRYPTO_EVENT_SETUP:
+            ret = crypto_event_setup_ioctl(filp);
+            break;
+
+        case CRYPTO_STREAM_SETUP:
+            ret = crypto_stream_setup_ioctl(filp, arg);
+            break;
+
+        case CRYPTO_FILE_XFORM:
+            ret = crypto_file_xform_ioctl(filp, arg);
+            break;
+
+        case CRYPTO_RUN_PROGRAM:
+            ret = crypto_program_ioctl(filp, arg);
+            break;
+
+        case CRYPTO_SET_QOS:
+            ret = crypto_qos_ioctl(filp, arg);
+            break;
+
+        default:
+            ret = -ENOTTY;
+            break;
+    }
+
+    return ret;
+}
+
+// Async mode: readable with completions queued, writable with a free slot.
+// Event mode: readable with events queued. Stream mode: readable with output
+// (or an error) waiting, writable with a free buffer. Plain fds keep the
+// default mask.
+static __poll_t crypto_poll(struct file *filp, poll_table *wait) {
+    struct crypto_client *client = filp->private_data;
+    struct crypto_stream *st = READ_ONCE(client->stream);
+    __poll_t mask = 0;
+
+    if (st) {
+        poll_wait(filp, &client->wait, wait);
+        spin_lock(&client->lock);
+        if (st->bufs[st->drain % CRYPTO_STREAM_BUFS].state == STREAM_DONE || st->err)
+            mask |= EPOLLIN | EPOLLRDNORM;
+        if (st->bufs[st->fill % CRYPTO_STREAM_BUFS].state == STREAM_FREE || st->err)
+            mask |= EPOLLOUT | EPOLLWRNORM;
+        spin_unlock(&client->lock);
+        return mask;
+    }
+
+    if (READ_ONCE(client->events_on)) {
+        poll_wait(filp, &client->wait, wait);
+        return crypto_events_pending(client) ? EPOLLIN | EPOLLRDNORM : 0;
+    }
+
+    if (!READ_ONCE(client->async))
+        return EPOLLIN | EPOLLRDNORM | EPOLLOUT | EPOLLWRNORM;
+
+    poll_wait(filp, &client->wait, wait);
+
+    spin_lock(&client->lock);
+    if (!kfifo_is_empty(&client->done))
+        mask |= EPOLLIN | EPOLLRDNORM;
+    if (client->inflight + kfifo_len(&client->done) < CRYPTO_ASYNC_DEPTH)
+        mask |= EPOLLOUT | EPOLLWRNORM;
+    spin_unlock(&client->lock);
+    return mask;
+}
+
+static bool crypto_client_idle(struct crypto_client *client) {
+    bool idle;
+
+    spin_lock(&client->lock);
+    idle = client->inflight == 0 && !(client->stream && client->stream->running);
+    spin_unlock(&client->lock);
+    return idle;
+}
+
+static int crypto_release(struct inode *inode, struct file *flip) {
+    struct crypto_client *client = flip->private_data;
+
+    // Queued work still points at the client; unread completions are dropped
+    wait_event(client->wait, crypto_client_idle(client));
+    crypto_event_release(client);
+    crypto_stream_free(client->stream);
+    if (client->eventfd)
+        eventfd_ctx_put(client->eventfd);
+    kfree(client);
+    return 0;
+}
+
+static struct file_operations crypto_fops = {
+    .owner = THIS_MODULE,
+    .open = crypto_open,
+    .write = crypto_write,
+    .read = crypto_read,
+    .read_iter = crypto_read_iter,
+    .write_iter = crypto_write_iter,
+    .unlocked_ioctl = crypto_ioctl,
+    .poll = crypto_poll,
+    .fasync = crypto_fasync,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 19, 0) && LINUX_VERSION_CODE < KERNEL_VERSION(6, 15, 0)
+    .uring_cmd = crypto_uring_cmd,
+#endif
+    .release = crypto_release,
+};
+
+// debugfs: crypto_ips/<engine><n>/latency and mmio for every instance.
+// Writing anything to either file clears that instance's counters.
+static const char * const ip_phase_names[IP_PHASE_CNT] = {
+    [IP_PHASE_QUEUE] = "queue",
+    [IP_PHASE_PROGRAM] = "program",
+    [IP_PHASE_WAIT] = "wait",
+};
+
+static int ip_latency_show(struct seq_file *m, void *v) {
+    struct ip_engine *eng = m->private;
+    unsigned int hist[IP_HIST_BUCKETS];
+    int p, b, lo, hi, cpu;
+
+    for (p = 0; p < IP_PHASE_CNT; p++) {
+        seq_printf(m, "%s (ns):\n", ip_phase_names[p]);
+
+        memset(hist, 0, sizeof(hist));
+        for_each_possible_cpu(cpu)
+            for (b = 0; b < IP_HIST_BUCKETS; b++)
+                hist[b] += READ_ONCE(per_cpu_ptr(eng->stats, cpu)->hist[p][b]);
+
+        // Only the range that has samples
+        for (lo = 0; lo < IP_HIST_BUCKETS - 1 && !hist[lo]; lo++)
+            ;
+        for (hi = IP_HIST_BUCKETS - 1; hi > lo && !hist[hi]; hi--)
+            ;
+        for (b = lo; b <= hi; b++) {
+            if (b == IP_HIST_BUCKETS - 1)
+                seq_printf(m, "  %10llu -            %u\n", 1ULL << b, hist[b]);
+            else
+                seq_printf(m, "  %10llu - %-10llu %u\n", b ? 1ULL << b : 0,
+                           (1ULL << (b + 1)) - 1, hist[b]);
+        }
+    }
+    return 0;
+}
+
+static int ip_mmio_show(struct seq_file *m, void *v) {
+    struct ip_engine_totals t;
+
+    ip_engine_totals(m->private, &t);
+    seq_printf(m, "reads %lu\nwrites %lu\nstream_bytes %lu\n", t.mmio_read, t.mmio_write,
+               t.stream_bytes);
+    return 0;
+}
+
+static ssize_t ip_stats_write(struct file *file, const char __user *buf, size_t len,
+                              loff_t *ppos) {
+    struct seq_file *m = file->private_data;
+    struct ip_engine *eng = m->private;
+    struct ip_engine_stats *st;
+    int cpu;
+
+    // Racing increments may survive the reset; good enough for profiling
+    for_each_possible_cpu(cpu) {
+        st = per_cpu_ptr(eng->stats, cpu);
+        memset(st->hist, 0, sizeof(st->hist));
+        WRITE_ONCE(st->mmio_read, 0);
+        WRITE_ONCE(st->mmio_write, 0);
+        WRITE_ONCE(st->stream_bytes, 0);
+    }
+    return len;
+}
+
+static int ip_latency_open(struct inode *inode, struct file *file) {
+    return single_open(file, ip_latency_show, inode->i_private);
+}
+
+static int ip_mmio_open(struct inode *inode, struct file *file) {
+    return single_open(file, ip_mmio_show, inode->i_private);
+}
+
+static const struct file_operations ip_latency_fops = {
+    .owner = THIS_MODULE,
+    .open = ip_latency_open,
+    .read = seq_read,
+    .write = ip_stats_write,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+
+static const struct file_operations ip_mmio_fops = {
+    .owner = THIS_MODULE,
+    .open = ip_mmio_open,
+    .read = seq_read,
+    .write = ip_stats_write,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+
+// Not per instance: these ops found no usable core of their type
+static int ip_fallbacks_show(struct seq_file *m, void *v) {
+    seq_printf(m, "aes %d\ndes %d\ngcd %d\n", atomic_read(&ip_fallbacks[ENGINE_AES]),
+               atomic_read(&ip_fallbacks[ENGINE_DES]), atomic_read(&ip_fallbacks[ENGINE_GCD]));
+    return 0;
+}
+
+static int ip_fallbacks_open(struct inode *inode, struct file *file) {
+    return single_open(file, ip_fallbacks_show, NULL);
+}
+
+static const struct file_operations ip_fallbacks_fops = {
+    .owner = THIS_MODULE,
+    .open = ip_fallbacks_open,
+    .read = seq_read,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+
+static void ip_engine_debugfs_init(struct ip_engine *eng) {
+    eng->debugfs = debugfs_create_dir(eng->label, crypto_dev.debugfs);
+    debugfs_create_file("latency", 0600, eng->debugfs, eng, &ip_latency_fops);
+    debugfs_create_file("mmio", 0600, eng->debugfs, eng, &ip_mmio_fops);
+}
+
+// sysfs: stats/ of every instance's platform device, also reachable as
+// /sys/class/crypto_class/crypto_ips/<engine><n>/stats
+#define IP_STATS_ATTR(field) \
+static ssize_t field##_show(struct device *dev, struct device_attribute *attr, char *buf) { \
+    struct ip_engine_totals t; \
+    ip_engine_totals(dev_get_drvdata(dev), &t); \
+    return sysfs_emit(buf, "%llu\n", (u64)t.field); \
+} \
+static DEVICE_ATTR_RO(field)
+
+IP_STATS_ATTR(ops);
+IP_STATS_ATTR(bytes);
+IP_STATS_ATTR(timeouts);
+IP_STATS_ATTR(busy_ns);
+// How ops finished: done interrupt, spin window, after sleeping
+IP_STATS_ATTR(irq);
+IP_STATS_ATTR(spin);
+IP_STATS_ATTR(sleep);
+// Key loads skipped because the core already held the key
+IP_STATS_ATTR(key_reuse);
+
+// Requests dispatched to the instance and not finished yet
+static ssize_t queue_depth_show(struct device *dev, struct device_attribute *attr, char *buf) {
+    struct ip_engine *eng = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%d\n", atomic_read(&eng->load));
+}
+static DEVICE_ATTR_RO(queue_depth);
+
+// Request queue coalescing, see ip_engine_submit()
+static ssize_t requests_show(struct device *dev, struct device_attribute *attr, char *buf) {
+    struct ip_engine *eng = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%d\n", atomic_read(&eng->n_requests));
+}
+static DEVICE_ATTR_RO(requests);
+
+static ssize_t bursts_show(struct device *dev, struct device_attribute *attr, char *buf) {
+    struct ip_engine *eng = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%d\n", atomic_read(&eng->n_bursts));
+}
+static DEVICE_ATTR_RO(bursts);
+
+static ssize_t coalesced_show(struct device *dev, struct device_attribute *attr, char *buf) {
+    struct ip_engine *eng = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%d\n", atomic_read(&eng->n_coalesced));
+}
+static DEVICE_ATTR_RO(coalesced);
+
+// Timeout recovery, see ip_engine_recover()
+static ssize_t wedged_show(struct device *dev, struct device_attribute *attr, char *buf) {
+    struct ip_engine *eng = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%d\n", READ_ONCE(eng->wedged));
+}
+static DEVICE_ATTR_RO(wedged);
+
+static ssize_t resets_show(struct device *dev, struct device_attribute *attr, char *buf) {
+    struct ip_engine *eng = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%d\n", atomic_read(&eng->n_resets));
+}
+static DEVICE_ATTR_RO(resets);
+
+static ssize_t preempted_show(struct device *dev, struct device_attribute *attr, char *buf) {
+    struct ip_engine *eng = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%d\n", atomic_read(&eng->n_preempted));
+}
+static DEVICE_ATTR_RO(preempted);
+
+static ssize_t redispatched_show(struct device *dev, struct device_attribute *attr, char *buf) {
+    struct ip_engine *eng = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%d\n", atomic_read(&eng->n_redispatched));
+}
+static DEVICE_ATTR_RO(redispatched);
+
+static struct attribute *ip_engine_stats_attrs[] = {
+    &dev_attr_ops.attr,
+    &dev_attr_bytes.attr,
+    &dev_attr_timeouts.attr,
+    &dev_attr_busy_ns.attr,
+    &dev_attr_irq.attr,
+    &dev_attr_spin.attr,
+    &dev_attr_sleep.attr,
+    &dev_attr_queue_depth.attr,
+    &dev_attr_requests.attr,
+    &dev_attr_bursts.attr,
+    &dev_attr_coalesced.attr,
+    &dev_attr_key_reuse.attr,
+    &dev_attr_wedged.attr,
+    &dev_attr_resets.attr,
+    &dev_attr_redispatched.attr,
+    &dev_attr_preempted.attr,
+    NULL,
+};
+
+static const struct attribute_group ip_engine_stats_group = {
+    .name = "stats",
+    .attrs = ip_engine_stats_attrs,
+};
+
+static const struct attribute_group *ip_engine_groups[] = {
+    &ip_engine_stats_group,
+    NULL,
+};
+
+// Self-benchmark
+//
+// bench=1 at load, or a write to debugfs crypto_ips/bench, times every
+// instance through its request queue: single-op latency percentiles,
+// throughput of back-to-back batches of several sizes, and the cost of
+// loading a new key for each op. Results are key=value lines, one test per
+// line, logged with a "crypto_ips bench:" prefix and kept for reading from
+// the debugfs file until the next run. Each test runs for bench_ms; other
+// clients keep being served meanwhile and show up in the numbers.
+#define BENCH_OPS        4096   // ops prepared, latency samples and largest batch
+#define BENCH_REKEY_SIZE 256    // batch size of the key-change test
+#define BENCH_BUF_SIZE   SZ_32K
+
+static bool bench;
+module_param(bench, bool, 0444);
+MODULE_PARM_DESC(bench, "Benchmark every core at load, results in the log and debugfs crypto_ips/bench");
+
+static unsigned int bench_ms = 100;
+module_param(bench_ms, uint, 0644);
+MODULE_PARM_DESC(bench_ms, "Self-benchmark: duration of each test per core (ms)");
+
+static const unsigned int bench_batch_sizes[] = { 1, 16, 256, BENCH_OPS };
+
+struct crypto_bench_job {
+    unsigned int first;
+    unsigned int count;
+    union {
+        void *ops;
+        struct des_operation *des;
+        struct aes_operation *aes;
+        struct gcd_operation *gcd;
+    };
+};
+
+// Last results, under bench_lock; a run holds it throughout
+static DEFINE_MUTEX(bench_lock);
+static char *bench_buf;
+static size_t bench_len;
+
+// Queue callback: count ops from first, back-to-back under one lock
+static int crypto_bench_run(struct ip_engine *eng, void *data) {
+    struct crypto_bench_job *job = data;
+    unsigned int i, end = job->first + job->count;
+    int ret = 0;
+
+    for (i = job->first; i < end && !ret; i++) {
+        switch (eng->id) {
+        case ENGINE_DES:
+            ret = des_crypt_op(eng, &job->des[i], false);
+            break;
+        case ENGINE_AES:
+            ret = aes_encrypt_op(eng, &job->aes[i]);
+            break;
+        default:
+            ret = gcd_calc_op(eng, &job->gcd[i]);
+            break;
+        }
+    }
+    return ret;
+}
+
+static int crypto_bench_submit(struct ip_engine *eng, struct crypto_bench_job *job) {
+    int ret;
+
+    atomic_inc(&eng->load);
+    atomic_inc(&eng->n_requests);
+    ret = ip_engine_submit(eng, CRYPTO_PRIO_NORMAL, crypto_bench_run, job);
+    ip_engine_put(eng);
+    return ret;
+}
+
+// Random data under one key, or two keys taking turns with rekey. GCD
+// operands are never 0, which would hang the core.
+static void crypto_bench_fill(struct crypto_bench_job *job, enum ip_engine_id id, bool rekey) {
+    uint32_t keys[2][4];
+    unsigned int i;
+
+    get_random_bytes(keys, sizeof(keys));
+    for (i = 0; i < BENCH_OPS; i++) {
+        const uint32_t *key = keys[rekey && (i & 1)];
+
+        switch (id) {
+        case ENGINE_DES:
+            get_random_bytes(&job->des[i].input, sizeof(job->des[i].input));
+            job->des[i].key = ((uint64_t)key[1] << 32) | key[0];
+            break;
+        case ENGINE_AES:
+            get_random_bytes(job->aes[i].input, sizeof(job->aes[i].input));
+            memcpy(job->aes[i].key, key, sizeof(job->aes[i].key));
+            break;
+        default:
+            job->gcd[i].x = get_random_u32() % GCD_RESULT_MASK + 1;
+            job->gcd[i].y = get_random_u32() % GCD_RESULT_MASK + 1;
+            break;
+        }
+    }
+}
+
+// One line to the log and the results
+static __printf(1, 2) void crypto_bench_emit(const char *fmt, ...) {
+    char *line = bench_buf + bench_len;
+    va_list args;
+
+    va_start(args, fmt);
+    bench_len += vscnprintf(line, BENCH_BUF_SIZE - bench_len, fmt, args);
+    va_end(args);
+    printk(KERN_INFO "crypto_ips bench: %s", line);
+}
+
+static int crypto_bench_cmp_u64(const void *a, const void *b) {
+    u64 x = *(const u64 *)a, y = *(const u64 *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+// Batches of size until bench_ms is up; returns ops run and their time
+static int crypto_bench_batches(struct ip_engine *eng, struct crypto_bench_job *job,
+                                unsigned int size, u64 *ops, u64 *ns) {
+    u64 start = ktime_get_ns(), end = start + (u64)READ_ONCE(bench_ms) * NSEC_PER_MSEC, now;
+    int ret;
+
+    *ops = 0;
+    do {
+        job->first = (u32)*ops % BENCH_OPS;
+        job->count = size;
+        ret = crypto_bench_submit(eng, job);
+        if (ret)
+            return ret;
+        *ops += size;
+        now = ktime_get_ns();
+    } while (now < end);
+    *ns = now - start;
+    return 0;
+}
+
+// One op per request, so queueing and the engine lock are in the figure
+static int crypto_bench_latency(struct ip_engine *eng, struct crypto_bench_job *job, u64 *samples) {
+    u64 start = ktime_get_ns(), end = start + (u64)READ_ONCE(bench_ms) * NSEC_PER_MSEC, t, now;
+    unsigned int n = 0, i;
+    int ret;
+
+    do {
+        job->first = n % BENCH_OPS;
+        job->count = 1;
+        t = ktime_get_ns();
+        ret = crypto_bench_submit(eng, job);
+        if (ret)
+            return ret;
+        now = ktime_get_ns();
+        samples[n % BENCH_OPS] = now - t;
+        n++;
+    } while (now < end);
+
+    i = min(n, (unsigned int)BENCH_OPS);
+    sort(samples, i, sizeof(*samples), crypto_bench_cmp_u64, NULL);
+    crypto_bench_emit("engine=%s test=latency ops=%u samples=%u min_ns=%llu p50_ns=%llu "
+                      "p99_ns=%llu p999_ns=%llu max_ns=%llu\n", eng->label, n, i, samples[0],
+                      samples[i / 2], samples[i * 99 / 100], samples[i * 999 / 1000], samples[i - 1]);
+    return 0;
+}
+
+static int crypto_bench_engine(struct ip_engine *eng, struct crypto_bench_job *job, u64 *samples) {
+    u64 ops, ns, same_ns, new_ns;
+    unsigned int i;
+    int ret;
+
+    crypto_bench_fill(job, eng->id, false);
+    ret = crypto_bench_latency(eng, job, samples);
+    if (ret)
+        return ret;
+
+    for (i = 0; i < ARRAY_SIZE(bench_batch_sizes); i++) {
+        ret = crypto_bench_batches(eng, job, bench_batch_sizes[i], &ops, &ns);
+        if (ret)
+            return ret;
+        crypto_bench_emit("engine=%s test=batch size=%u ops=%llu ns=%llu ns_per_op=%llu "
+                          "ops_per_s=%llu bytes_per_s=%llu\n", eng->label, bench_batch_sizes[i],
+                          ops, ns, div64_u64(ns, ops), div64_u64(ops * NSEC_PER_SEC, ns),
+                          div64_u64(ops * NSEC_PER_SEC, ns) * eng->block_bytes);
+    }
+
+    // The GCD core has no key
+    if (eng->id == ENGINE_GCD)
+        return 0;
+    ret = crypto_bench_batches(eng, job, BENCH_REKEY_SIZE, &ops, &ns);
+    if (ret)
+        return ret;
+    same_ns = div64_u64(ns, ops);
+    crypto_bench_fill(job, eng->id, true);
+    ret = crypto_bench_batches(eng, job, BENCH_REKEY_SIZE, &ops, &ns);
+    if (ret)
+        return ret;
+    new_ns = div64_u64(ns, ops);
+    crypto_bench_emit("engine=%s test=rekey size=%u ops=%llu same_key_ns_per_op=%llu "
+                      "new_key_ns_per_op=%llu overhead_ns=%lld\n", eng->label, BENCH_REKEY_SIZE,
+                      ops, same_ns, new_ns, (s64)(new_ns - same_ns));
+    return 0;
+}
+
+// Bench every instance probed so far, one at a time
+static int crypto_bench_all(void) {
+    struct crypto_bench_job job = { };
+    struct ip_engine *eng, **engines = NULL;
+    unsigned int i, n = 0, max = 0;
+    u64 *samples = NULL;
+    int ret = 0;
+
+    mutex_lock(&bench_lock);
+    if (!bench_buf)
+        bench_buf = kvzalloc(BENCH_BUF_SIZE, GFP_KERNEL);
+    // Room for the largest op struct
+    job.ops = kvmalloc_array(BENCH_OPS, sizeof(struct aes_operation), GFP_KERNEL);
+    samples = kvmalloc_array(BENCH_OPS, sizeof(*samples), GFP_KERNEL);
+    if (!bench_buf || !job.ops || !samples) {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    // Instances stay until unload; only the list walk needs the lock
+    for (i = 0; i < ENGINE_CNT; i++)
+        max += READ_ONCE(crypto_dev.n_engines[i]);
+    engines = kcalloc(max ?: 1, sizeof(*engines), GFP_KERNEL);
+    if (!engines) {
+        ret = -ENOMEM;
+        goto out;
+    }
+    spin_lock(&crypto_dev.engines_lock);
+    for_each_ip_engine(eng, i) {
+        if (n < max)
+            engines[n++] = eng;
+    }
+    spin_unlock(&crypto_dev.engines_lock);
+
+    bench_len = 0;
+    crypto_bench_emit("start kernel=%s mock=%d engines=%u bench_ms=%u poll_mode=%u\n",
+                      init_utsname()->release, mock, n, READ_ONCE(bench_ms), READ_ONCE(poll_mode));
+    for (i = 0; i < n; i++) {
+        ret = crypto_bench_engine(engines[i], &job, samples);
+        if (ret)
+            crypto_bench_emit("engine=%s error=%d\n", engines[i]->label, ret);
+    }
+    crypto_bench_emit("end\n");
+    ret = 0;
+out:
+    mutex_unlock(&bench_lock);
+    kfree(engines);
+    kvfree(samples);
+    kvfree(job.ops);
+    return ret;
+}
+
+static int crypto_bench_show(struct seq_file *m, void *v) {
+    mutex_lock(&bench_lock);
+    if (bench_buf)
+        seq_write(m, bench_buf, bench_len);
+    mutex_unlock(&bench_lock);
+    return 0;
+}
+
+static int crypto_bench_open(struct inode *inode, struct file *file) {
+    return single_open(file, crypto_bench_show, NULL);
+}
+
+// Any write runs the benchmark and returns when it is done
+static ssize_t crypto_bench_write(struct file *file, const char __user *buf, size_t len,
+                                  loff_t *ppos) {
+    int ret = crypto_bench_all();
 
-// IOCTL command definitions
-#define CRYPTO_IOC_MAGIC 'c'
-#define CRYPTO_READ_SWITCH     _IOR(CRYPTO_IOC_MAGIC, 1, int)
-#define CRYPTO_WRITE_LED       _IOW(CRYPTO_IOC_MAGIC, 2, int)
-#define CRYPTO_DES_ENCRYPT     _IOWR(CRYPTO_IOC_MAGIC, 3, struct des_operation)
-#define CRYPTO_DES_DECRYPT     _IOWR(CRYPTO_IOC_MAGIC, 4, struct des_operation)
-#define CRYPTO_GCD_CALC        _IOWR(CRYPTO_IOC_MAGIC, 5, struct gcd_operation)
-#define CRYPTO_AES_ENCRYPT     _IOWR(CRYPTO_IOC_MAGIC, 6, struct aes_operation)
+    return ret ? ret : len;
+}
 
-// Data structures for operations
-struct des_operation {
-    uint64_t input;
-    uint64_t key;
-    uint64_t output;
+static const struct file_operations crypto_bench_fops = {
+    .owner = THIS_MODULE,
+    .open = crypto_bench_open,
+    .read = seq_read,
+    .write = crypto_bench_write,
+    .llseek = seq_lseek,
+    .release = single_release,
 };
 
-struct gcd_operation {
-    int x;
-    int y;
-    int result;
-};
+static void crypto_bench_exit(void) {
+    kvfree(bench_buf);
+    bench_buf = NULL;
+}
 
-struct aes_operation {
-    uint32_t key[4];     // 128-bit key
-    uint32_t input[4];   // 128-bit input
-    uint32_t output[4];  // 128-bit output
+// Platform drivers
+//
+// Every AES/DES/GCD node in the DT, or register model device with mock=1,
+// becomes one instance on crypto_dev.engines[type], and ops are spread over
+// the instances of their type. The inter IP (switches, LEDs, button) is a
+// single node of its own.
+static const struct of_device_id crypto_ips_of_match[] = {
+    { .compatible = "xlnx,aes-ip-1.00", .data = &ip_engine_types[ENGINE_AES] },
+    { .compatible = "xlnx,des-ip-1.00", .data = &ip_engine_types[ENGINE_DES] },
+    { .compatible = "xlnx,gcd-ip-1.00", .data = &ip_engine_types[ENGINE_GCD] },
+    { }
 };
+MODULE_DEVICE_TABLE(of, crypto_ips_of_match);
 
-struct crypto_device {
-    dev_t devid;
-    int major;
-    struct cdev cdev;
-    struct class *class;
-    struct device_node *nd;
-    void __iomem *inter_base;
-    void __iomem *aes_base;
-    void __iomem *des_base;
-    void __iomem *gcd_base;
-    unsigned int irq;
+static const struct of_device_id crypto_ips_inter_of_match[] = {
+    { .compatible = "xlnx,myhwip-1.00" },
+    { }
 };
+MODULE_DEVICE_TABLE(of, crypto_ips_inter_of_match);
 
-static struct crypto_device crypto_dev;
-static volatile int button_pressed = 0;
+static int crypto_ips_engine_probe(struct platform_device *pdev) {
+    struct device *dev = &pdev->dev;
+    const struct ip_engine *type;
+    struct ip_engine *eng;
+    int irq, ret, cpu;
 
-// Interrupt handler
-static irqreturn_t btn_handler(int irq, void *dev_id) {
-    printk(KERN_INFO "Button interrupt triggered!\n");
-    button_pressed = 1;
-    return IRQ_HANDLED;
-}
+    // With mock=1 only the register model devices are used, and vice versa
+    if (mock == !!dev->of_node)
+        return -ENODEV;
 
-// DES encrypt function
-static int des_encrypt_op(struct des_operation *op) {
-    uint32_t pt_high = (uint32_t)(op->input >> 32);
-    uint32_t pt_low = (uint32_t)(op->input & 0xFFFFFFFF);
-    uint32_t key_high = (uint32_t)(op->key >> 32);
-    uint32_t key_low = (uint32_t)(op->key & 0xFFFFFFFF);
-    uint32_t res_high, res_low;
-    uint32_t status;
-    int timeout = 0;
+    if (dev->of_node)
+        type = of_device_get_match_data(dev);
+    else
+        type = (const struct ip_engine *)platform_get_device_id(pdev)->driver_data;
 
-    // Reset DES IP
-    writel(0, crypto_dev.des_base + 0x10); // control reg
-    writel(0, crypto_dev.des_base + 0x1C); // status reg
-    msleep(10);
+    eng = devm_kmemdup(dev, type, sizeof(*eng), GFP_KERNEL);
+    if (!eng)
+        return -ENOMEM;
+    mutex_init(&eng->lock);
+    spin_lock_init(&eng->queue_lock);
+    INIT_LIST_HEAD(&eng->queue);
+    init_completion(&eng->done);
 
-    // Write plaintext and key
-    writel(pt_low, crypto_dev.des_base + 0x00);
-    writel(pt_high, crypto_dev.des_base + 0x04);
-    writel(key_low, crypto_dev.des_base + 0x08);
-    writel(key_high, crypto_dev.des_base + 0x0C);
+    eng->stats = devm_alloc_percpu(dev, struct ip_engine_stats);
+    if (!eng->stats)
+        return -ENOMEM;
+    for_each_possible_cpu(cpu)
+        u64_stats_init(&per_cpu_ptr(eng->stats, cpu)->syncp);
 
-    // Start encryption
-    writel(0x01, crypto_dev.des_base + 0x10);
+    if (mock) {
+        ret = mock_engine_init(dev, eng);
+        if (ret)
+            return ret;
+    } else {
+        eng->base = devm_platform_ioremap_resource(pdev, 0);
+        if (IS_ERR(eng->base))
+            return PTR_ERR(eng->base);
 
-    // Wait for completion
-    do {
-        msleep(1);
-        status = readl(crypto_dev.des_base + 0x1C);
-        timeout++;
-        if (timeout > 100) {
-            printk(KERN_ERR "DES encryption timeout!\n");
-            return -ETIMEDOUT;
+        // Nodes without an interrupt (older bitstreams) keep polling
+        irq = platform_get_irq_optional(pdev, 0);
+        if (irq == -EPROBE_DEFER)
+            return irq;
+        if (irq > 0) {
+            ret = devm_request_threaded_irq(dev, irq, ip_engine_irq, ip_engine_irq_thread,
+                                            IRQF_ONESHOT, dev_name(dev), eng);
+            if (ret < 0) {
+                printk("request_irq %d for %s failed, ret = %d\n", irq, dev_name(dev), ret);
+            } else {
+                eng->irq = irq;
+                eng->use_irq = true;
+            }
         }
-    } while ((status & 0x01) == 0);
 
-    // Read result
-    res_low = readl(crypto_dev.des_base + 0x14);
-    res_high = readl(crypto_dev.des_base + 0x18);
-    op->output = ((uint64_t)res_high << 32) | res_low;
+        ret = ip_engine_dma_init(dev, eng);
+        if (ret)
+            return ret;
+    }
 
-    // Clear start signal
-    writel(0, crypto_dev.des_base + 0x10);
-    
+    platform_set_drvdata(pdev, eng);
+    spin_lock(&crypto_dev.engines_lock);
+    eng->index = crypto_dev.n_engines[eng->id]++;
+    list_add_tail_rcu(&eng->node, &crypto_dev.engines[eng->id]);
+    spin_unlock(&crypto_dev.engines_lock);
+    snprintf(eng->label, sizeof(eng->label), "%s%u", eng->name, eng->index);
+
+    printk(KERN_INFO "%s: %s, %s%s\n", eng->label, dev_name(dev),
+           eng->use_irq ? "done irq" : "polling", eng->stream_in ? ", DMA stream" : "");
+    ip_engine_debugfs_init(eng);
+    if (sysfs_create_link(&crypto_dev.dev->kobj, &dev->kobj, eng->label))
+        printk(KERN_WARNING "%s: no link under %s\n", eng->label, DEVICE_NAME);
+
+    // The first instance of a type brings up its crypto API algorithms
+    if (eng->index == 0)
+        crypto_ips_register_algs(eng->id);
     return 0;
 }
 
-// DES decrypt function
-static int des_decrypt_op(struct des_operation *op) {
-    uint32_t ct_high = (uint32_t)(op->input >> 32);
-    uint32_t ct_low = (uint32_t)(op->input & 0xFFFFFFFF);
-    uint32_t key_high = (uint32_t)(op->key >> 32);
-    uint32_t key_low = (uint32_t)(op->key & 0xFFFFFFFF);
-    uint32_t res_high, res_low;
-    uint32_t status;
-    int timeout = 0;
+// Bind attributes are suppressed, so this only runs at module unload when
+// no fd or crypto API user is left
+static int crypto_ips_engine_remove(struct platform_device *pdev) {
+    struct ip_engine *eng = platform_get_drvdata(pdev);
 
-    // Reset DES IP
-    writel(0, crypto_dev.des_base + 0x10);
-    writel(0, crypto_dev.des_base + 0x1C);
-    msleep(10);
+    spin_lock(&crypto_dev.engines_lock);
+    list_del_rcu(&eng->node);
+    crypto_dev.n_engines[eng->id]--;
+    spin_unlock(&crypto_dev.engines_lock);
+    synchronize_rcu();
+    sysfs_remove_link(&crypto_dev.dev->kobj, eng->label);
+    debugfs_remove_recursive(eng->debugfs);
 
-    // Write ciphertext and key
-    writel(ct_low, crypto_dev.des_base + 0x00);
-    writel(ct_high, crypto_dev.des_base + 0x04);
-    writel(key_low, crypto_dev.des_base + 0x08);
-    writel(key_high, crypto_dev.des_base + 0x0C);
+    if (eng->mock_regs)
+        hrtimer_cancel(&eng->mock_timer);
+    return 0;
+}
 
-    // Start decryption (bit1=1 for decrypt)
-    writel(0x03, crypto_dev.des_base + 0x10);
+static int crypto_ips_inter_probe(struct platform_device *pdev) {
+    struct device *dev = &pdev->dev;
+    void __iomem *base;
+    int irq, ret;
 
-    // Wait for completion
-    do {
-        msleep(1);
-        status = readl(crypto_dev.des_base + 0x1C);
-        timeout++;
-        if (timeout > 100) {
-            printk(KERN_ERR "DES decryption timeout!\n");
-            return -ETIMEDOUT;
-        }
-    } while ((status & 0x01) == 0);
+    // The register model has its own switch/LED registers
+    if (mock)
+        return -ENODEV;
 
-    // Read result
-    res_low = readl(crypto_dev.des_base + 0x14);
-    res_high = readl(crypto_dev.des_base + 0x18);
-    op->output = ((uint64_t)res_high << 32) | res_low;
+    base = devm_platform_ioremap_resource(pdev, 0);
+    if (IS_ERR(base))
+        return PTR_ERR(base);
 
-    // Clear start signal
-    writel(0, crypto_dev.des_base + 0x10);
-    
+    irq = platform_get_irq(pdev, 0);
+    if (irq == -EPROBE_DEFER)
+        return irq;
+
+    // Button events read the switches from the handler
+    crypto_dev.inter_base = base;
+    if (irq > 0) {
+        ret = devm_request_irq(dev, irq, btn_handler, IRQF_TRIGGER_RISING, "crypto_ips", NULL);
+        if (ret < 0)
+            printk("request_irq %d failed, ret = %d\n", irq, ret);
+    }
+
+    printk(KERN_INFO "inter: %s, button irq %d\n", dev_name(dev), irq);
     return 0;
 }
 
-// GCD calculation function
-static int gcd_calc_op(struct gcd_operation *op) {
-    int result;
-    int timeout = 0;
+static int crypto_ips_inter_remove(struct platform_device *pdev) {
+    crypto_dev.inter_base = NULL;
+    return 0;
+}
 
-    // Ensure start signal is 0
-    writel(0, crypto_dev.gcd_base + 0x08);
+static struct platform_driver crypto_ips_engine_driver = {
+    .probe = crypto_ips_engine_probe,
+    .remove = crypto_ips_engine_remove,
+    .id_table = crypto_ips_engine_ids,
+    .driver = {
+        .name = "crypto-ips",
+        .of_match_table = crypto_ips_of_match,
+        .dev_groups = ip_engine_groups,
+        .suppress_bind_attrs = true,
+    },
+};
 
-    // Write X and Y values
-    writel(op->x, crypto_dev.gcd_base + 0x00);
-    writel(op->y, crypto_dev.gcd_base + 0x04);
+static struct platform_driver crypto_ips_inter_driver = {
+    .probe = crypto_ips_inter_probe,
+    .remove = crypto_ips_inter_remove,
+    .driver = {
+        .name = "crypto-ips-inter",
+        .of_match_table = crypto_ips_inter_of_match,
+        .suppress_bind_attrs = true,
+    },
+};
 
-    msleep(1);
+static struct platform_driver * const crypto_ips_drivers[] = {
+    &crypto_ips_inter_driver,
+    &crypto_ips_engine_driver,
+};
 
-    // Start calculation
-    writel(1, crypto_dev.gcd_base + 0x08);
+// Encrypted block device
+//
+// With blk_ram_mb or blk_backing set, /dev/cipsblk is a blk-mq disk over a
+// RAM buffer or a backing file whose data is kept AES-128-CTR encrypted
+// by the cores. The counter of each 16-byte block is its byte offset / 16,
+// so a request of contiguous sectors is one CTR run, and encrypting and
+// decrypting only need the encrypt direction. There is one hardware queue
+// per AES instance, queue n feeding instance n. blk-mq merges bios into
+// requests of up to CRYPTO_BLK_MAX_BYTES, and each request is gathered into
+// its own bounce buffer and sent to the instance as one queue request (over
+// the stream path when there is one). CTR leaves no room for an
+// authentication tag or per-write IVs, so this is for scratch data, not
+// for disks an attacker can read twice.
+#define CRYPTO_BLK_NAME       "cipsblk"
+#define CRYPTO_BLK_MAX_BYTES  SZ_128K
+#define CRYPTO_BLK_DEPTH      16    // requests per hardware queue
 
-    // Poll for result
-    do {
-        msleep(1);
-        result = readl(crypto_dev.gcd_base + 0x0C);
-        timeout++;
-        if (timeout > 1000) {
-            printk(KERN_ERR "GCD calculation timeout!\n");
-            return -ETIMEDOUT;
-        }
-    } while ((result & 0xFF) == 0);
+static unsigned int blk_ram_mb;
+module_param(blk_ram_mb, uint, 0444);
+MODULE_PARM_DESC(blk_ram_mb, "Size of a RAM-backed encrypted block device (MiB, 0 = none)");
 
-    // Clear start signal
-    writel(0, crypto_dev.gcd_base + 0x08);
-    
-    op->result = result & 0xFF;
-    return 0;
-}
+static char *blk_backing = "";
+module_param(blk_backing, charp, 0444);
+MODULE_PARM_DESC(blk_backing, "Backing file of the encrypted block device, instead of RAM");
 
-// AES encrypt function
-static int aes_encrypt_op(struct aes_operation *op) {
-    uint32_t status;
-    int timeout = 0;
-    int i;
+static char *blk_key = "";
+module_param(blk_key, charp, 0400);
+MODULE_PARM_DESC(blk_key, "AES-128 key of the block device, 32 hex digits (default: random per load)");
 
-    // Write key (4 x 32-bit words)
-    for (i = 0; i < 4; i++) {
-        writel(op->key[i], crypto_dev.aes_base + 0x08 + (i * 4));
-    }
+static struct crypto_blk {
+    struct blk_mq_tag_set tag_set;
+    struct gendisk *disk;
+    int major;
+    struct file *backing;       // NULL for RAM
+    uint8_t *ram;
+    sector_t sectors;
+    uint32_t key[4];            // as aes_operation.key
+} crypto_blk;
 
-    // Write input data (4 x 32-bit words)
-    for (i = 0; i < 4; i++) {
-        writel(op->input[i], crypto_dev.aes_base + 0x18 + (i * 4));
-    }
+struct crypto_blk_cmd {
+    uint8_t *bounce;            // CRYPTO_BLK_MAX_BYTES
+};
 
-    // Start encryption (mode=1 for encrypt, start=1)
-    writel(0x00000003, crypto_dev.aes_base + 0x00);
+struct crypto_blk_job {
+    uint8_t *buf;
+    size_t len;
+    loff_t pos;
+};
 
-    // Wait for completion
-    do {
-        msleep(1);
-        status = readl(crypto_dev.aes_base + 0x04);
-        timeout++;
-        if (timeout > 1000) {
-            printk(KERN_ERR "AES encryption timeout!\n");
-            return -ETIMEDOUT;
-        }
-    } while (!(status & 0x00000001));
+// Queue callback: CTR over one request, in place
+static int crypto_blk_run(struct ip_engine *eng, void *data) {
+    struct crypto_blk_job *job = data;
+    uint8_t ctr[AES_BLOCK_SIZE] = { 0 }, ks[AES_BLOCK_SIZE];
+    uint8_t *p = job->buf;
+    size_t left;
+    int ret = 0;
 
-    // Read result (4 x 32-bit words)
-    for (i = 0; i < 4; i++) {
-        op->output[i] = readl(crypto_dev.aes_base + 0x28 + (i * 4));
+    put_unaligned_be64(job->pos / AES_BLOCK_SIZE, ctr + 8);
+    aes_hw_setkey(eng, crypto_blk.key);
+    if (ip_engine_can_stream(eng, job->len))
+        return crypto_ips_stream(eng, CIPHER_CTR, false, ctr, p, p, job->len);
+    for (left = job->len; left; left -= AES_BLOCK_SIZE, p += AES_BLOCK_SIZE) {
+        ret = crypto_ips_block(eng, ks, ctr, false);
+        if (ret)
+            break;
+        crypto_xor(p, ks, AES_BLOCK_SIZE);
+        crypto_inc(ctr, AES_BLOCK_SIZE);
     }
-
-    return 0;
+    return ret;
 }
 
-// Device file operations
-static int crypto_open(struct inode *node, struct file *filp) {
-    return nonseekable_open(node, filp);
-}
+// Ciphertext between the bounce buffer and the backing store
+static int crypto_blk_io(uint8_t *buf, size_t len, loff_t pos, bool write) {
+    ssize_t n;
 
-static ssize_t crypto_read(struct file *filp, char *buf, size_t size, loff_t *offset) {
-    int ret, value;
-    // Read switch value (similar to myhwip)
-    value = (readl(crypto_dev.inter_base + 0x04) >> 24) & 0xff;
-    if ((ret = copy_to_user(buf, &value, size)))
-        return ret;
-    else
+    if (!crypto_blk.backing) {
+        if (write)
+            memcpy(crypto_blk.ram + pos, buf, len);
+        else
+            memcpy(buf, crypto_blk.ram + pos, len);
         return 0;
-}
-
-static ssize_t crypto_write(struct file *filp, const char __user *buf, size_t size, loff_t *offset) {
-    int ret, value;
-    // Write LED value (similar to myhwip)
-    if ((ret = copy_from_user(&value, buf, size)))
-        printk("err: copy_from_user. ret = %d\n", ret);
-    writel(value & 0xff, crypto_dev.inter_base);
+    }
+    for (; len; len -= n, buf += n) {
+        n = write ? kernel_write(crypto_blk.backing, buf, len, &pos) :
+                    kernel_read(crypto_blk.backing, buf, len, &pos);
+        if (n < 0)
+            return n;
+        if (!n)
+            return -EIO;
+    }
     return 0;
 }
 
-static long crypto_ioctl(struct file *filp, unsigned int cmd, unsigned long arg) {
+static blk_status_t crypto_blk_queue_rq(struct blk_mq_hw_ctx *hctx,
+                                        const struct blk_mq_queue_data *bd) {
+    struct request *rq = bd->rq;
+    struct crypto_blk_cmd *cmd = blk_mq_rq_to_pdu(rq);
+    struct crypto_blk_job job = {
+        .buf = cmd->bounce,
+        .len = blk_rq_bytes(rq),
+        .pos = (loff_t)blk_rq_pos(rq) << SECTOR_SHIFT,
+    };
+    struct req_iterator iter;
+    struct bio_vec bv;
+    size_t off = 0;
     int ret = 0;
-    struct des_operation des_op;
-    struct gcd_operation gcd_op;
-    struct aes_operation aes_op;
-    int value;
 
-    switch (cmd) {
-        case CRYPTO_READ_SWITCH:
-            value = (readl(crypto_dev.inter_base + 0x04) >> 24) & 0xff;
-            ret = copy_to_user((int *)arg, &value, sizeof(int));
+    blk_mq_start_request(rq);
+    switch (req_op(rq)) {
+        case REQ_OP_FLUSH:
+            if (crypto_blk.backing)
+                ret = vfs_fsync(crypto_blk.backing, 0);
             break;
 
-        case CRYPTO_WRITE_LED:
-            ret = copy_from_user(&value, (int *)arg, sizeof(int));
-            if (!ret) {
-                writel(value & 0xff, crypto_dev.inter_base);
+        case REQ_OP_WRITE:
+            rq_for_each_segment(bv, rq, iter) {
+                memcpy_from_bvec(job.buf + off, &bv);
+                off += bv.bv_len;
             }
+            ret = ip_instance_submit(ENGINE_AES, hctx->queue_num, crypto_blk_run, &job);
+            if (!ret)
+                ret = crypto_blk_io(job.buf, job.len, job.pos, true);
             break;
 
-        case CRYPTO_DES_ENCRYPT:
-            ret = copy_from_user(&des_op, (struct des_operation *)arg, sizeof(des_op));
-            if (!ret) {
-                ret = des_encrypt_op(&des_op);
-                if (!ret) {
-                    ret = copy_to_user((struct des_operation *)arg, &des_op, sizeof(des_op));
-                }
+        case REQ_OP_READ:
+            ret = crypto_blk_io(job.buf, job.len, job.pos, false);
+            if (!ret)
+                ret = ip_instance_submit(ENGINE_AES, hctx->queue_num, crypto_blk_run, &job);
+            if (ret)
+                break;
+            rq_for_each_segment(bv, rq, iter) {
+                memcpy_to_bvec(&bv, job.buf + off);
+                off += bv.bv_len;
             }
             break;
 
-        case CRYPTO_DES_DECRYPT:
-            ret = copy_from_user(&des_op, (struct des_operation *)arg, sizeof(des_op));
-            if (!ret) {
-                ret = des_decrypt_op(&des_op);
-                if (!ret) {
-                    ret = copy_to_user((struct des_operation *)arg, &des_op, sizeof(des_op));
-                }
-            }
-            break;
+        default:
+            blk_mq_end_request(rq, BLK_STS_NOTSUPP);
+            return BLK_STS_OK;
+    }
+    blk_mq_end_request(rq, errno_to_blk_status(ret));
+    return BLK_STS_OK;
+}
 
-        case CRYPTO_GCD_CALC:
-            ret = copy_from_user(&gcd_op, (struct gcd_operation *)arg, sizeof(gcd_op));
-            if (!ret) {
-                ret = gcd_calc_op(&gcd_op);
-                if (!ret) {
-                    ret = copy_to_user((struct gcd_operation *)arg, &gcd_op, sizeof(gcd_op));
-                }
-            }
-            break;
+static int crypto_blk_init_request(struct blk_mq_tag_set *set, struct request *rq,
+                                   unsigned int hctx_idx, unsigned int numa_node) {
+    struct crypto_blk_cmd *cmd = blk_mq_rq_to_pdu(rq);
 
-        case CRYPTO_AES_ENCRYPT:
-            ret = copy_from_user(&aes_op, (struct aes_operation *)arg, sizeof(aes_op));
-            if (!ret) {
-                ret = aes_encrypt_op(&aes_op);
-                if (!ret) {
-                    ret = copy_to_user((struct aes_operation *)arg, &aes_op, sizeof(aes_op));
-                }
-            }
-            break;
+    cmd->bounce = kvmalloc(CRYPTO_BLK_MAX_BYTES, GFP_KERNEL);
+    return cmd->bounce ? 0 : -ENOMEM;
+}
 
-        default:
-            ret = -ENOTTY;
+static void crypto_blk_exit_request(struct blk_mq_tag_set *set, struct request *rq,
+                                    unsigned int hctx_idx) {
+    struct crypto_blk_cmd *cmd = blk_mq_rq_to_pdu(rq);
+
+    kvfree(cmd->bounce);
+}
+
+static const struct blk_mq_ops crypto_blk_mq_ops = {
+    .queue_rq = crypto_blk_queue_rq,
+    .init_request = crypto_blk_init_request,
+    .exit_request = crypto_blk_exit_request,
+};
+
+static const struct block_device_operations crypto_blk_fops = {
+    .owner = THIS_MODULE,
+};
+
+static int crypto_blk_key(void) {
+    uint8_t raw[AES_KEYSIZE_128];
+    int i;
+
+    if (!*blk_key) {
+        get_random_bytes(raw, sizeof(raw));
+    } else if (strlen(blk_key) != 2 * AES_KEYSIZE_128 || hex2bin(raw, blk_key, sizeof(raw))) {
+        return -EINVAL;
+    }
+    // Big-endian words, like the crypto API path
+    for (i = 0; i < 4; i++)
+        crypto_blk.key[i] = get_unaligned_be32(raw + i * 4);
+    memzero_explicit(raw, sizeof(raw));
+    return 0;
+}
+
+static void crypto_blk_exit(void) {
+    if (crypto_blk.disk) {
+        del_gendisk(crypto_blk.disk);
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 0, 0)
+        blk_cleanup_disk(crypto_blk.disk);
+#else
+        put_disk(crypto_blk.disk);
+#endif
+        crypto_blk.disk = NULL;
+    }
+    if (crypto_blk.tag_set.ops) {
+        blk_mq_free_tag_set(&crypto_blk.tag_set);
+        crypto_blk.tag_set.ops = NULL;
+    }
+    if (crypto_blk.major > 0) {
+        unregister_blkdev(crypto_blk.major, CRYPTO_BLK_NAME);
+        crypto_blk.major = 0;
+    }
+    if (crypto_blk.backing) {
+        filp_close(crypto_blk.backing, NULL);
+        crypto_blk.backing = NULL;
+    }
+    vfree(crypto_blk.ram);
+    crypto_blk.ram = NULL;
+}
+
+// After the cores have probed: one hardware queue per AES instance
+static int crypto_blk_init(void) {
+    struct blk_mq_tag_set *set = &crypto_blk.tag_set;
+    unsigned int queues = READ_ONCE(crypto_dev.n_engines[ENGINE_AES]);
+    struct gendisk *disk;
+    int ret;
+
+    if (!blk_ram_mb && !*blk_backing)
+        return 0;
+    if (!queues)
+        return -ENODEV;
+    if (!crypto_ips_kat(ENGINE_AES))
+        return -EIO;
+    ret = crypto_blk_key();
+    if (ret)
+        return ret;
+
+    if (*blk_backing) {
+        crypto_blk.backing = filp_open(blk_backing, O_RDWR | O_LARGEFILE, 0);
+        if (IS_ERR(crypto_blk.backing)) {
+            ret = PTR_ERR(crypto_blk.backing);
+            crypto_blk.backing = NULL;
+            return ret;
+        }
+        crypto_blk.sectors = i_size_read(file_inode(crypto_blk.backing)) >> SECTOR_SHIFT;
+    } else {
+        crypto_blk.ram = vzalloc((size_t)blk_ram_mb << 20);
+        if (!crypto_blk.ram)
+            return -ENOMEM;
+        crypto_blk.sectors = (sector_t)blk_ram_mb << (20 - SECTOR_SHIFT);
+    }
+    ret = -EINVAL;
+    if (!crypto_blk.sectors)
+        goto fail;
+
+    ret = register_blkdev(0, CRYPTO_BLK_NAME);
+    if (ret < 0)
+        goto fail;
+    crypto_blk.major = ret;
+
+    set->ops = &crypto_blk_mq_ops;
+    set->nr_hw_queues = queues;
+    set->queue_depth = CRYPTO_BLK_DEPTH;
+    set->numa_node = NUMA_NO_NODE;
+    set->cmd_size = sizeof(struct crypto_blk_cmd);
+    // queue_rq sleeps on the engine
+    set->flags = BLK_MQ_F_SHOULD_MERGE | BLK_MQ_F_BLOCKING;
+    ret = blk_mq_alloc_tag_set(set);
+    if (ret) {
+        set->ops = NULL;
+        goto fail;
+    }
+
+    disk = blk_mq_alloc_disk(set, &crypto_blk);
+    if (IS_ERR(disk)) {
+        ret = PTR_ERR(disk);
+        goto fail;
+    }
+    crypto_blk.disk = disk;
+    blk_queue_max_hw_sectors(disk->queue, CRYPTO_BLK_MAX_BYTES >> SECTOR_SHIFT);
+    blk_queue_flag_set(QUEUE_FLAG_NONROT, disk->queue);
+    disk->major = crypto_blk.major;
+    disk->first_minor = 0;
+    disk->minors = 1;
+    disk->fops = &crypto_blk_fops;
+    disk->private_data = &crypto_blk;
+    strscpy(disk->disk_name, CRYPTO_BLK_NAME, DISK_NAME_LEN);
+    set_capacity(disk, crypto_blk.sectors);
+
+    ret = add_disk(disk);
+    if (ret)
+        goto fail;
+
+    printk(KERN_INFO "%s: %llu MiB on %s, %u queues\n", CRYPTO_BLK_NAME,
+           (unsigned long long)crypto_blk.sectors >> (20 - SECTOR_SHIFT),
+           crypto_blk.backing ? blk_backing : "RAM", queues);
+    return 0;
+
+fail:
+    crypto_blk_exit();
+    return ret;
+}
+
+// Hardware RNG
+//
+// An SP 800-90A CTR_DRBG on AES-128 (no derivation function, seeds of
+// seedlen = 32 bytes from get_random_bytes()) registered as a hwrng. Each
+// refill is one Generate of CRYPTO_RNG_BUF bytes: the counter blocks V+1,
+// V+2, ... run through the core in a single queue request, over the stream
+// path where there is one, and reads are served from that buffer. Reseeds
+// come from the kernel pool every rng_reseed_s in the background and after
+// CRYPTO_RNG_RESEED_INTERVAL generates. Since the seed comes from the pool,
+// quality is 1 so the output isn't credited back to it as entropy.
+#define CRYPTO_RNG_BUF              IP_STREAM_SIZE  // per Generate, under the 64 KiB limit
+#define CRYPTO_RNG_SEED             (AES_KEYSIZE_128 + AES_BLOCK_SIZE)
+#define CRYPTO_RNG_RESEED_INTERVAL  1024            // generates, 16 MiB
+
+static bool rng_enable = true;
+module_param_named(rng, rng_enable, bool, 0444);
+MODULE_PARM_DESC(rng, "Register an AES-CTR_DRBG on the AES core as a hwrng");
+
+static unsigned int rng_reseed_s = 60;
+module_param(rng_reseed_s, uint, 0644);
+MODULE_PARM_DESC(rng_reseed_s, "Reseed period of the hwrng from the kernel entropy pool (s, 0 = by count only)");
+
+static struct crypto_ips_rng {
+    struct hwrng hwrng;
+    bool registered;
+    struct mutex lock;          // everything below
+    uint32_t key[4];            // as aes_operation.key
+    uint8_t v[AES_BLOCK_SIZE];  // V + 1, the next counter block
+    unsigned int generates;     // since the last reseed
+    // Work for the next run
+    bool instantiate;
+    bool reseed;                // Update with seed first
+    bool generate;
+    uint8_t seed[CRYPTO_RNG_SEED];
+    uint8_t *buf;
+    size_t pos, len;
+    struct delayed_work reseed_work;
+} crypto_rng;
+
+// AES(ctr), AES(ctr + 1), ... into out, len a multiple of the block. ctr
+// is left at the next counter.
+static int crypto_ips_keystream(struct ip_engine *eng, uint8_t *ctr, uint8_t *out, size_t len) {
+    int ret = 0;
+
+    if (ip_engine_can_stream(eng, len)) {
+        memset(out, 0, len);
+        return crypto_ips_stream(eng, CIPHER_CTR, false, ctr, out, out, len);
+    }
+    for (; len; len -= AES_BLOCK_SIZE, out += AES_BLOCK_SIZE) {
+        ret = crypto_ips_block(eng, out, ctr, false);
+        if (ret)
             break;
+        crypto_inc(ctr, AES_BLOCK_SIZE);
     }
+    return ret;
+}
 
+// CTR_DRBG_Update: Key || V = AES(V+1) || AES(V+2), xor provided (if any)
+static int crypto_rng_update(struct ip_engine *eng, struct crypto_ips_rng *r,
+                             const uint8_t *provided) {
+    uint8_t temp[CRYPTO_RNG_SEED];
+    int i, ret;
+
+    aes_hw_setkey(eng, r->key);
+    ret = crypto_ips_keystream(eng, r->v, temp, sizeof(temp));
+    if (!ret) {
+        if (provided)
+            crypto_xor(temp, provided, sizeof(temp));
+        for (i = 0; i < 4; i++)
+            r->key[i] = get_unaligned_be32(temp + i * 4);
+        memcpy(r->v, temp + AES_KEYSIZE_128, AES_BLOCK_SIZE);
+        crypto_inc(r->v, AES_BLOCK_SIZE);
+    }
+    memzero_explicit(temp, sizeof(temp));
     return ret;
 }
 
-static int crypto_release(struct inode *inode, struct file *flip) {
-    return 0;
+// Queue callback: instantiate or reseed, then generate, as requested
+static int crypto_rng_run(struct ip_engine *eng, void *data) {
+    struct crypto_ips_rng *r = data;
+    int ret;
+
+    if (r->instantiate) {
+        // Key = 0, V = 0
+        memset(r->key, 0, sizeof(r->key));
+        memset(r->v, 0, sizeof(r->v));
+        crypto_inc(r->v, AES_BLOCK_SIZE);
+    }
+    if (r->reseed) {
+        ret = crypto_rng_update(eng, r, r->seed);
+        if (ret)
+            return ret;
+        r->generates = 0;
+    }
+    if (!r->generate)
+        return 0;
+
+    aes_hw_setkey(eng, r->key);
+    ret = crypto_ips_keystream(eng, r->v, r->buf, CRYPTO_RNG_BUF);
+    if (!ret)
+        ret = crypto_rng_update(eng, r, NULL);
+    if (!ret)
+        r->generates++;
+    return ret;
 }
 
-static struct file_operations crypto_fops = {
-    .owner = THIS_MODULE,
-    .open = crypto_open,
-    .write = crypto_write,
-    .read = crypto_read,
-    .unlocked_ioctl = crypto_ioctl,
-    .release = crypto_release,
-};
+// Under r->lock
+static int crypto_rng_submit(struct crypto_ips_rng *r, bool instantiate, bool reseed,
+                             bool generate) {
+    int ret;
+
+    r->instantiate = instantiate;
+    r->reseed = reseed;
+    r->generate = generate;
+    if (reseed)
+        get_random_bytes(r->seed, sizeof(r->seed));
+    ret = ip_type_submit(ENGINE_AES, CRYPTO_PRIO_NORMAL, crypto_rng_run, r);
+    memzero_explicit(r->seed, sizeof(r->seed));
+    return ret;
+}
 
-// Initialize interrupt
-static void get_node_irq(void) {
+static int crypto_rng_read(struct hwrng *hwrng, void *data, size_t max, bool wait) {
+    struct crypto_ips_rng *r = container_of(hwrng, struct crypto_ips_rng, hwrng);
+    size_t n;
     int ret;
-    crypto_dev.nd = of_find_node_by_path("/amba_pl/inter_ip@43c00000");
-    if (crypto_dev.nd == NULL) {
-        printk("no node from dts found!\n");
-        return;
+
+    mutex_lock(&r->lock);
+    if (r->pos == r->len) {
+        ret = crypto_rng_submit(r, false, r->generates >= CRYPTO_RNG_RESEED_INTERVAL, true);
+        if (ret) {
+            mutex_unlock(&r->lock);
+            return ret;
+        }
+        r->pos = 0;
+        r->len = CRYPTO_RNG_BUF;
     }
-    crypto_dev.irq = irq_of_parse_and_map(crypto_dev.nd, 0);
-    printk("virtual irq: %d\n", crypto_dev.irq);
-    ret = request_irq(crypto_dev.irq, btn_handler, IRQF_TRIGGER_RISING, "crypto_ips", NULL);
-    if (ret < 0)
-        printk("request_irq %d failed, ret = %d\n", crypto_dev.irq, ret);
+    // Bytes handed out don't stay behind in the buffer
+    n = min(max, r->len - r->pos);
+    memcpy(data, r->buf + r->pos, n);
+    memzero_explicit(r->buf + r->pos, n);
+    r->pos += n;
+    mutex_unlock(&r->lock);
+    return n;
+}
+
+static void crypto_rng_reseed_work(struct work_struct *work) {
+    struct crypto_ips_rng *r = container_of(to_delayed_work(work), struct crypto_ips_rng,
+                                            reseed_work);
+    unsigned int period = READ_ONCE(rng_reseed_s);
+    int ret;
+
+    mutex_lock(&r->lock);
+    ret = crypto_rng_submit(r, false, true, false);
+    mutex_unlock(&r->lock);
+    if (ret)
+        printk(KERN_WARNING "crypto_ips rng: reseed failed, ret = %d\n", ret);
+    if (period)
+        schedule_delayed_work(&r->reseed_work, period * HZ);
+}
+
+static void crypto_rng_exit(void) {
+    struct crypto_ips_rng *r = &crypto_rng;
+
+    if (!r->registered)
+        return;
+    hwrng_unregister(&r->hwrng);
+    cancel_delayed_work_sync(&r->reseed_work);
+    memzero_explicit(r->buf, CRYPTO_RNG_BUF);
+    kfree(r->buf);
+    memzero_explicit(r->key, sizeof(r->key));
+    r->registered = false;
+}
+
+// After the cores have probed, like the block device
+static int crypto_rng_init(void) {
+    struct crypto_ips_rng *r = &crypto_rng;
+    int ret;
+
+    if (!rng_enable || !READ_ONCE(crypto_dev.n_engines[ENGINE_AES]))
+        return 0;
+    // Wrong output must not reach the entropy pool
+    if (!crypto_ips_kat(ENGINE_AES))
+        return -EIO;
+    r->buf = kmalloc(CRYPTO_RNG_BUF, GFP_KERNEL);
+    if (!r->buf)
+        return -ENOMEM;
+    mutex_init(&r->lock);
+    INIT_DELAYED_WORK(&r->reseed_work, crypto_rng_reseed_work);
+
+    mutex_lock(&r->lock);
+    ret = crypto_rng_submit(r, true, true, false);
+    mutex_unlock(&r->lock);
+    if (ret)
+        goto fail;
+
+    r->hwrng.name = "crypto_ips";
+    r->hwrng.read = crypto_rng_read;
+    r->hwrng.quality = 1;
+    ret = hwrng_register(&r->hwrng);
+    if (ret)
+        goto fail;
+    r->registered = true;
+    if (rng_reseed_s)
+        schedule_delayed_work(&r->reseed_work, rng_reseed_s * HZ);
+    printk(KERN_INFO "crypto_ips rng: AES-CTR_DRBG registered\n");
+    return 0;
+
+fail:
+    kfree(r->buf);
+    r->buf = NULL;
+    return ret;
 }
 
 static int __init crypto_init(void) {
+    int i, ret;
+
+    // Everything an open() or ioctl() can reach is set up before the char
+    // device goes live
+    spin_lock_init(&crypto_dev.engines_lock);
+    for (i = 0; i < ENGINE_CNT; i++)
+        INIT_LIST_HEAD(&crypto_dev.engines[i]);
+
+    // Unbound so async ops for different engines run side by side
+    crypto_dev.async_wq = alloc_workqueue("crypto_ips", WQ_UNBOUND, 0);
+    if (!crypto_dev.async_wq)
+        return -ENOMEM;
+
     // Allocate device number
-    if (alloc_chrdev_region(&crypto_dev.devid, 0, DEVICE_CNT, DEVICE_NAME) < 0) {
+    ret = alloc_chrdev_region(&crypto_dev.devid, 0, DEVICE_CNT, DEVICE_NAME);
+    if (ret < 0) {
         printk("allocating chrdev region failed!\n");
-        return -1;
+        goto err_wq;
     }
     crypto_dev.major = MAJOR(crypto_dev.devid);
     printk("major: %d\n", crypto_dev.major);
 
     // Initialize and add character device
     cdev_init(&crypto_dev.cdev, &crypto_fops);
-    cdev_add(&crypto_dev.cdev, crypto_dev.devid, DEVICE_CNT);
+    ret = cdev_add(&crypto_dev.cdev, crypto_dev.devid, DEVICE_CNT);
+    if (ret)
+        goto err_region;
 
     // Create device class and device
     crypto_dev.class = class_create(THIS_MODULE, CLASS_NAME);
-    device_create(crypto_dev.class, NULL, crypto_dev.devid, NULL, DEVICE_NAME);
+    if (IS_ERR(crypto_dev.class)) {
+        ret = PTR_ERR(crypto_dev.class);
+        goto err_cdev;
+    }
+    crypto_dev.dev = device_create(crypto_dev.class, NULL, crypto_dev.devid, NULL, DEVICE_NAME);
+    if (IS_ERR(crypto_dev.dev)) {
+        ret = PTR_ERR(crypto_dev.dev);
+        goto err_class;
+    }
 
-    // Setup interrupt
-    get_node_irq();
+    // Per-instance histograms go below this, see ip_engine_debugfs_init()
+    crypto_dev.debugfs = debugfs_create_dir("crypto_ips", NULL);
+    crypto_events_debugfs_init();
+    debugfs_create_file("bench", 0600, crypto_dev.debugfs, NULL, &crypto_bench_fops);
+    debugfs_create_file("fallbacks", 0400, crypto_dev.debugfs, NULL, &ip_fallbacks_fops);
 
-    // Map all IP base addresses
-    crypto_dev.inter_base = ioremap(INTER_IP_BASEADDR, IP_SIZE);
-    crypto_dev.aes_base = ioremap(AES_IP_BASEADDR, IP_SIZE);
-    crypto_dev.des_base = ioremap(DES_IP_BASEADDR, IP_SIZE);
-    crypto_dev.gcd_base = ioremap(GCD_IP_BASEADDR, IP_SIZE);
+    // The cores probe from here on, from the DT or the register model
+    ret = platform_register_drivers(crypto_ips_drivers, ARRAY_SIZE(crypto_ips_drivers));
+    if (ret) {
+        printk(KERN_ERR "registering platform drivers failed, ret = %d\n", ret);
+        goto err_debugfs;
+    }
 
-    if (!crypto_dev.inter_base || !crypto_dev.aes_base || 
-        !crypto_dev.des_base || !crypto_dev.gcd_base) {
-        printk(KERN_ERR "Failed to map IP addresses\n");
-        return -EINVAL;
+    if (mock) {
+        ret = mock_init();
+        if (ret)
+            goto err_mock;
     }
 
-    printk(KERN_INFO "Crypto IPs module loaded successfully\n");
-    printk(KERN_INFO "INTER: 0x%08x => %p\n", INTER_IP_BASEADDR, crypto_dev.inter_base);
-    printk(KERN_INFO "AES: 0x%08x => %p\n", AES_IP_BASEADDR, crypto_dev.aes_base);
-    printk(KERN_INFO "DES: 0x%08x => %p\n", DES_IP_BASEADDR, crypto_dev.des_base);
-    printk(KERN_INFO "GCD: 0x%08x => %p\n", GCD_IP_BASEADDR, crypto_dev.gcd_base);
+    if (watchdog_ms)
+        schedule_delayed_work(&ip_watchdog_work, msecs_to_jiffies(watchdog_ms));
+
+    // Before the disk and the hwrng have users of their own
+    if (bench && crypto_bench_all())
+        printk(KERN_ERR "crypto_ips bench: out of memory\n");
 
+    // Optional, so the char device stays up if it fails
+    ret = crypto_blk_init();
+    if (ret)
+        printk(KERN_ERR "%s: not created, ret = %d\n", CRYPTO_BLK_NAME, ret);
+    ret = crypto_rng_init();
+    if (ret)
+        printk(KERN_ERR "crypto_ips rng: not registered, ret = %d\n", ret);
+
+    printk(KERN_INFO "Crypto IPs module loaded successfully\n");
     return 0;
+
+err_mock:
+    mock_exit();
+    platform_unregister_drivers(crypto_ips_drivers, ARRAY_SIZE(crypto_ips_drivers));
+err_debugfs:
+    debugfs_remove_recursive(crypto_dev.debugfs);
+    device_destroy(crypto_dev.class, crypto_dev.devid);
+err_class:
+    class_destroy(crypto_dev.class);
+err_cdev:
+    cdev_del(&crypto_dev.cdev);
+err_region:
+    unregister_chrdev_region(crypto_dev.devid, DEVICE_CNT);
+err_wq:
+    destroy_workqueue(crypto_dev.async_wq);
+    return ret;
 }
 
 static void __exit crypto_exit(void) {
     printk(KERN_ALERT "Crypto IPs module unloaded\n");
-    
-    // Cleanup
-    cdev_del(&crypto_dev.cdev);
-    unregister_chrdev_region(crypto_dev.devid, DEVICE_CNT);
+
+    // The disk, the hwrng and the crypto API users drain before the cores
+    // go away
+    crypto_rng_exit();
+    crypto_blk_exit();
+    crypto_ips_unregister_algs();
+
+    // Open fds hold a module reference, so no async work is left and the
+    // switch sampling has stopped with the last subscriber
+    destroy_workqueue(crypto_dev.async_wq);
+    cancel_delayed_work_sync(&switch_poll_work);
+    cancel_delayed_work_sync(&ip_watchdog_work);
+
+    // Unbinding releases the mappings and interrupts (devm); the engines
+    // drop their links under the char device on the way
+    if (mock)
+        mock_exit();
+    platform_unregister_drivers(crypto_ips_drivers, ARRAY_SIZE(crypto_ips_drivers));
+    debugfs_remove_recursive(crypto_dev.debugfs);
+    crypto_bench_exit();
+
+    // Cleanup, in reverse order of crypto_init()
     device_destroy(crypto_dev.class, crypto_dev.devid);
     class_destroy(crypto_dev.class);
-    
-    // Unmap addresses
-    if (crypto_dev.inter_base) iounmap(crypto_dev.inter_base);
-    if (crypto_dev.aes_base) iounmap(crypto_dev.aes_base);
-    if (crypto_dev.des_base) iounmap(crypto_dev.des_base);
-    if (crypto_dev.gcd_base) iounmap(crypto_dev.gcd_base);
-    
-    // Free interrupt
-    if (crypto_dev.irq) free_irq(crypto_dev.irq, NULL);
+    cdev_del(&crypto_dev.cdev);
+    unregister_chrdev_region(crypto_dev.devid, DEVICE_CNT);
 }
 
 module_init(crypto_init);
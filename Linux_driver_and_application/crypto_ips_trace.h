@@ -0,0 +1,132 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM crypto_ips
+
+#if !defined(CRYPTO_IPS_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define CRYPTO_IPS_TRACE_H
+
+#include <linux/tracepoint.h>
+
+// Tracepoints for one op's way through the driver:
+//   copy_in -> submit (queued on an instance) -> start (registers programmed,
+//   start bit written) -> done or timeout (-> reset) -> copy_out
+// Enable with: trace-cmd record -e crypto_ips
+
+DECLARE_EVENT_CLASS(crypto_ips_engine,
+    TP_PROTO(const char *name, unsigned int index),
+    TP_ARGS(name, index),
+    TP_STRUCT__entry(
+        __string(name, name)
+        __field(unsigned int, index)
+    ),
+    TP_fast_assign(
+        __assign_str(name, name);
+        __entry->index = index;
+    ),
+    TP_printk("%s%u", __get_str(name), __entry->index)
+);
+
+DEFINE_EVENT(crypto_ips_engine, crypto_ips_submit,
+    TP_PROTO(const char *name, unsigned int index),
+    TP_ARGS(name, index)
+);
+
+TRACE_EVENT(crypto_ips_start,
+    TP_PROTO(const char *name, unsigned int index, uint32_t ctrl, u64 program_ns),
+    TP_ARGS(name, index, ctrl, program_ns),
+    TP_STRUCT__entry(
+        __string(name, name)
+        __field(unsigned int, index)
+        __field(uint32_t, ctrl)
+        __field(u64, program_ns)
+    ),
+    TP_fast_assign(
+        __assign_str(name, name);
+        __entry->index = index;
+        __entry->ctrl = ctrl;
+        __entry->program_ns = program_ns;
+    ),
+    TP_printk("%s%u ctrl=0x%08x program_ns=%llu", __get_str(name), __entry->index,
+              __entry->ctrl, __entry->program_ns)
+);
+
+DECLARE_EVENT_CLASS(crypto_ips_result,
+    TP_PROTO(const char *name, unsigned int index, uint32_t status, u64 wait_ns),
+    TP_ARGS(name, index, status, wait_ns),
+    TP_STRUCT__entry(
+        __string(name, name)
+        __field(unsigned int, index)
+        __field(uint32_t, status)
+        __field(u64, wait_ns)
+    ),
+    TP_fast_assign(
+        __assign_str(name, name);
+        __entry->index = index;
+        __entry->status = status;
+        __entry->wait_ns = wait_ns;
+    ),
+    TP_printk("%s%u status=0x%08x wait_ns=%llu", __get_str(name), __entry->index,
+              __entry->status, __entry->wait_ns)
+);
+
+DEFINE_EVENT(crypto_ips_result, crypto_ips_done,
+    TP_PROTO(const char *name, unsigned int index, uint32_t status, u64 wait_ns),
+    TP_ARGS(name, index, status, wait_ns)
+);
+
+DEFINE_EVENT(crypto_ips_result, crypto_ips_timeout,
+    TP_PROTO(const char *name, unsigned int index, uint32_t status, u64 wait_ns),
+    TP_ARGS(name, index, status, wait_ns)
+);
+
+// Soft reset after a timeout or by the watchdog; ret 0 if the core is idle
+// again, see ip_engine_recover()
+TRACE_EVENT(crypto_ips_reset,
+    TP_PROTO(const char *name, unsigned int index, int ret),
+    TP_ARGS(name, index, ret),
+    TP_STRUCT__entry(
+        __string(name, name)
+        __field(unsigned int, index)
+        __field(int, ret)
+    ),
+    TP_fast_assign(
+        __assign_str(name, name);
+        __entry->index = index;
+        __entry->ret = ret;
+    ),
+    TP_printk("%s%u ret=%d", __get_str(name), __entry->index, __entry->ret)
+);
+
+// Emitted once the user buffer has been copied, so the gap to the ioctl
+// syscall entry (or to done) is the copy time
+DECLARE_EVENT_CLASS(crypto_ips_copy,
+    TP_PROTO(unsigned int cmd, size_t len),
+    TP_ARGS(cmd, len),
+    TP_STRUCT__entry(
+        __field(unsigned int, cmd)
+        __field(size_t, len)
+    ),
+    TP_fast_assign(
+        __entry->cmd = cmd;
+        __entry->len = len;
+    ),
+    TP_printk("cmd=0x%08x len=%zu", __entry->cmd, __entry->len)
+);
+
+DEFINE_EVENT(crypto_ips_copy, crypto_ips_copy_in,
+    TP_PROTO(unsigned int cmd, size_t len),
+    TP_ARGS(cmd, len)
+);
+
+DEFINE_EVENT(crypto_ips_copy, crypto_ips_copy_out,
+    TP_PROTO(unsigned int cmd, size_t len),
+    TP_ARGS(cmd, len)
+);
+
+#endif // CRYPTO_IPS_TRACE_H
+
+// The header lives next to crypto_ips.c, not in include/trace/events
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE crypto_ips_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,319 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include "crypto_uio.h"
+
+// Register map of the cores, as in crypto_ips.c
+#define AES_CTRL_REG      0x00
+#define AES_STATUS_REG    0x04
+#define AES_KEY_REG       0x08  // 4 words
+#define AES_DATA_IN_REG   0x18  // 4 words
+#define AES_DATA_OUT_REG  0x28  // 4 words
+#define AES_CTRL_START    (1u << 0)
+#define AES_CTRL_ENCRYPT  (1u << 1)
+#define AES_CTRL_IRQ_EN   (1u << 2)
+#define AES_STATUS_DONE   (1u << 0)
+
+#define DES_DATA_LO_REG   0x00
+#define DES_DATA_HI_REG   0x04
+#define DES_KEY_LO_REG    0x08
+#define DES_KEY_HI_REG    0x0C
+#define DES_CTRL_REG      0x10
+#define DES_RES_LO_REG    0x14
+#define DES_RES_HI_REG    0x18
+#define DES_STATUS_REG    0x1C
+#define DES_CTRL_START    (1u << 0)
+#define DES_CTRL_DECRYPT  (1u << 1)
+#define DES_CTRL_IRQ_EN   (1u << 2)
+#define DES_STATUS_DONE   (1u << 0)
+#define DES_STATUS_READY  (1u << 1)
+
+#define GCD_X_REG         0x00
+#define GCD_Y_REG         0x04
+#define GCD_CTRL_REG      0x08
+#define GCD_RESULT_REG    0x0C
+#define GCD_CTRL_START    (1u << 0)
+#define GCD_CTRL_IRQ_EN   (1u << 1)
+#define GCD_RESULT_MASK   0xFF
+#define GCD_RESULT_DONE   (1u << 8)
+
+#define UIO_DEVICES_MAX   32
+#define POLL_CLOCK_EVERY  64    // status reads between clock reads
+
+struct uio_core {
+    const char *name;       // DT node name, /sys/class/uio/uioN/name
+    uint32_t ctrl_reg;
+    uint32_t irq_en_bit;
+    uint32_t status_reg;
+    uint32_t done_mask;
+    unsigned int timeout_us;
+};
+
+static const struct uio_core uio_cores[CRYPTO_UIO_CORES] = {
+    [CRYPTO_UIO_AES] = { "aes_ip", AES_CTRL_REG, AES_CTRL_IRQ_EN, AES_STATUS_REG,
+                         AES_STATUS_DONE, 1000000 },
+    [CRYPTO_UIO_DES] = { "des_ip", DES_CTRL_REG, DES_CTRL_IRQ_EN, DES_STATUS_REG,
+                         DES_STATUS_DONE, 100000 },
+    // A non-zero result also counts as done, as in the driver
+    [CRYPTO_UIO_GCD] = { "gcd_ip", GCD_CTRL_REG, GCD_CTRL_IRQ_EN, GCD_RESULT_REG,
+                         GCD_RESULT_DONE | GCD_RESULT_MASK, 1000000 },
+};
+
+struct crypto_uio {
+    const struct uio_core *core;
+    enum crypto_uio_core id;
+    int fd;
+    int use_irq;
+    volatile uint32_t *regs;
+    size_t size;
+    // What the key registers hold, as the driver tracks it
+    uint32_t key[4];
+    int key_valid;
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline uint32_t reg_read(struct crypto_uio *u, uint32_t off) {
+    return u->regs[off / 4];
+}
+
+static inline void reg_write(struct crypto_uio *u, uint32_t off, uint32_t val) {
+    u->regs[off / 4] = val;
+}
+
+// First line of a sysfs attribute
+static int read_attr(const char *path, char *buf, size_t len) {
+    FILE *f = fopen(path, "r");
+    int ok;
+
+    if (!f)
+        return -1;
+    ok = fgets(buf, len, f) != NULL;
+    fclose(f);
+    if (!ok)
+        return -1;
+    buf[strcspn(buf, "\n")] = '\0';
+    return 0;
+}
+
+// uioN whose name is the core's DT node name, -1 if none
+static int find_uio(const char *name, size_t *size) {
+    char path[64], buf[32];
+    int n;
+
+    for (n = 0; n < UIO_DEVICES_MAX; n++) {
+        snprintf(path, sizeof(path), "/sys/class/uio/uio%d/name", n);
+        if (read_attr(path, buf, sizeof(buf)) || strcmp(buf, name))
+            continue;
+        snprintf(path, sizeof(path), "/sys/class/uio/uio%d/maps/map0/size", n);
+        if (read_attr(path, buf, sizeof(buf)))
+            return -1;
+        *size = strtoul(buf, NULL, 0);
+        return n;
+    }
+    return -1;
+}
+
+struct crypto_uio *crypto_uio_open(enum crypto_uio_core core, int use_irq) {
+    struct crypto_uio *u;
+    char path[32];
+    int n, err;
+
+    if (core < 0 || core >= CRYPTO_UIO_CORES) {
+        errno = EINVAL;
+        return NULL;
+    }
+    u = calloc(1, sizeof(*u));
+    if (!u)
+        return NULL;
+    u->core = &uio_cores[core];
+    u->id = core;
+    u->use_irq = use_irq;
+    u->fd = -1;
+
+    n = find_uio(u->core->name, &u->size);
+    if (n < 0 || !u->size) {
+        err = ENODEV;
+        goto fail;
+    }
+    snprintf(path, sizeof(path), "/dev/uio%d", n);
+    u->fd = open(path, O_RDWR);
+    if (u->fd < 0) {
+        err = errno;
+        goto fail;
+    }
+    if (flock(u->fd, LOCK_EX | LOCK_NB)) {
+        err = errno == EWOULDBLOCK ? EBUSY : errno;
+        goto fail;
+    }
+    // Map N of a UIO device is at offset N pages
+    u->regs = mmap(NULL, u->size, PROT_READ | PROT_WRITE, MAP_SHARED, u->fd, 0);
+    if (u->regs == MAP_FAILED) {
+        u->regs = NULL;
+        err = errno;
+        goto fail;
+    }
+    return u;
+
+fail:
+    crypto_uio_close(u);
+    errno = err;
+    return NULL;
+}
+
+void crypto_uio_close(struct crypto_uio *u) {
+    if (!u)
+        return;
+    if (u->regs) {
+        // Leave the done interrupt off for the next user
+        reg_write(u, u->core->ctrl_reg, 0);
+        munmap((void *)u->regs, u->size);
+    }
+    if (u->fd >= 0)
+        close(u->fd);
+    free(u);
+}
+
+// Start an op; ctrl contains the start bit. uio_pdrv_genirq masks the
+// interrupt each time it fires, so it is unmasked again first.
+static int start_op(struct crypto_uio *u, uint32_t ctrl) {
+    uint32_t one = 1;
+
+    if (u->use_irq) {
+        if (write(u->fd, &one, sizeof(one)) != sizeof(one))
+            return -1;
+        ctrl |= u->core->irq_en_bit;
+    }
+    reg_write(u, u->core->ctrl_reg, ctrl);
+    return 0;
+}
+
+// Busy-poll the status register, or sleep in the UIO fd until the done
+// interrupt, the same completion contract as ip_engine_wait_done()
+static int wait_done(struct crypto_uio *u, uint32_t *status) {
+    const struct uio_core *c = u->core;
+    struct pollfd pfd = { .fd = u->fd, .events = POLLIN };
+    uint64_t deadline;
+    uint32_t count;
+    unsigned int i;
+
+    if (u->use_irq) {
+        if (poll(&pfd, 1, c->timeout_us / 1000 + 1) > 0 &&
+            read(u->fd, &count, sizeof(count)) != sizeof(count))
+            return -1;
+        // Late or lost edge: trust the status register over the IRQ
+        *status = reg_read(u, c->status_reg);
+        if (*status & c->done_mask)
+            return 0;
+        errno = ETIMEDOUT;
+        return -1;
+    }
+
+    deadline = now_ns() + c->timeout_us * 1000ULL;
+    for (i = 1;; i++) {
+        *status = reg_read(u, c->status_reg);
+        if (*status & c->done_mask)
+            return 0;
+        if (i % POLL_CLOCK_EVERY == 0 && now_ns() > deadline) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+    }
+}
+
+static int key_loaded(struct crypto_uio *u, const uint32_t *key, int words) {
+    if (u->key_valid && !memcmp(u->key, key, words * sizeof(*key)))
+        return 1;
+    memcpy(u->key, key, words * sizeof(*key));
+    u->key_valid = 1;
+    return 0;
+}
+
+// des_crypt_op(): key (unless loaded), wait for ready, data, start, result
+int crypto_uio_des(struct crypto_uio *u, struct des_operation *op, int decrypt) {
+    uint32_t key[2] = { (uint32_t)op->key, (uint32_t)(op->key >> 32) };
+    uint32_t status;
+    uint64_t deadline = 0;
+
+    if (u->id != CRYPTO_UIO_DES) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (!key_loaded(u, key, 2)) {
+        reg_write(u, DES_KEY_LO_REG, key[0]);
+        reg_write(u, DES_KEY_HI_REG, key[1]);
+    }
+
+    // Back-to-back blocks only need the core to report ready
+    while (!(reg_read(u, DES_STATUS_REG) & DES_STATUS_READY)) {
+        if (!deadline)
+            deadline = now_ns() + u->core->timeout_us * 1000ULL;
+        else if (now_ns() > deadline) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+    }
+
+    reg_write(u, DES_DATA_LO_REG, (uint32_t)op->input);
+    reg_write(u, DES_DATA_HI_REG, (uint32_t)(op->input >> 32));
+    if (start_op(u, DES_CTRL_START | (decrypt ? DES_CTRL_DECRYPT : 0)) ||
+        wait_done(u, &status))
+        return -1;
+
+    op->output = ((uint64_t)reg_read(u, DES_RES_HI_REG) << 32) | reg_read(u, DES_RES_LO_REG);
+    return 0;
+}
+
+// aes_encrypt_op(): key (unless loaded), data, start, result
+int crypto_uio_aes_encrypt(struct crypto_uio *u, struct aes_operation *op) {
+    uint32_t status;
+    int i;
+
+    if (u->id != CRYPTO_UIO_AES) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (!key_loaded(u, op->key, 4)) {
+        for (i = 0; i < 4; i++)
+            reg_write(u, AES_KEY_REG + i * 4, op->key[i]);
+    }
+    for (i = 0; i < 4; i++)
+        reg_write(u, AES_DATA_IN_REG + i * 4, op->input[i]);
+    if (start_op(u, AES_CTRL_START | AES_CTRL_ENCRYPT) || wait_done(u, &status))
+        return -1;
+
+    for (i = 0; i < 4; i++)
+        op->output[i] = reg_read(u, AES_DATA_OUT_REG + i * 4);
+    return 0;
+}
+
+// gcd_calc_op(): start low, operands, start, result, start low again
+int crypto_uio_gcd(struct crypto_uio *u, struct gcd_operation *op) {
+    uint32_t result;
+
+    if (u->id != CRYPTO_UIO_GCD) {
+        errno = EINVAL;
+        return -1;
+    }
+    reg_write(u, GCD_CTRL_REG, 0);
+    reg_write(u, GCD_X_REG, op->x);
+    reg_write(u, GCD_Y_REG, op->y);
+    if (start_op(u, GCD_CTRL_START) || wait_done(u, &result))
+        return -1;
+    reg_write(u, GCD_CTRL_REG, 0);
+
+    op->result = result & GCD_RESULT_MASK;
+    return 0;
+}
@@ -0,0 +1,38 @@
+#ifndef CRYPTO_UIO_H
+#define CRYPTO_UIO_H
+
+#include "crypto_ioctl.h"
+
+// Kernel-bypass access to the AES/DES/GCD cores. With
+// Device_tree/system-user-uio.dtsi the cores are bound to uio_pdrv_genirq
+// instead of crypto_ips; this library maps a core's register window from
+// /dev/uioN and runs the same register sequences as the driver's
+// des_crypt_op/aes_encrypt_op/gcd_calc_op, so an op costs no syscall at
+// all when polling. With use_irq the done interrupt arrives through the
+// UIO fd instead (one write to unmask, one read to wait).
+//
+// A handle owns its core: crypto_uio_open() takes an exclusive lock on the
+// UIO fd and fails with EBUSY if another process holds it. Handles are not
+// thread-safe.
+
+enum crypto_uio_core {
+    CRYPTO_UIO_AES,
+    CRYPTO_UIO_DES,
+    CRYPTO_UIO_GCD,
+    CRYPTO_UIO_CORES,
+};
+
+struct crypto_uio;
+
+// Find the core's UIO device by its DT node name ("aes_ip", ...) and map
+// it. Returns NULL with errno set, ENODEV if the core isn't under UIO.
+struct crypto_uio *crypto_uio_open(enum crypto_uio_core core, int use_irq);
+void crypto_uio_close(struct crypto_uio *u);
+
+// Same structs and results as the ioctls; 0, or -1 with errno
+// (ETIMEDOUT, EINVAL for the wrong core)
+int crypto_uio_des(struct crypto_uio *u, struct des_operation *op, int decrypt);
+int crypto_uio_aes_encrypt(struct crypto_uio *u, struct aes_operation *op);
+int crypto_uio_gcd(struct crypto_uio *u, struct gcd_operation *op);
+
+#endif // CRYPTO_UIO_H
@@ -5,6 +5,11 @@
 #include <sys/ioctl.h>
 #include <stdint.h>
 #include <string.h>
+#include <poll.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/eventfd.h>
+#include <sys/epoll.h>
 #include "crypto_ioctl.h"
 
 // LED Status Patterns (matching standalone.c)
@@ -22,8 +27,22 @@
 #define MODE_DEBUG      2    // Show detailed debug information
 #define MODE_SIMPLE     3    // Simplified output mode
 
+// Steps of the async workflow, passed as user_data; also the program's
+// step numbers
+#define STEP_DES_ENC1   0
+#define STEP_DES_ENC2   1
+#define STEP_DES_DEC1   2
+#define STEP_DES_DEC2   3
+#define STEP_GCD        4
+#define STEP_AES        5
+
 static int crypto_fd;
 static int selected_mode = 0;
+static int use_async = 0;
+static int use_program = 0;
+static int event_fd = -1;       // button/switch events, -1 if only Enter works
+static int epoll_fd = -1;       // event_fd and stdin
+static int shown_switch = -1;   // last switch value printed by the current stage
 
 // Function prototypes
 int read_switch_value(void);
@@ -33,6 +52,8 @@ int get_switch_value(void);
 void stage1_mode_selection(void);
 int stage2_value_input(void);
 void execute_crypto_workflow(int value1, int value2);
+void execute_crypto_workflow_async(int value1, int value2);
+void execute_crypto_workflow_program(int value1, int value2);
 
 int read_switch_value(void) {
     int switch_val;
@@ -49,6 +70,77 @@ void set_led_status(int pattern) {
     }
 }
 
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Watch stdin and, if the driver has them, button/switch events
+static void events_init(void) {
+    struct epoll_event ev;
+
+    epoll_fd = epoll_create1(0);
+    if (epoll_fd < 0) {
+        perror("epoll_create1 failed");
+        exit(1);
+    }
+    ev.events = EPOLLIN;
+    ev.data.fd = STDIN_FILENO;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, STDIN_FILENO, &ev);
+
+    // A separate fd, since read() on it returns events from now on
+    event_fd = open("/dev/crypto_ips", O_RDONLY | O_NONBLOCK);
+    if (event_fd < 0 || ioctl(event_fd, CRYPTO_EVENT_SETUP) < 0) {
+        perror("Button events unavailable, confirm with Enter");
+        if (event_fd >= 0) close(event_fd);
+        event_fd = -1;
+        return;
+    }
+    ev.data.fd = event_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, event_fd, &ev);
+}
+
+// Sleep until the button or Enter; switch changes on the way go to
+// on_switch (if any) as they happen. Returns the switches at confirmation,
+// -1 if they can't be read.
+static int wait_for_confirm(void (*on_switch)(int value)) {
+    struct crypto_event events[8];
+    struct epoll_event ev;
+    char line[64];
+    int n, i;
+
+    while (1) {
+        if (epoll_wait(epoll_fd, &ev, 1, -1) < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait failed");
+            return read_switch_value();
+        }
+
+        if (ev.data.fd == STDIN_FILENO) {
+            if (fgets(line, sizeof(line), stdin) || event_fd < 0)
+                return read_switch_value();
+            // stdin closed: only the button is left
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, STDIN_FILENO, NULL);
+            continue;
+        }
+
+        n = read(event_fd, events, sizeof(events));
+        for (i = 0; i < n / (int)sizeof(events[0]); i++) {
+            if (events[i].type == CRYPTO_EVENT_SWITCH) {
+                if (on_switch) on_switch(events[i].value & 0x3);
+            } else if (events[i].type == CRYPTO_EVENT_BUTTON) {
+                if (selected_mode == MODE_DEBUG) {
+                    printf("Button: woke up %.1f us after the interrupt\n",
+                           (now_ns() - events[i].timestamp_ns) / 1000.0);
+                }
+                return events[i].value & 0x3;
+            }
+        }
+    }
+}
+
 void wait_for_user_continue(void) {
     if (selected_mode == MODE_AUTO) {
         sleep(2); // Auto mode waits 2 seconds
@@ -56,44 +148,57 @@ void wait_for_user_continue(void) {
     }
 
     if (selected_mode != MODE_SIMPLE) {
-        printf("Press Enter to continue...\n");
+        printf("Press the button or Enter to continue...\n");
+    }
+    wait_for_confirm(NULL);
+}
+
+static void show_test_case(int current_switch) {
+    if (current_switch < 0 || current_switch == shown_switch) return;
+    shown_switch = current_switch;
+    if (selected_mode == MODE_SIMPLE) return;
+
+    printf("Current Switch: SW1=%d SW0=%d = Case %d ",
+          (current_switch>>1)&1, current_switch&1, current_switch);
+    switch(current_switch) {
+        case 0: printf("(Values: 12, 8)\n"); break;
+        case 1: printf("(Values: 48, 18)\n"); break;
+        case 2: printf("(Values: 144, 96)\n"); break;
+        case 3: printf("(Values: 255, 85)\n"); break;
     }
-    getchar();
 }
 
 int get_switch_value(void) {
-    int current_switch = 0;
-    int last_switch = -1;
+    int current_switch;
 
-    while (1) {
-        current_switch = read_switch_value();
-        if (current_switch < 0) return 0;
-
-        if (current_switch != last_switch) {
-            if (selected_mode != MODE_SIMPLE) {
-                printf("Current Switch: SW1=%d SW0=%d = Case %d ",
-                      (current_switch>>1)&1, current_switch&1, current_switch);
-                switch(current_switch) {
-                    case 0: printf("(Values: 12, 8)\n"); break;
-                    case 1: printf("(Values: 48, 18)\n"); break;
-                    case 2: printf("(Values: 144, 96)\n"); break;
-                    case 3: printf("(Values: 255, 85)\n"); break;
-                }
-            }
-            last_switch = current_switch;
-        }
-        usleep(200000); // 200ms delay
+    shown_switch = -1;
+    show_test_case(read_switch_value());
 
-        printf("Press Enter to confirm selection...\n");
-        getchar();
-        printf("Test case confirmed: %d\n\n", current_switch);
-        return current_switch;
+    // Switch changes are shown as they happen, no polling
+    printf("Press the button or Enter to confirm selection...\n");
+    current_switch = wait_for_confirm(show_test_case);
+    if (current_switch < 0) return 0;
+
+    printf("Test case confirmed: %d\n\n", current_switch);
+    return current_switch;
+}
+
+static void show_mode(int current_switch) {
+    if (current_switch < 0 || current_switch == shown_switch) return;
+    shown_switch = current_switch;
+
+    printf("Current selection: SW1=%d SW0=%d = Mode %d - ",
+          (current_switch>>1)&1, current_switch&1, current_switch);
+    switch(current_switch) {
+        case MODE_AUTO:   printf("Auto Mode\n"); break;
+        case MODE_MANUAL: printf("Manual Mode\n"); break;
+        case MODE_DEBUG:  printf("Debug Mode\n"); break;
+        case MODE_SIMPLE: printf("Simple Mode\n"); break;
     }
 }
 
 void stage1_mode_selection(void) {
-    int current_switch = 0;
-    int last_switch = -1;
+    int current_switch;
 
     set_led_status(LED_INPUT);
     printf("\n=== Stage 1: Mode Selection ===\n");
@@ -103,31 +208,15 @@ void stage1_mode_selection(void) {
     printf("0   1   = Manual Mode (manual confirmation for each step)\n");
     printf("1   0   = Debug Mode (show detailed intermediate results)\n");
     printf("1   1   = Simple Mode (minimal output for quick testing)\n");
-    printf("Press Enter to confirm selection\n\n");
+    printf("Press the button or Enter to confirm selection\n\n");
 
-    while (1) {
-        current_switch = read_switch_value();
-        if (current_switch < 0) break;
-
-        if (current_switch != last_switch) {
-            printf("Current selection: SW1=%d SW0=%d = Mode %d - ",
-                  (current_switch>>1)&1, current_switch&1, current_switch);
-            switch(current_switch) {
-                case MODE_AUTO:   printf("Auto Mode\n"); break;
-                case MODE_MANUAL: printf("Manual Mode\n"); break;
-                case MODE_DEBUG:  printf("Debug Mode\n"); break;
-                case MODE_SIMPLE: printf("Simple Mode\n"); break;
-            }
-            last_switch = current_switch;
-        }
-        usleep(200000);
+    shown_switch = -1;
+    show_mode(read_switch_value());
 
-        printf("Press Enter to confirm...\n");
-        getchar();
-        selected_mode = current_switch;
-        printf("Mode confirmed: %d\n\n", selected_mode);
-        break;
-    }
+    current_switch = wait_for_confirm(show_mode);
+    if (current_switch < 0) return;
+    selected_mode = current_switch;
+    printf("Mode confirmed: %d\n\n", selected_mode);
 }
 
 int stage2_value_input(void) {
@@ -300,7 +389,247 @@ void execute_crypto_workflow(int value1, int value2) {
     printf("All cryptographic operations completed!\n");
 }
 
-int main(void) {
+static int async_submit(int fd, uint32_t op, uint64_t step, const void *arg, size_t size) {
+    struct crypto_submit sub;
+
+    memset(&sub, 0, sizeof(sub));
+    sub.op = op;
+    sub.user_data = step;
+    memcpy(&sub.aes, arg, size); // any member of the union
+    if (ioctl(fd, CRYPTO_SUBMIT, &sub) < 0) {
+        perror("Async submit failed");
+        return -1;
+    }
+    if (selected_mode == MODE_DEBUG) {
+        printf("Step %d submitted, tag %u\n", (int)step, sub.tag);
+    }
+    return 0;
+}
+
+// Same workflow without blocking ioctls: both DES encryptions and the GCD
+// start at once, and each completion submits the step that depends on it,
+// so the three engines work in parallel from this one thread
+void execute_crypto_workflow_async(int value1, int value2) {
+    uint64_t des_key = 0x133457799BBCDFF1ULL;
+    struct crypto_async_setup setup;
+    struct crypto_completion comp[8];
+    struct des_operation des_op;
+    struct gcd_operation gcd_op;
+    struct aes_operation aes_op;
+    uint64_t decrypted[2] = {0, 0};
+    struct pollfd pfd;
+    uint64_t count;
+    int async_fd, efd;
+    int pending = 0, failed = 0;
+    int i, n;
+
+    printf("=== Starting Cryptographic Workflow (async) ===\n");
+    printf("Processing values: %d and %d\n\n", value1, value2);
+
+    // A separate fd, since read() on it returns completions from now on
+    async_fd = open("/dev/crypto_ips", O_RDWR);
+    if (async_fd == -1) {
+        perror("cannot open the device crypto_ips!!");
+        set_led_status(LED_ERROR);
+        return;
+    }
+    efd = eventfd(0, EFD_NONBLOCK);
+    setup.eventfd = efd;
+    setup.flags = 0;
+    if (efd < 0 || ioctl(async_fd, CRYPTO_ASYNC_SETUP, &setup) < 0) {
+        perror("Async setup failed");
+        set_led_status(LED_ERROR);
+        if (efd >= 0) close(efd);
+        close(async_fd);
+        return;
+    }
+
+    set_led_status(LED_DES_WORK);
+    des_op.key = des_key;
+    des_op.input = (uint64_t)value1;
+    if (async_submit(async_fd, CRYPTO_OP_DES_ENCRYPT, STEP_DES_ENC1, &des_op, sizeof(des_op)) == 0) pending++;
+    des_op.input = (uint64_t)value2;
+    if (async_submit(async_fd, CRYPTO_OP_DES_ENCRYPT, STEP_DES_ENC2, &des_op, sizeof(des_op)) == 0) pending++;
+    gcd_op.x = value1;
+    gcd_op.y = value2;
+    if (async_submit(async_fd, CRYPTO_OP_GCD_CALC, STEP_GCD, &gcd_op, sizeof(gcd_op)) == 0) pending++;
+    if (pending < 3) failed = 1;
+
+    while (pending > 0) {
+        pfd.fd = efd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, 5000) <= 0) {
+            printf("Async workflow timed out, %d steps pending\n", pending);
+            failed = 1;
+            break;
+        }
+        // The eventfd counts completions, so this many records are queued
+        if (read(efd, &count, sizeof(count)) != sizeof(count)) continue;
+
+        while (count > 0) {
+            n = read(async_fd, comp, (count < 8 ? count : 8) * sizeof(comp[0]));
+            if (n <= 0) {
+                perror("Reading completions failed");
+                failed = 1;
+                pending = 0;
+                break;
+            }
+            n /= sizeof(comp[0]);
+            count -= n;
+
+            for (i = 0; i < n; i++) {
+                int step = (int)comp[i].user_data;
+
+                pending--;
+                if (comp[i].status) {
+                    printf("Step %d failed: %s\n", step, strerror(-comp[i].status));
+                    failed = 1;
+                    continue;
+                }
+                if (selected_mode == MODE_DEBUG) {
+                    printf("Step %d done, tag %u\n", step, comp[i].tag);
+                }
+
+                switch (step) {
+                    case STEP_DES_ENC1:
+                    case STEP_DES_ENC2:
+                        if (selected_mode == MODE_DEBUG) {
+                            printf("Value%d encrypted: 0x%016lX\n", step + 1, comp[i].des.output);
+                        }
+                        des_op = comp[i].des;
+                        des_op.input = comp[i].des.output;
+                        if (async_submit(async_fd, CRYPTO_OP_DES_DECRYPT, step + 2, &des_op, sizeof(des_op)) == 0) pending++;
+                        else failed = 1;
+                        break;
+                    case STEP_DES_DEC1:
+                    case STEP_DES_DEC2:
+                        decrypted[step - STEP_DES_DEC1] = comp[i].des.output;
+                        break;
+                    case STEP_GCD:
+                        printf("GCD(%d, %d) = %d\n", value1, value2, comp[i].gcd.result);
+                        set_led_status(LED_AES_WORK);
+                        aes_op.key[0] = 0x2B7E1516;
+                        aes_op.key[1] = 0x28AED2A6;
+                        aes_op.key[2] = 0xABF71588;
+                        aes_op.key[3] = 0x09CF4F3C;
+                        aes_op.input[0] = comp[i].gcd.result;
+                        aes_op.input[1] = 0x00000000;
+                        aes_op.input[2] = 0x00000000;
+                        aes_op.input[3] = 0x00000000;
+                        if (async_submit(async_fd, CRYPTO_OP_AES_ENCRYPT, STEP_AES, &aes_op, sizeof(aes_op)) == 0) pending++;
+                        else failed = 1;
+                        break;
+                    case STEP_AES:
+                        printf("AES Encrypted Result: 0x%08X%08X%08X%08X\n",
+                               comp[i].aes.output[3], comp[i].aes.output[2],
+                               comp[i].aes.output[1], comp[i].aes.output[0]);
+                        break;
+                }
+            }
+        }
+    }
+
+    // close() waits for anything still in flight
+    close(efd);
+    close(async_fd);
+
+    if (failed) {
+        set_led_status(LED_ERROR);
+        return;
+    }
+    if ((int)(decrypted[0] & 0xFFFFFFFF) == value1 && (int)(decrypted[1] & 0xFFFFFFFF) == value2) {
+        printf("DES verification SUCCESS: decrypted values %d, %d\n",
+               (int)(decrypted[0] & 0xFFFFFFFF), (int)(decrypted[1] & 0xFFFFFFFF));
+    } else {
+        printf("DES verification FAILED! Original: %d,%d, Decrypted: %d,%d\n",
+               value1, value2, (int)(decrypted[0] & 0xFFFFFFFF), (int)(decrypted[1] & 0xFFFFFFFF));
+        set_led_status(LED_ERROR);
+        return;
+    }
+
+    set_led_status(LED_COMPLETE);
+    printf("\n=== Workflow Complete ===\n");
+    printf("All cryptographic operations completed!\n");
+}
+
+// The whole workflow as one CRYPTO_RUN_PROGRAM: the decryptions take the
+// ciphertexts, the GCD takes the decrypted values and the AES step takes the
+// GCD result, all linked inside the driver. The two DES chains run side by
+// side, and no step waits for a round trip through this thread.
+void execute_crypto_workflow_program(int value1, int value2) {
+    uint64_t des_key = 0x133457799BBCDFF1ULL;
+    uint32_t aes_key[4] = { 0x2B7E1516, 0x28AED2A6, 0xABF71588, 0x09CF4F3C };
+    struct crypto_prog_step steps[6];
+    struct crypto_program prog;
+    int i, k;
+
+    printf("=== Starting Cryptographic Workflow (program) ===\n");
+    printf("Processing values: %d and %d\n\n", value1, value2);
+
+    memset(steps, 0, sizeof(steps));
+    for (i = 0; i < 6; i++)
+        for (k = 0; k < CRYPTO_PROGRAM_LINKS; k++)
+            steps[i].links[k].step = CRYPTO_PROGRAM_NONE;
+
+    for (i = 0; i < 2; i++) {
+        // Encrypt value i, then decrypt its output (words 4-5 into 0-1)
+        steps[STEP_DES_ENC1 + i].op = CRYPTO_OP_DES_ENCRYPT;
+        steps[STEP_DES_ENC1 + i].des.input = (uint64_t)(i ? value2 : value1);
+        steps[STEP_DES_ENC1 + i].des.key = des_key;
+        steps[STEP_DES_DEC1 + i].op = CRYPTO_OP_DES_DECRYPT;
+        steps[STEP_DES_DEC1 + i].des.key = des_key;
+        steps[STEP_DES_DEC1 + i].links[0] =
+            (struct crypto_prog_link){ STEP_DES_ENC1 + i, 4, 0, 2 };
+        // Low word of each decrypted value into x (word 0) and y (word 1)
+        steps[STEP_GCD].links[i] = (struct crypto_prog_link){ STEP_DES_DEC1 + i, 4, i, 1 };
+    }
+    steps[STEP_GCD].op = CRYPTO_OP_GCD_CALC;
+    // GCD result (word 2) into input[0] (word 4)
+    steps[STEP_AES].op = CRYPTO_OP_AES_ENCRYPT;
+    memcpy(steps[STEP_AES].aes.key, aes_key, sizeof(aes_key));
+    steps[STEP_AES].links[0] = (struct crypto_prog_link){ STEP_GCD, 2, 4, 1 };
+
+    memset(&prog, 0, sizeof(prog));
+    prog.steps = (uintptr_t)steps;
+    prog.count = 6;
+    set_led_status(LED_DES_WORK);
+    if (ioctl(crypto_fd, CRYPTO_RUN_PROGRAM, &prog) < 0) {
+        perror("Program failed");
+        set_led_status(LED_ERROR);
+        return;
+    }
+    if (prog.done != prog.count) {
+        for (i = 0; i < 6; i++)
+            if (steps[i].status)
+                printf("Step %d failed: %s\n", i, strerror(-steps[i].status));
+        set_led_status(LED_ERROR);
+        return;
+    }
+
+    if (selected_mode == MODE_DEBUG) {
+        printf("Value1 encrypted: 0x%016lX\n", steps[STEP_DES_ENC1].des.output);
+        printf("Value2 encrypted: 0x%016lX\n", steps[STEP_DES_ENC2].des.output);
+    }
+    if ((int)(steps[STEP_DES_DEC1].des.output & 0xFFFFFFFF) != value1 ||
+        (int)(steps[STEP_DES_DEC2].des.output & 0xFFFFFFFF) != value2) {
+        printf("DES verification FAILED! Original: %d,%d, Decrypted: %d,%d\n",
+               value1, value2, (int)(steps[STEP_DES_DEC1].des.output & 0xFFFFFFFF),
+               (int)(steps[STEP_DES_DEC2].des.output & 0xFFFFFFFF));
+        set_led_status(LED_ERROR);
+        return;
+    }
+    printf("DES verification SUCCESS: decrypted values %d, %d\n", value1, value2);
+    printf("GCD(%d, %d) = %d\n", value1, value2, steps[STEP_GCD].gcd.result);
+    printf("AES Encrypted Result: 0x%08X%08X%08X%08X\n",
+           steps[STEP_AES].aes.output[3], steps[STEP_AES].aes.output[2],
+           steps[STEP_AES].aes.output[1], steps[STEP_AES].aes.output[0]);
+
+    set_led_status(LED_COMPLETE);
+    printf("\n=== Workflow Complete ===\n");
+    printf("All cryptographic operations completed!\n");
+}
+
+int main(int argc, char **argv) {
     int values;
     int value1, value2;
 
@@ -309,6 +638,17 @@ int main(void) {
     printf("    Supporting DES, GCD, AES with Interrupt Control\n");
     printf("================================================\n");
 
+    // "async": submit ops without blocking and collect completions
+    if (argc > 1 && strcmp(argv[1], "async") == 0) {
+        use_async = 1;
+        printf("Async mode: DES, GCD and AES run in parallel\n");
+    }
+    // "program": the whole workflow in one CRYPTO_RUN_PROGRAM
+    if (argc > 1 && strcmp(argv[1], "program") == 0) {
+        use_program = 1;
+        printf("Program mode: the workflow runs in the driver in one call\n");
+    }
+
     // Open crypto device
     crypto_fd = open("/dev/crypto_ips", O_RDWR);
     if (crypto_fd == -1) {
@@ -317,6 +657,7 @@ int main(void) {
     }
 
     printf("Crypto device opened successfully\n");
+    events_init();
 
     while (1) {
         set_led_status(LED_IDLE);
@@ -330,16 +671,23 @@ int main(void) {
         value2 = values & 0xFFFF;
 
         // Stage 3-7: Execute crypto workflow
-        execute_crypto_workflow(value1, value2);
+        if (use_async)
+            execute_crypto_workflow_async(value1, value2);
+        else if (use_program)
+            execute_crypto_workflow_program(value1, value2);
+        else
+            execute_crypto_workflow(value1, value2);
 
-        printf("\nPress Enter to restart...\n");
-        getchar();
+        printf("\nPress the button or Enter to restart...\n");
+        wait_for_confirm(NULL);
 
         printf("\n================================================\n");
         printf("Restarting system...\n");
         printf("================================================\n");
     }
 
+    if (event_fd >= 0) close(event_fd);
+    close(epoll_fd);
     close(crypto_fd);
     return 0;
 }
\ No newline at end of file
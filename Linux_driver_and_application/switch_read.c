@@ -2,10 +2,48 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <string.h>
 #include <sys/ioctl.h>
+#include <sys/epoll.h>
 #include "crypto_ioctl.h"
 
-int main(void) {
+// "watch": print button and switch events as they arrive
+static int watch_events(int crypto_fd) {
+    struct crypto_event events[8];
+    struct epoll_event ev = { .events = EPOLLIN };
+    int epoll_fd, n, i;
+
+    if (ioctl(crypto_fd, CRYPTO_EVENT_SETUP) < 0) {
+        perror("CRYPTO_EVENT_SETUP failed");
+        return 1;
+    }
+    epoll_fd = epoll_create1(0);
+    ev.data.fd = crypto_fd;
+    if (epoll_fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, crypto_fd, &ev) < 0) {
+        perror("epoll setup failed");
+        return 1;
+    }
+
+    printf("Waiting for button presses and switch changes (Ctrl-C to stop)\n");
+    while (epoll_wait(epoll_fd, &ev, 1, -1) >= 0) {
+        n = read(crypto_fd, events, sizeof(events));
+        for (i = 0; i < n / (int)sizeof(events[0]); i++) {
+            printf("%llu.%06llu %s SW1=%d SW0=%d",
+                   (unsigned long long)events[i].timestamp_ns / 1000000000ULL,
+                   (unsigned long long)events[i].timestamp_ns / 1000 % 1000000,
+                   events[i].type == CRYPTO_EVENT_BUTTON ? "button" : "switch",
+                   (events[i].value >> 1) & 1, events[i].value & 1);
+            if (events[i].dropped)
+                printf(" (%u events lost)", events[i].dropped);
+            printf("\n");
+        }
+    }
+    perror("epoll_wait failed");
+    close(epoll_fd);
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
     int crypto_fd;
     unsigned int switch_data;
 
@@ -15,8 +53,15 @@ int main(void) {
         exit(1);
     }
 
+    if (argc > 1 && strcmp(argv[1], "watch") == 0) {
+        int ret = watch_events(crypto_fd);
+
+        close(crypto_fd);
+        return ret;
+    }
+
     // Method 1: Using read() (compatible with old myhwip style)
-    if (read(crypto_fd, &switch_data, sizeof(char))) {
+    if (read(crypto_fd, &switch_data, sizeof(char)) != sizeof(char)) {
         perror("read() error!");
         close(crypto_fd);
         exit(1);
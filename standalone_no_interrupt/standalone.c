@@ -23,6 +23,13 @@
 #define DATA_OUT_MIDLOW_OFFSET  0x30
 #define DATA_OUT_LOW_OFFSET     0x34
 
+// DES IP control (slv_reg4) and status (slv_reg7) bits
+#define DES_CTRL_START          0x01    // self-clearing
+#define DES_CTRL_DECRYPT        0x02
+#define DES_STATUS_DONE         0x01
+#define DES_STATUS_READY        0x02    // core idle, next block can be started
+#define DES_POLL_LIMIT          100000  // status reads before giving up
+
 // Function prototypes
 uint64_t des_encrypt(uint64_t plaintext, uint64_t key);
 uint64_t des_decrypt(uint64_t ciphertext, uint64_t key);
@@ -122,10 +129,14 @@ uint64_t des_encrypt(uint64_t plaintext, uint64_t key) {
     uint32_t status;
     int timeout = 0;
     
-    // Reset DES IP
-    DESIP_mWriteReg(XPAR_DESIP_0_S00_AXI_BASEADDR, DESIP_S00_AXI_SLV_REG4_OFFSET, 0);
-    DESIP_mWriteReg(XPAR_DESIP_0_S00_AXI_BASEADDR, DESIP_S00_AXI_SLV_REG7_OFFSET, 0);
-    usleep(10000);
+    // Wait until the core can take the next block (no reset delay needed)
+    while ((DESIP_mReadReg(XPAR_DESIP_0_S00_AXI_BASEADDR, DESIP_S00_AXI_SLV_REG7_OFFSET) & DES_STATUS_READY) == 0) {
+        if (++timeout > DES_POLL_LIMIT) {
+            xil_printf("DES core not ready!\r\n");
+            break;
+        }
+    }
+    timeout = 0;
     
     // Write plaintext
     DESIP_mWriteReg(XPAR_DESIP_0_S00_AXI_BASEADDR, DESIP_S00_AXI_SLV_REG0_OFFSET, pt_low);
@@ -135,27 +146,23 @@ uint64_t des_encrypt(uint64_t plaintext, uint64_t key) {
     DESIP_mWriteReg(XPAR_DESIP_0_S00_AXI_BASEADDR, DESIP_S00_AXI_SLV_REG2_OFFSET, key_low);
     DESIP_mWriteReg(XPAR_DESIP_0_S00_AXI_BASEADDR, DESIP_S00_AXI_SLV_REG3_OFFSET, key_high);
     
-    // Start encryption
-    DESIP_mWriteReg(XPAR_DESIP_0_S00_AXI_BASEADDR, DESIP_S00_AXI_SLV_REG4_OFFSET, 0x01);
+    // Start encryption (start bit clears itself)
+    DESIP_mWriteReg(XPAR_DESIP_0_S00_AXI_BASEADDR, DESIP_S00_AXI_SLV_REG4_OFFSET, DES_CTRL_START);
     
     // Wait for completion
     do {
-        usleep(1000);
         status = DESIP_mReadReg(XPAR_DESIP_0_S00_AXI_BASEADDR, DESIP_S00_AXI_SLV_REG7_OFFSET);
         timeout++;
-        if (timeout > 100) {
+        if (timeout > DES_POLL_LIMIT) {
             xil_printf("DES encryption timeout!\r\n");
             break;
         }
-    } while ((status & 0x01) == 0);
+    } while ((status & DES_STATUS_DONE) == 0);
     
     // Read result
     res_low  = DESIP_mReadReg(XPAR_DESIP_0_S00_AXI_BASEADDR, DESIP_S00_AXI_SLV_REG5_OFFSET);
     res_high = DESIP_mReadReg(XPAR_DESIP_0_S00_AXI_BASEADDR, DESIP_S00_AXI_SLV_REG6_OFFSET);
     
-    // Clear start signal
-    DESIP_mWriteReg(XPAR_DESIP_0_S00_AXI_BASEADDR, DESIP_S00_AXI_SLV_REG4_OFFSET, 0);
-    
     return ((uint64_t)res_high << 32) | res_low;
 }
 
@@ -168,10 +175,14 @@ uint64_t des_decrypt(uint64_t ciphertext, uint64_t key) {
     uint32_t status;
     int timeout = 0;
     
-    // Reset DES IP
-    DESIP_mWriteReg(XPAR_DESIP_0_S00_AXI_BASEADDR, DESIP_S00_AXI_SLV_REG4_OFFSET, 0);
-    DESIP_mWriteReg(XPAR_DESIP_0_S00_AXI_BASEADDR, DESIP_S00_AXI_SLV_REG7_OFFSET, 0);
-    usleep(10000);
+    // Wait until the core can take the next block (no reset delay needed)
+    while ((DESIP_mReadReg(XPAR_DESIP_0_S00_AXI_BASEADDR, DESIP_S00_AXI_SLV_REG7_OFFSET) & DES_STATUS_READY) == 0) {
+        if (++timeout > DES_POLL_LIMIT) {
+            xil_printf("DES core not ready!\r\n");
+            break;
+        }
+    }
+    timeout = 0;
     
     // Write ciphertext
     DESIP_mWriteReg(XPAR_DESIP_0_S00_AXI_BASEADDR, DESIP_S00_AXI_SLV_REG0_OFFSET, ct_low);
@@ -181,27 +192,23 @@ uint64_t des_decrypt(uint64_t ciphertext, uint64_t key) {
     DESIP_mWriteReg(XPAR_DESIP_0_S00_AXI_BASEADDR, DESIP_S00_AXI_SLV_REG2_OFFSET, key_low);
     DESIP_mWriteReg(XPAR_DESIP_0_S00_AXI_BASEADDR, DESIP_S00_AXI_SLV_REG3_OFFSET, key_high);
     
-    // Start decryption (bit0=start, bit1=1 for decrypt)
-    DESIP_mWriteReg(XPAR_DESIP_0_S00_AXI_BASEADDR, DESIP_S00_AXI_SLV_REG4_OFFSET, 0x03);
+    // Start decryption (start bit clears itself)
+    DESIP_mWriteReg(XPAR_DESIP_0_S00_AXI_BASEADDR, DESIP_S00_AXI_SLV_REG4_OFFSET, DES_CTRL_START | DES_CTRL_DECRYPT);
     
     // Wait for completion
     do {
-        usleep(1000);
         status = DESIP_mReadReg(XPAR_DESIP_0_S00_AXI_BASEADDR, DESIP_S00_AXI_SLV_REG7_OFFSET);
         timeout++;
-        if (timeout > 100) {
+        if (timeout > DES_POLL_LIMIT) {
             xil_printf("DES decryption timeout!\r\n");
             break;
         }
-    } while ((status & 0x01) == 0);
+    } while ((status & DES_STATUS_DONE) == 0);
     
     // Read result
     res_low  = DESIP_mReadReg(XPAR_DESIP_0_S00_AXI_BASEADDR, DESIP_S00_AXI_SLV_REG5_OFFSET);
     res_high = DESIP_mReadReg(XPAR_DESIP_0_S00_AXI_BASEADDR, DESIP_S00_AXI_SLV_REG6_OFFSET);
     
-    // Clear start signal
-    DESIP_mWriteReg(XPAR_DESIP_0_S00_AXI_BASEADDR, DESIP_S00_AXI_SLV_REG4_OFFSET, 0);
-    
     return ((uint64_t)res_high << 32) | res_low;
 }
 
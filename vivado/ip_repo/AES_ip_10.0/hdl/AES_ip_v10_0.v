@@ -15,7 +15,7 @@
 	)
 	(
 		// Users to add ports here
-
+		output wire intr,
 		// User ports ends
 		// Do not modify the ports beyond this line
 
@@ -48,6 +48,7 @@
 		.C_S_AXI_DATA_WIDTH(C_S00_AXI_DATA_WIDTH),
 		.C_S_AXI_ADDR_WIDTH(C_S00_AXI_ADDR_WIDTH)
 	) AES_ip_v10_0_S00_AXI_inst (
+		.intr(intr),
 		.S_AXI_ACLK(s00_axi_aclk),
 		.S_AXI_ARESETN(s00_axi_aresetn),
 		.S_AXI_AWADDR(s00_axi_awaddr),
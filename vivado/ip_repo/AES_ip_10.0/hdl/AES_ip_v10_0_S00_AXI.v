@@ -14,7 +14,8 @@ module AES_ip_v10_0_S00_AXI #
 )
 (
     // Users to add ports here
-
+    // Done interrupt, rising edge per completed block
+    output wire intr,
     // User ports ends
     // Do not modify the ports beyond this line
 
@@ -104,7 +105,7 @@ localparam integer OPT_MEM_ADDR_BITS = 3;
 //-- AES Register Map (14 registers total)
 //----------------------------------------------
 // Register Map:
-// 0x00: Control Register    [1:0] = {mode, start}, [31:2] = reserved
+// 0x00: Control Register    [2:0] = {irq_en, mode, start}, [31] = soft reset, [30:3] = reserved
 // 0x04: Status Register     [0] = done, [1] = busy, [31:2] = reserved  
 // 0x08: Key[63:32]          Upper 32 bits of first 64-bit key load
 // 0x0C: Key[31:0]           Lower 32 bits of first 64-bit key load
@@ -149,6 +150,7 @@ wire aes_mode;
 wire aes_load;
 wire aes_done;
 wire aes_reset;
+wire core_resetn;      // bus reset or soft reset, see below
 
 // AES data signals  
 wire [63:0] aes_key;
@@ -166,7 +168,7 @@ reg operation_complete;
 // Extract control signals from registers
 assign aes_start = start_edge_detected;
 assign aes_mode = slv_reg0[1];  // 1: encrypt, 0: decrypt
-assign aes_reset = ~S_AXI_ARESETN;
+assign aes_reset = ~core_resetn;
 
 // AES data routing based on load phase
 assign aes_key = load_phase ? {slv_reg4, slv_reg5} : {slv_reg2, slv_reg3};
@@ -194,7 +196,7 @@ aes128_fast aes_core (
 //-- AES Control Logic (Based on Testbench Pattern)
 //----------------------------------------------
 always @(posedge S_AXI_ACLK) begin
-    if (~S_AXI_ARESETN) begin
+    if (~core_resetn) begin
         load_phase <= 1'b0;
         aes_busy <= 1'b0;
         start_prev <= 1'b0;
@@ -256,7 +258,7 @@ end
 
 // Update output registers when AES operation completes
 always @(posedge S_AXI_ACLK) begin
-    if (~S_AXI_ARESETN) begin
+    if (~core_resetn) begin
         slv_reg10 <= 32'h0;
         slv_reg11 <= 32'h0;
         slv_reg12 <= 32'h0;
@@ -271,7 +273,7 @@ end
 
 // Update status register
 always @(posedge S_AXI_ACLK) begin
-    if (~S_AXI_ARESETN) begin
+    if (~core_resetn) begin
         slv_reg1 <= 32'h0;
     end else begin
         slv_reg1[0] <= aes_done && operation_complete;    // Done flag
@@ -280,6 +282,55 @@ always @(posedge S_AXI_ACLK) begin
     end
 end
 
+//----------------------------------------------
+//-- Done Interrupt
+//----------------------------------------------
+// done_irq is set on the rising edge of the done flag and cleared by any
+// write to the control register, so re-arming the core never produces an
+// edge for the previous block.
+reg done_irq;
+reg result_valid_prev;
+wire result_valid = aes_done && operation_complete;
+wire ctrl_wr = slv_reg_wren && (axi_awaddr[ADDR_LSB+OPT_MEM_ADDR_BITS:ADDR_LSB] == 4'h0);
+
+always @(posedge S_AXI_ACLK) begin
+    if (~core_resetn) begin
+        done_irq <= 1'b0;
+        result_valid_prev <= 1'b0;
+    end else begin
+        result_valid_prev <= result_valid;
+        if (ctrl_wr)
+            done_irq <= 1'b0;
+        else if (result_valid && !result_valid_prev)
+            done_irq <= 1'b1;
+    end
+end
+
+assign intr = done_irq & slv_reg0[2];
+
+//----------------------------------------------
+//-- Soft Reset
+//----------------------------------------------
+// Writing control bit 31 holds the AES core, the load sequencer, status,
+// output and interrupt logic in reset for SOFT_RESET_CYCLES clocks. The AXI
+// interface and the key/data registers are left alone. Bit 31 reads back as
+// 1 until the reset is over, so software can tell a wedged core is idle
+// again (and that the bitstream has the reset at all).
+localparam integer SOFT_RESET_CYCLES = 4;
+reg [2:0] soft_reset_cnt;
+wire soft_reset = (soft_reset_cnt != 3'd0);
+
+assign core_resetn = S_AXI_ARESETN & ~soft_reset;
+
+always @(posedge S_AXI_ACLK) begin
+    if (~S_AXI_ARESETN)
+        soft_reset_cnt <= 3'd0;
+    else if (ctrl_wr && S_AXI_WSTRB[3] && S_AXI_WDATA[31])
+        soft_reset_cnt <= SOFT_RESET_CYCLES;
+    else if (soft_reset)
+        soft_reset_cnt <= soft_reset_cnt - 1'b1;
+end
+
 // I/O Connections assignments
 assign S_AXI_AWREADY = axi_awready;
 assign S_AXI_WREADY = axi_wready;
@@ -441,6 +492,11 @@ begin
     if (load_state == 3'd4) begin
         slv_reg0[0] <= 1'b0;
     end
+
+    // Soft reset bit clears once the reset is over
+    if (slv_reg0[31] && !soft_reset && !slv_reg_wren) begin
+        slv_reg0[31] <= 1'b0;
+    end
   end
 end    
 
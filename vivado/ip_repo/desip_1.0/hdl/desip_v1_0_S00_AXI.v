@@ -14,7 +14,8 @@
 	)
 	(
 		// Users to add ports here
-
+		// Done interrupt, rising edge per completed block
+		output wire intr,
 		// User ports ends
 		// Do not modify the ports beyond this line
 
@@ -133,6 +134,9 @@
 	wire des_e_data_rdy;
 	wire des_decrypt;
 	wire des_reset;
+	wire core_resetn;          // bus reset or soft reset, see below
+	reg [2:0] soft_reset_cnt;
+	wire soft_reset = (soft_reset_cnt != 3'd0);
 	wire [1:64] des_data_out;   // DES uses [1:64] bit ordering
 	wire des_d_data_rdy;
 	
@@ -402,6 +406,14 @@
 	                    end
 	        endcase
 	      end
+	    else begin
+	      // Start is self-clearing: drop it once the edge has been sampled
+	      if (slv_reg4[0] && start_prev)
+	        slv_reg4[0] <= 1'b0;
+	      // So is soft reset, once the reset is over
+	      if (slv_reg4[31] && !soft_reset)
+	        slv_reg4[31] <= 1'b0;
+	    end
 	  end
 	end    
 
@@ -689,8 +701,11 @@
 	assign des_key[63] = key_std[62];
 	assign des_key[64] = key_std[63];
 	
+	// Control register (slv_reg4): [0] = start (self-clearing), [1] = decrypt, [2] = done irq enable,
+	//                              [31] = soft reset (self-clearing)
+	// Status register (slv_reg7):  [0] = done, [1] = ready for the next block
 	assign des_decrypt = slv_reg4[1];            // Decrypt control bit
-	assign des_reset = ~S_AXI_ARESETN;           // Active high reset for DES
+	assign des_reset = ~core_resetn;             // Active high reset for DES
 	
 	// Convert DES output from [1:64] to [63:0] format
 	assign data_out_std[0] = des_data_out[1];
@@ -759,12 +774,11 @@
 	assign data_out_std[63] = des_data_out[64];
 	
     // Start signal edge detection and pulse generation
-    reg start_prev;
     reg [2:0] start_pulse_counter;
     wire start_pulse;
     
     always @(posedge S_AXI_ACLK) begin
-        if (S_AXI_ARESETN == 1'b0) begin
+        if (core_resetn == 1'b0) begin
             start_prev <= 1'b0;
             start_pulse_counter <= 3'b0;
         end else begin
@@ -786,14 +800,15 @@
     //-- DES Output and Status Logic
     //----------------------------------------------
     always @(posedge S_AXI_ACLK) begin
-        if (S_AXI_ARESETN == 1'b0) begin
+        if (core_resetn == 1'b0) begin
             slv_reg5 <= 32'b0;
             slv_reg6 <= 32'b0;
-            slv_reg7 <= 32'b0;
+            slv_reg7 <= 32'h2;                    // Ready out of reset
         end else begin
-            // Clear done flag when new operation starts
+            // Clear done and ready flags when new operation starts
             if (start_pulse) begin
                 slv_reg7[0] <= 1'b0;
+                slv_reg7[1] <= 1'b0;
                 slv_reg5 <= 32'b0;  // Clear previous results
                 slv_reg6 <= 32'b0;
             end
@@ -802,10 +817,52 @@
                 slv_reg5 <= data_out_std[31:0];   // Lower 32 bits
                 slv_reg6 <= data_out_std[63:32];  // Upper 32 bits
                 slv_reg7[0] <= 1'b1;              // Set done flag
+                slv_reg7[1] <= 1'b1;              // Core can take the next block
             end
         end
     end
 	
+    //----------------------------------------------
+    //-- Done Interrupt
+    //----------------------------------------------
+    // done_irq is set when a result is latched and cleared by any write to
+    // the control register, so a stale done flag can never produce an edge
+    // when software re-arms the next block.
+    reg done_irq;
+    wire ctrl_wr = slv_reg_wren && (axi_awaddr[ADDR_LSB+OPT_MEM_ADDR_BITS:ADDR_LSB] == 4'h4);
+
+    always @(posedge S_AXI_ACLK) begin
+        if (core_resetn == 1'b0) begin
+            done_irq <= 1'b0;
+        end else if (ctrl_wr) begin
+            done_irq <= 1'b0;
+        end else if (des_d_data_rdy) begin
+            done_irq <= 1'b1;
+        end
+    end
+
+    assign intr = done_irq & slv_reg4[2];
+
+    //----------------------------------------------
+    //-- Soft Reset
+    //----------------------------------------------
+    // Writing control bit 31 holds the DES core, the start pulse, status,
+    // result and interrupt logic in reset for SOFT_RESET_CYCLES clocks; the
+    // AXI interface and the key/data registers are left alone. The core is
+    // ready again afterwards. Bit 31 reads back as 1 until then.
+    localparam integer SOFT_RESET_CYCLES = 4;
+
+    assign core_resetn = S_AXI_ARESETN & ~soft_reset;
+
+    always @(posedge S_AXI_ACLK) begin
+        if (S_AXI_ARESETN == 1'b0)
+            soft_reset_cnt <= 3'd0;
+        else if (ctrl_wr && S_AXI_WSTRB[3] && S_AXI_WDATA[31])
+            soft_reset_cnt <= SOFT_RESET_CYCLES;
+        else if (soft_reset)
+            soft_reset_cnt <= soft_reset_cnt - 1'b1;
+    end
+	
 	// Instantiate DES core
 	des des_core_inst (
 	    .reset(des_reset),